@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gramparser.h"
+#include "gramvm.h"
+
+/**
+ * compares the startup of a large generated grammar (a rule per keyword,
+ * matched in any case, as @KEYWORD does) built with gramparser_add and
+ * compiled, with loading it compiled from a file with load_gram_program.
+ */
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the n-th keyword: kw_a, kw_b, ..., kw_z, kw_ab, kw_bb, ...
+static void keyword(char * buf, int n) {
+  int len = sprintf(buf, "kw_");
+  do {
+    buf[len++] = 'a' + n % 26;
+    n /= 26;
+  } while (n);
+  buf[len] = '\0';
+}
+
+static struct gram_program * build(int count, char ** names, char * main_def) {
+  struct gramparser * gp = new_gramparser();
+  char def[256];
+  int i, j, len;
+  gramparser_add(gp, "ident_char", "'a'..'z' / 'A'..'Z' / '0'..'9' / '_'");
+  for (i = 0; i < count; i++) {
+    for (j = len = 0; names[i][j]; j++)
+      len += sprintf(def + len, "('%c'/'%c')", names[i][j], names[i][j] >= 'a' && names[i][j] <= 'z'
+	  ? names[i][j] - 'a' + 'A' : names[i][j]);
+    sprintf(def + len, "!ident_char");
+    gramparser_add(gp, names[i], def);
+  }
+  gramparser_add(gp, "main", main_def);
+  gramparser_optimize(gp, "main");
+  gram_analyze(gramparser_get_gram(gp, "main"));
+  // gp is never freed: the program calls the spans it made.
+  return compile_gram(gramparser_get_gram(gp, "main"));
+}
+
+int main(int argc, char * argv[]) {
+  int i, len, count = 5000, runs = 5;
+  const char * path = "loadbench.prog";
+  for (i = 1; i < argc; i++) {
+    if (!strcmp("-n", argv[i]) && i < argc - 1)
+      count = atoi(argv[++i]);
+    else if (!strcmp("-r", argv[i]) && i < argc - 1)
+      runs = atoi(argv[++i]);
+    else {
+      printf("Usage: %s [-n keywords] [-r runs]\n", *argv);
+      return 1;
+    }
+  }
+  char ** names = malloc(sizeof (char *) * count);
+  char * main_def = malloc(16 * count + 32);
+  len = sprintf(main_def, "(");
+  for (i = 0; i < count; i++) {
+    names[i] = malloc(16);
+    keyword(names[i], i);
+    len += sprintf(main_def + len, "%s%s", i ? " / " : "", names[i]);
+  }
+  sprintf(main_def + len, ") !.");
+  double best_build = 1e9, best_load = 1e9, start, elapsed;
+  for (i = 0; i < runs; i++) {
+    start = now();
+    struct gram_program * prog = build(count, names, main_def);
+    if ((elapsed = now() - start) < best_build)
+      best_build = elapsed;
+    if (!i && save_gram_program(prog, path))
+      return 1;
+  }
+  for (i = 0; i < runs; i++) {
+    start = now();
+    struct gram_program * prog = load_gram_program(path);
+    if ((elapsed = now() - start) < best_load)
+      best_load = elapsed;
+    int last = 0;
+    if (!prog || match_program(prog, "KW_AB", &last) != 5) {
+      fprintf(stderr, "the loaded grammar doesn't match\n");
+      return 1;
+    }
+    free_gram_program(prog);
+  }
+  unlink(path);
+  printf("%d keywords: gramparser_add + compile %.2f ms, load_gram_program %.3f ms (%.0fx)\n",
+      count, best_build * 1000, best_load * 1000, best_build / best_load);
+  return 0;
+}
@@ -1,6 +1,9 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // memrchr, memmem
 
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +11,7 @@
 #include <stdbool.h>
 
 #include "gramparser.h"
+#include "gramvm.h"
 
 static void add_gram(struct gramparser * gp, const char * name, const char * def) {
   int i, res = gramparser_add(gp, name, def);
@@ -18,54 +22,113 @@ static void add_gram(struct gramparser * gp, const char * name, const char * def
   }
 }
 
-void colorize(char * text, int * cursor, struct ast * ast, int depth) {
-  printf("\033[3%dm", depth%6 + 1);
+void colorize(FILE * out, const char * text, int * cursor, struct ast * ast, int depth) {
+  fprintf(out, "\033[3%dm", depth%6 + 1);
   struct ast ** children = (struct ast **)&ast->children;
   while (*cursor < ast->from + ast->len) {
     if (*children && *cursor >= (*children)->from) {
-      colorize(text, cursor, *children, depth + 1);
-      printf("\033[3%dm", depth%6 + 1);
+      colorize(out, text, cursor, *children, depth + 1);
+      fprintf(out, "\033[3%dm", depth%6 + 1);
       children++;
       continue;
     }
-    putchar(text[(*cursor)++]);
+    putc(text[(*cursor)++], out);
   }
 }
 
-static void void_puts(void * str) {
-  puts((char *)str);
+// prints the tree as dump_ast does (the user data are names), to any file.
+static void print_ast(FILE * out, struct ast * ast, int indent) {
+  int ch;
+  fprintf(out, "%*sfrom=%d, len=%d, userdata=%s\n", indent, "",
+      ast->from, ast->len, (char *)ast->user_data);
+  for (ch = 0; ast->children[ch]; ch++)
+    print_ast(out, ast->children[ch], indent + 2);
 }
 
-static void parse_file(struct gram * g, int delim, bool use_colorize, bool use_ast, bool quiet, FILE * fd) {
+struct options {
+  struct gram * g;
+  struct gram_program * prog;
+  int delim, flags;
+  bool use_colorize, use_ast, quiet, only_matching;
+  // every match contains literal (at its start if anchored), so the
+  // records without it aren't even matched.
+  char literal[64];
+  int literal_len, anchored;
+};
+
+// the buffers of a thread matching records.
+struct matcher {
+  struct gram_context * ctx;
+  struct ast_arena * arena;
+};
+
+struct matches {
+  const struct options * o;
+  const char * record;
+  FILE * out;
+};
+
+static void print_match(int from, int len, void * privdata) {
+  struct matches * m = privdata;
+  if (!m->o->quiet) {
+    fwrite(m->record + from, 1, len, m->out);
+    putc(m->o->delim, m->out);
+  }
+}
+
+static void process_record(const struct options * o, struct matcher * m,
+    const char * record, int len, FILE * out) {
+  int last = 0;
+  if (o->literal_len && (o->anchored
+	? len < o->literal_len || memcmp(record, o->literal, o->literal_len)
+	: !memmem(record, len, o->literal, o->literal_len)))
+    return;
+  if (o->only_matching) {
+    struct matches matches = {o, record, out};
+    search_all(m->ctx, record, len, o->g, o->flags, &print_match, &matches);
+    return;
+  }
+  if (!o->use_ast && (o->quiet || !o->use_colorize)) {
+    // the tree is not needed, so just recognize the record.
+    if ((o->prog ? match_program_n(o->prog, record, len, &last)
+	  : match_context(m->ctx, record, len, o->g, &last, o->flags)) >= 0 && !o->quiet) {
+      fwrite(record, 1, len, out);
+      putc(o->delim, out);
+    }
+    return;
+  }
+  struct ast * raw_ast = o->prog ? parse_program_arena_n(m->arena, o->prog, record, len, &last)
+    : parse_context(m->ctx, m->arena, record, len, o->g, &last, o->flags);
+  if (raw_ast) {
+    struct ast * ast = purge_ast(raw_ast);
+    if (!o->quiet) {
+      if (o->use_colorize) {
+	int cursor = 0;
+	colorize(out, record, &cursor, ast, 0);
+	fprintf(out, "\033[0m");
+	fwrite(record + cursor, 1, len - cursor, out);
+      } else {
+	fwrite(record, 1, len, out);
+      }
+      putc(o->delim, out);
+    }
+    if (o->use_ast)
+      print_ast(out, ast, 2);
+    free_ast(ast);
+  }
+  ast_arena_reset(m->arena);
+}
+
+// reads the records of a pipe one by one.
+static void parse_file(const struct options * o, struct matcher * m, FILE * fd) {
   static char * buffer = NULL;
   size_t buffer_size = 0;
   ssize_t res;
   errno = 0;
-  while ((res = getdelim(&buffer, &buffer_size, delim, fd)) != -1) {
-    if (delim && res > 0 && buffer[res-1] == delim) {
-      buffer[res-1] = 0;
-    } else {
-      buffer[res] = 0;
-    }
-    int last;
-    struct ast * raw_ast = parse(buffer, g, &last);
-    if (raw_ast) {
-      struct ast * ast = purge_ast(raw_ast);
-      if (!quiet) {
-	if (use_colorize) {
-	  int cursor = 0;
-	  colorize(buffer, &cursor, ast, 0);
-	  printf("\033[0m%s%c", buffer + cursor, delim);
-	} else {
-	  printf("%s%c", buffer, delim);
-	}
-      }
-      if (use_ast) {
-	dump_ast(ast, 2, &void_puts);
-      }
-      free_ast(ast);
-      free_ast(raw_ast);
-    }
+  while ((res = getdelim(&buffer, &buffer_size, o->delim, fd)) != -1) {
+    // records may have NULs, so they are parsed by length.
+    int len = res > 0 && buffer[res-1] == o->delim ? res - 1 : res;
+    process_record(o, m, buffer, len, stdout);
   }
   if (errno) {
     perror("Error getting line");
@@ -73,17 +136,248 @@ static void parse_file(struct gram * g, int delim, bool use_colorize, bool use_a
   }
 }
 
+// matches every record of text, in place.
+static void match_records(const struct options * o, struct matcher * m,
+    const char * text, size_t len, FILE * out) {
+  const char * record = text, * end = text + len;
+  while (record < end) {
+    // (memchr is vectorized by the libc)
+    const char * next = memchr(record, o->delim, end - record);
+    int record_len = next ? next - record : end - record;
+    process_record(o, m, record, record_len, out);
+    record += record_len + 1;
+  }
+}
+
+/************************************************************************\
+*				  INPUT					 *
+* Regular files are mapped and matched in place, other inputs (pipes,	 *
+* terminals) are read in chunks of whole records.			 *
+\************************************************************************/
+
+#define CHUNK_SIZE (1 << 20)
+
+struct input {
+  FILE * fd;
+  const char * map; // the whole file, or NULL if it's read.
+  size_t map_len, map_off;
+  char * rest; // the incomplete record read after the last chunk.
+  size_t rest_len, rest_size;
+};
+
+struct chunk {
+  const char * text; // whole records (the last one may lack its delim at the end).
+  size_t len;
+  char * buf; // where text is read to, unless it's mapped.
+  size_t size;
+  char * out; // what the records printed.
+  size_t out_len;
+  bool done;
+};
+
+static bool map_input(struct input * in, FILE * fd) {
+  struct stat st;
+  memset(in, 0, sizeof (struct input));
+  in->fd = fd;
+  if (fstat(fileno(fd), &st) || !S_ISREG(st.st_mode) || !st.st_size)
+    return false;
+  void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+  if (map == MAP_FAILED)
+    return false;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  in->map = map;
+  in->map_len = st.st_size;
+  return true;
+}
+
+// takes about CHUNK_SIZE bytes of whole records, false at the end of input.
+static bool next_chunk(struct input * in, int delim, struct chunk * c) {
+  char * cut = NULL;
+  size_t n;
+  if (in->map) {
+    const char * end = NULL;
+    c->text = in->map + in->map_off;
+    c->len = in->map_len - in->map_off;
+    if (c->len > CHUNK_SIZE)
+      end = memchr(c->text + CHUNK_SIZE, delim, c->len - CHUNK_SIZE);
+    if (end)
+      c->len = end + 1 - c->text;
+    in->map_off += c->len;
+    return c->len;
+  }
+  if (c->size < in->rest_len + CHUNK_SIZE) {
+    c->size = in->rest_len + CHUNK_SIZE;
+    c->buf = realloc(c->buf, c->size);
+  }
+  memcpy(c->buf, in->rest, in->rest_len);
+  c->len = in->rest_len;
+  // reads until the chunk has a whole record.
+  while (!cut) {
+    if (c->len == c->size) {
+      c->size *= 2;
+      c->buf = realloc(c->buf, c->size);
+    }
+    n = fread(c->buf + c->len, 1, c->size - c->len, in->fd);
+    cut = memrchr(c->buf + c->len, delim, n);
+    c->len += n;
+    if (!n) {
+      if (ferror(in->fd)) {
+	perror("Error reading");
+	exit(1);
+      }
+      break;
+    }
+  }
+  in->rest_len = cut ? c->buf + c->len - cut - 1 : 0;
+  if (in->rest_len > in->rest_size) {
+    in->rest_size = in->rest_len;
+    in->rest = realloc(in->rest, in->rest_size);
+  }
+  memcpy(in->rest, c->buf + c->len - in->rest_len, in->rest_len);
+  c->len -= in->rest_len;
+  c->text = c->buf;
+  return c->len;
+}
+
+/************************************************************************\
+*				 THREADS				 *
+* With -j, the chunks of the input are matched by a pool of threads	 *
+* (each one taking the oldest chunk not taken yet), and their output is	 *
+* written in the order of the input.					 *
+\************************************************************************/
+
+struct pool {
+  const struct options * o;
+  pthread_mutex_t lock;
+  pthread_cond_t queued, done;
+  struct chunk * chunks; // a ring of nchunks, indexed by sequence number.
+  int nchunks;
+  long filled, taken, written;
+  bool eof;
+};
+
+static void * worker(void * arg) {
+  struct pool * p = arg;
+  struct matcher m = {new_gram_context(), new_ast_arena()};
+  pthread_mutex_lock(&p->lock);
+  while (1) {
+    while (p->taken == p->filled && !p->eof)
+      pthread_cond_wait(&p->queued, &p->lock);
+    if (p->taken == p->filled)
+      break;
+    struct chunk * c = &p->chunks[p->taken++ % p->nchunks];
+    pthread_mutex_unlock(&p->lock);
+    FILE * out = open_memstream(&c->out, &c->out_len);
+    match_records(p->o, &m, c->text, c->len, out);
+    fclose(out);
+    pthread_mutex_lock(&p->lock);
+    c->done = true;
+    pthread_cond_broadcast(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  free_ast_arena(m.arena);
+  free_gram_context(m.ctx);
+  return NULL;
+}
+
+// waits for the oldest chunk in the ring, and writes its output.
+static void write_chunk(struct pool * p) {
+  struct chunk * c = &p->chunks[p->written % p->nchunks];
+  pthread_mutex_lock(&p->lock);
+  while (!c->done)
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  fwrite(c->out, 1, c->out_len, stdout);
+  free(c->out);
+  c->done = false;
+  p->written++;
+}
+
+static void parse_input_threads(const struct options * o, int threads, struct input * in) {
+  struct pool p = {
+    .o = o,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .queued = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .nchunks = 4 * threads,
+  };
+  pthread_t * tids = malloc(sizeof (pthread_t) * threads);
+  int i;
+  p.chunks = calloc(p.nchunks, sizeof (struct chunk));
+  for (i = 0; i < threads; i++)
+    pthread_create(&tids[i], NULL, worker, &p);
+  while (!p.eof) {
+    if (p.filled - p.written == p.nchunks)
+      write_chunk(&p);
+    bool more = next_chunk(in, o->delim, &p.chunks[p.filled % p.nchunks]);
+    pthread_mutex_lock(&p.lock);
+    if (more)
+      p.filled++;
+    else
+      p.eof = true;
+    pthread_cond_broadcast(&p.queued);
+    pthread_mutex_unlock(&p.lock);
+  }
+  while (p.written < p.filled)
+    write_chunk(&p);
+  for (i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+  for (i = 0; i < p.nchunks; i++)
+    free(p.chunks[i].buf);
+  free(p.chunks);
+  free(tids);
+}
+
+static void parse_input(const struct options * o, int threads, FILE * fd) {
+  static struct matcher m = {NULL, NULL};
+  struct input in;
+  bool mapped = map_input(&in, fd);
+  if (!m.ctx) {
+    m.ctx = new_gram_context();
+    m.arena = new_ast_arena();
+  }
+  if (threads > 1)
+    parse_input_threads(o, threads, &in);
+  else if (mapped)
+    match_records(o, &m, in.map, in.map_len, stdout);
+  else
+    parse_file(o, &m, fd);
+  if (mapped)
+    munmap((void *)in.map, in.map_len);
+  free(in.rest);
+}
+
+static void print_memo_stats(const char * name, struct gram * g, void * privdata) {
+  static const char * policies[] = {"auto", "always", "never"};
+  struct gram_memo_stats stats;
+  gram_get_memo_stats(g, &stats);
+  fprintf(stderr, "%s: %s, %lu hits, %lu misses\n",
+      name, policies[stats.policy], stats.hits, stats.misses);
+}
+
 void print_help(const char * arg0) {
-  printf("Usage: %1$s [-z] [-c / -nc] [-ast] [-q] {-nt name def}* main_def {file}*\n"
+  printf("Usage: %1$s [-z] [-c / -nc] [-ast / -o] [-q] [-packrat / -memo] [-memo-stats]\n"
+      "       [-vm] [-j threads] [-save F] ({-nt name def}* main_def | -load F) {file}*\n"
       "Options:\n"
       "  -z        Use NUL byte as delimiter (instead of \\n).\n"
       "  -c / -nc  (Force / No) colorize.\n"
       "  -ast      Print its Abstract Syntax Tree.\n"
+      "  -o        Print only the matches, found anywhere in the records, one per line\n"
+      "            (neither colorized nor with their trees).\n"
       "  -q        Don't print matched lines.\n"
+      "  -packrat  Memoize partial matches, for linear time on any grammar.\n"
+      "  -memo     Only memoize the non-terminals that pay off.\n"
+      "  -memo-stats  Print memoization hits and misses per non-terminal on exit.\n"
+      "  -vm       Compile the grammar and run it in the bytecode machine (no memoization).\n"
+      "  -save F   Compile the grammar into the file F, for -load, and exit.\n"
+      "  -load F   Run the grammar compiled into F (-vm), instead of main_def.\n"
+      "  -j N      Match the records on N threads, printing them in order (-memo-stats\n"
+      "            are not collected then).\n"
       "Examples:\n"
       "  %1$s '\"hello\"' file;                 : starting with hello\n"
       "  %1$s '(!\"hello\".)*\"hello\"' file;     : lines containing hello\n"
       "  %1$s -nt e '\"foo\"!.' '(!e.)*e' file; : lines ending with foo\n"
+      "  %1$s -o \"('0'..'9')+\" file;          : every number\n"
       "  %1$s -nt ab \"'a' ab 'b'\" 'ab!.';     : lines like ab, aabb, aaabbb, ...\n"
       "  %1$s -nt nb '!(\"[\"/\"]\").' -nt m '\"[\" nb* m* \"]\" nb*' 'nb* m*!.'; : lines with matching brackets\n"
       "  echo '1+1*(2+1)+3' | %1$s -ast \\\n"
@@ -91,7 +385,8 @@ void print_help(const char * arg0) {
       "     -nt mults 'atom (\"*\"atom)*' \\\n"
       "     -nt adds  'mults (\"+\"mults)*'  'adds!.'; : parse natural arithmetic expressions\n",
       arg0);
-  // there are some pathological cases, for instance with exponential cpu & memory consumption:
+  // there are some pathological cases, for instance with exponential cpu & memory consumption
+  // (unless -packrat is used):
   // echo aaaaaaaaaaaaaaaaaaaaaaaaaa | ./peggrep -nt a '"a"(e/e/.)' -nt e '!(a"j")a' e
 }
 
@@ -101,6 +396,11 @@ int main(int argc, char * argv[]) {
   bool use_colorize = !!isatty(1);
   bool use_ast = false;
   bool quiet = false;
+  bool memo_stats = false;
+  bool use_vm = false;
+  bool only_matching = false;
+  const char * save_path = NULL, * load_path = NULL;
+  int flags = 0, threads = 1;
   int i, main_grammar_arg_index = -1;
   int delim = '\n';
   for (i = 1; i < argc; i++) {
@@ -115,8 +415,32 @@ int main(int argc, char * argv[]) {
       use_colorize = false;
     } else if (!strcmp("-ast", argv[i])) {
       use_ast = true;
+    } else if (!strcmp("-o", argv[i])) {
+      only_matching = true;
     } else if (!strcmp("-q", argv[i])) {
       quiet = true;
+    } else if (!strcmp("-packrat", argv[i])) {
+      flags |= PARSE_PACKRAT;
+    } else if (!strcmp("-memo", argv[i])) {
+      flags |= PARSE_MEMO;
+    } else if (!strcmp("-memo-stats", argv[i])) {
+      memo_stats = true;
+    } else if (!strcmp("-vm", argv[i])) {
+      use_vm = true;
+    } else if (!strcmp("-save", argv[i]) && i < argc - 1) {
+      save_path = argv[++i];
+    } else if (!strcmp("-load", argv[i]) && i < argc - 1) {
+      // instead of the grammar, so the files follow.
+      load_path = argv[++i];
+      use_vm = true;
+      main_grammar_arg_index = i;
+      break;
+    } else if (!strcmp("-j", argv[i]) && i < argc - 1) {
+      threads = atoi(argv[++i]);
+      if (threads < 1) {
+	fprintf(stderr, "-j needs a positive number of threads.\n");
+	return 1;
+      }
     } else if (!strcmp("--help", argv[i]) || !strcmp("-help", argv[i])) {
       print_help(*argv);
       return 0;
@@ -130,22 +454,60 @@ int main(int argc, char * argv[]) {
     print_help(*argv);
     return 1;
   }
-  if (!gramparser_is_complete(gp)) {
-    fprintf(stderr, "There are undefined non-terminal references.\n");
+  if (only_matching && use_vm) {
+    fprintf(stderr, "-o can't be used with -vm.\n");
     return 1;
   }
-  struct gram * g = gramparser_get_gram(gp, "main");
+  struct gram * g = NULL;
+  struct gram_program * prog = NULL;
+  if (load_path) {
+    if (!(prog = load_gram_program(load_path)))
+      return 1;
+  } else {
+    if (!gramparser_is_complete(gp)) {
+      fprintf(stderr, "There are undefined non-terminal references.\n");
+      return 1;
+    }
+    // only the purged trees are printed, so the unnamed grams may change.
+    gramparser_optimize(gp, "main");
+    g = gramparser_get_gram(gp, "main");
+    // shared by the threads, if any.
+    if (threads > 1)
+      gram_freeze(g);
+    else
+      gram_analyze(g);
+    if (use_vm || save_path)
+      prog = compile_gram(g);
+  }
+  if (save_path)
+    return save_gram_program(prog, save_path) ? 1 : 0;
+  struct options o = {
+    .g = g,
+    .prog = prog,
+    .delim = delim,
+    .flags = flags,
+    .use_colorize = use_colorize,
+    .use_ast = use_ast,
+    .quiet = quiet,
+    .only_matching = only_matching,
+  };
+  if (g)
+    o.literal_len = gram_required_literal(g, o.literal, sizeof o.literal, &o.anchored);
+  // the matches may start anywhere in the record.
+  o.anchored = o.anchored && !only_matching;
   if (main_grammar_arg_index == argc - 1) {
-    parse_file(g, delim, use_colorize, use_ast, quiet, stdin);
+    parse_input(&o, threads, stdin);
   } else {
     for (i = main_grammar_arg_index + 1; i < argc; i++) {
       FILE * fd = fopen(argv[i], "r");
       if (!fd) {
 	fprintf(stderr, "Failed opening file %s: %s\n", argv[i], strerror(errno));
       }
-      parse_file(g, delim, use_colorize, use_ast, quiet, fd);
+      parse_input(&o, threads, fd);
       fclose(fd);
     }
   }
+  if (memo_stats)
+    gramparser_foreach(gp, &print_memo_stats, NULL);
   return 0;
 }
@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gramparser.h"
+
+/**
+ * parses the same records with 1, 2, 4... threads sharing one frozen
+ * grammar, every thread with its own context and arena, to show that
+ * parse() scales with the cores.
+ */
+
+struct worker {
+  pthread_t thread;
+  struct gram * gram;
+  char ** records;
+  int count, flags;
+  long nodes;
+};
+
+static long count_nodes(struct ast * ast) {
+  long n = 1;
+  int i;
+  for (i = 0; ast->children[i]; i++)
+    n += count_nodes(ast->children[i]);
+  return n;
+}
+
+static void * work(void * arg) {
+  struct worker * w = arg;
+  struct gram_context * ctx = new_gram_context();
+  struct ast_arena * arena = new_ast_arena();
+  int i, last;
+  for (i = 0; i < w->count; i++) {
+    last = 0;
+    struct ast * ast = parse_context(ctx, arena, w->records[i], strlen(w->records[i]),
+	w->gram, &last, w->flags);
+    if (!ast) {
+      fprintf(stderr, "record %d didn't match at %d\n", i, last);
+      exit(1);
+    }
+    w->nodes += count_nodes(ast);
+    ast_arena_reset(arena);
+  }
+  free_ast_arena(arena);
+  free_gram_context(ctx);
+  return NULL;
+}
+
+// a random arithmetic expression of about size chars.
+static void random_expr(char * buf, int * len, int size, unsigned * seed) {
+  while (1) {
+    *seed = *seed * 1103515245 + 12345;
+    if (size > 8 && (*seed >> 16) % 4 == 0) {
+      buf[(*len)++] = '(';
+      random_expr(buf, len, size / 2, seed);
+      buf[(*len)++] = ')';
+    } else {
+      *len += sprintf(buf + *len, "%u", (*seed >> 8) % 1000);
+    }
+    if (*len >= size)
+      return;
+    buf[(*len)++] = (*seed >> 20) % 2 ? '+' : '*';
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+  int i, t, max_threads = sysconf(_SC_NPROCESSORS_ONLN), count = 20000, flags = 0;
+  for (i = 1; i < argc; i++) {
+    if (!strcmp("-t", argv[i]) && i < argc - 1)
+      max_threads = atoi(argv[++i]);
+    else if (!strcmp("-n", argv[i]) && i < argc - 1)
+      count = atoi(argv[++i]);
+    else if (!strcmp("-packrat", argv[i]))
+      flags = PARSE_PACKRAT;
+    else if (!strcmp("-iterative", argv[i]))
+      flags = PARSE_ITERATIVE;
+    else {
+      printf("Usage: %s [-t max_threads] [-n records] [-packrat | -iterative]\n", *argv);
+      return 1;
+    }
+  }
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "atom", "('0'..'9')+ / '(' adds ')'");
+  gramparser_add(gp, "mults", "atom ('*' atom)*");
+  gramparser_add(gp, "adds", "mults ('+' mults)*");
+  gramparser_add(gp, "main", "adds !.");
+  struct gram * g = gram_freeze(gramparser_get_gram(gp, "main"));
+  char ** records = malloc(sizeof (char *) * count);
+  unsigned seed = 42;
+  for (i = 0; i < count; i++) {
+    int len = 0;
+    records[i] = malloc(2048);
+    random_expr(records[i], &len, 1000, &seed);
+    records[i][len] = '\0';
+  }
+  printf("%d records, up to %d threads\n", count, max_threads);
+  double base = 0;
+  for (t = 1; t <= max_threads; t = t < max_threads && 2 * t > max_threads ? max_threads : 2 * t) {
+    struct worker * workers = calloc(t, sizeof (struct worker));
+    long nodes = 0;
+    double start = now();
+    for (i = 0; i < t; i++) {
+      workers[i].gram = g;
+      workers[i].records = records + (long)count * i / t;
+      workers[i].count = (long)count * (i + 1) / t - (long)count * i / t;
+      workers[i].flags = flags;
+      pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+    for (i = 0; i < t; i++) {
+      pthread_join(workers[i].thread, NULL);
+      nodes += workers[i].nodes;
+    }
+    double elapsed = now() - start;
+    if (t == 1)
+      base = elapsed;
+    printf("%3d threads: %8.1f ms, %10.0f records/s, %ld nodes, speedup %.2f\n",
+	t, elapsed * 1000, count / elapsed, nodes, base / elapsed);
+    free(workers);
+    if (t == max_threads)
+      break;
+  }
+  for (i = 0; i < count; i++)
+    free(records[i]);
+  free(records);
+  free_gramparser(gp);
+  return 0;
+}
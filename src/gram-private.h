@@ -0,0 +1,315 @@
+#ifndef GRAM_PRIVATE_H
+#define GRAM_PRIVATE_H 1
+
+/**
+ * internals of gram.c shared with the other engines of the library (they
+ * walk the grams and build the very same trees). NOT part of the public
+ * api: users must stick to gram.h.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "gram.h"
+
+enum gram_type {
+  GRAM_DOT,
+  GRAM_STRING,
+  GRAM_RANGE,
+  GRAM_CLASS,
+  GRAM_SPAN, // the last terminal: the grams above never call others.
+  GRAM_INT,
+  GRAM_OPT,
+  GRAM_PLUS,
+  GRAM_ASTER,
+  GRAM_ALT,
+  GRAM_CAT,
+  GRAM_POSLA,
+  GRAM_NEGLA,
+  GRAM_CUSTOM,
+};
+
+struct gram {
+  void * user_data;
+  enum gram_type type;
+  // if it matches, it returns the number of characters eaten (and pushes
+  // its node when building the tree), or -1 if it didn't match.
+  int (*matcher)(const char * text, int cursor, struct gram * gram, struct gram_state * state);
+  // what's kept of its node when building the tree (see gram_set_filter).
+  enum filter_ast_mode filter;
+  // memoization feedback, kept across parses:
+  enum gram_memo_policy memo_policy;
+  unsigned long memo_hits, memo_misses;
+  // where this gram was last matched, to detect re-evaluations:
+  unsigned seen_serial;
+  int seen_cursor;
+  bool memo_hot; // it was matched again at the same cursor.
+  bool frozen; // by gram_freeze: nothing above is changed anymore.
+  // filled in by gram_analyze:
+  unsigned analysis_serial;
+  bool nullable; // it may succeed without consuming anything.
+  unsigned char first[32]; // bitmap of the bytes it may start with.
+  // frozen grams only: compiled by the first parse with PARSE_ITERATIVE.
+  struct gram_program * program;
+};
+
+struct gram_string {
+  struct gram gram;
+  int len;
+  char text[];
+};
+
+struct gram_range {
+  struct gram gram;
+  char from, to;
+};
+
+struct gram_class {
+  struct gram gram;
+  unsigned char set[32]; // already negated.
+};
+
+static inline bool gram_class_has(const unsigned char * set, unsigned char c) {
+  return set[c >> 3] >> (c & 7) & 1;
+}
+
+// at most this many byte ranges are compared in parallel.
+#define SPAN_RANGES 4
+
+struct gram_span {
+  struct gram gram;
+  int min;
+  unsigned char set[32]; // as in gram_class.
+  // set as ranges [lo[i], lo[i] + width[i]], or 0 if there are too many
+  // (its complement always has about as many, as it has the NUL):
+  int ranges;
+  unsigned char lo[SPAN_RANGES], width[SPAN_RANGES];
+};
+
+/**
+ * the length of the run of chars of the span starting at text, which has
+ * n chars left.
+ */
+int gram_span_length(const struct gram_span * g, const char * text, int n);
+
+// whether gram may match at a cursor whose byte is c (after gram_analyze).
+static inline bool gram_may_start(struct gram * gram, unsigned char c) {
+  return gram->nullable || gram_class_has(gram->first, c);
+}
+
+// used by new_gram_opt, new_gram_plus, new_gram_aster, new_gram_posla
+// and new_gram_negla.
+struct gram_child {
+  struct gram gram;
+  struct gram * child;
+};
+
+// used by new_gram_alt and new_gram_cat.
+struct gram_children {
+  struct gram gram;
+  // alt only: index of the first child that may start with every byte.
+  unsigned short * dispatch;
+  struct gram * children[];
+};
+
+// used by new_gram_custom.
+struct gram_custom {
+  struct gram gram;
+  int (*matcher)(const char * text, int cursor, void * priv_data, struct gram_state * state);
+  void * priv_data;
+};
+
+// the matchers of the builtin grams.
+#define GRAM_MATCHER(name) \
+  int name(const char * text, int cursor, struct gram * gram, struct gram_state * state)
+GRAM_MATCHER(gram_dot_matcher);
+GRAM_MATCHER(gram_string_matcher);
+GRAM_MATCHER(gram_range_matcher);
+GRAM_MATCHER(gram_class_matcher);
+GRAM_MATCHER(gram_span_matcher);
+GRAM_MATCHER(gram_int_matcher);
+GRAM_MATCHER(gram_opt_matcher);
+GRAM_MATCHER(gram_plus_matcher);
+GRAM_MATCHER(gram_aster_matcher);
+GRAM_MATCHER(gram_alt_matcher);
+GRAM_MATCHER(gram_cat_matcher);
+GRAM_MATCHER(gram_posla_matcher);
+GRAM_MATCHER(gram_negla_matcher);
+
+/**
+ * the struct gram of a gram laid out at compile time, as new_gram_* would
+ * initialize it, e.g.:
+ *   static struct gram_string hello = {
+ *     GRAM_STATIC(NULL, GRAM_STRING, gram_string_matcher), 5, "hello"};
+ * gram_analyze fills in their analysis the first time (alternations get
+ * their dispatch table allocated, unless it's given to them), and they
+ * must never be freed.
+ */
+#define GRAM_STATIC(user_data_, type_, matcher_) { \
+    .user_data = (void *)(user_data_), \
+    .type = (type_), \
+    .matcher = &(matcher_), \
+    .filter = FILTER_AST_KEEP, \
+    .memo_policy = GRAM_MEMO_AUTO, \
+    .seen_cursor = -1, \
+    .nullable = true, \
+    .first = {[0 ... 31] = 0xff}, \
+  }
+
+struct ast_arena_block {
+  struct ast_arena_block * next;
+  size_t size, used;
+  char data[];
+};
+
+struct ast_arena {
+  struct ast_arena_block * first, * current;
+};
+
+struct arena_mark {
+  struct ast_arena_block * block;
+  size_t used;
+};
+
+static inline struct arena_mark arena_mark(struct ast_arena * arena) {
+  return (struct arena_mark){arena->current, arena->current->used};
+}
+
+// moves to the next block when size doesn't fit in the current one.
+void * arena_alloc_block(struct ast_arena * arena, size_t size);
+
+static inline void * arena_alloc(struct ast_arena * arena, size_t size) {
+  struct ast_arena_block * block = arena->current;
+  size = (size + sizeof (void *) - 1) & ~(sizeof (void *) - 1);
+  if (block->used + size > block->size)
+    return arena_alloc_block(arena, size);
+  void * ptr = block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+// a node with user_data seen by parse_events, recorded when it matched (so
+// after those of its subtree), until the parse is done.
+struct gram_event {
+  void * user_data;
+  int from, len;
+  int size; // the number of events of its subtree, itself included.
+};
+
+// deeper than this the C stack may not hold, and the parse fails.
+#define GRAM_MAX_DEPTH 0xfff
+
+struct gram_state {
+  int len; // the text ends here, whatever its bytes are.
+  int last;
+  // one past the furthest byte examined (the end of the text counts as a
+  // byte), only tracked when memoizing.
+  int reach;
+  int depth, max_depth;
+  bool overflow; // nested deeper than max_depth: the parse fails.
+  bool build; // false when only recognizing: no node is ever created.
+  // nodes of the matches in progress, children pushed before their parents:
+  struct ast ** nodes;
+  int nodes_count, nodes_size;
+  struct memo * memo; // NULL unless memoizing.
+  struct ast_arena * arena; // NULL if nodes are malloced.
+  // with parse_events, events are recorded instead of nodes (counted by
+  // nodes_count, so marks work the same):
+  bool record_events;
+  struct gram_event * events;
+  int events_size;
+  int flags;
+  unsigned serial; // unique per parse.
+  // the stack of the iterative engine, kept for the next parse:
+  struct vm_frame * frames;
+  int frames_size;
+};
+
+// remembers where the nodes of a matcher's children start.
+struct gram_mark {
+  int nodes;
+  struct arena_mark arena;
+};
+
+void gram_state_grow_nodes(struct gram_state * state);
+void gram_state_grow_events(struct gram_state * state);
+
+// (inlined, every matcher of the engines calls them)
+static inline void gram_state_push(struct gram_state * state, struct ast * ast) {
+  if (state->nodes_count == state->nodes_size)
+    gram_state_grow_nodes(state);
+  state->nodes[state->nodes_count++] = ast;
+}
+
+static inline struct gram_mark gram_state_mark(struct gram_state * state) {
+  if (state->arena)
+    return (struct gram_mark){state->nodes_count, arena_mark(state->arena)};
+  return (struct gram_mark){state->nodes_count, {NULL, 0}};
+}
+
+// a node malloced with one reference, as returned by parse.
+struct ast * allocate_ast(void * user_data, int from, int len, int num_children);
+
+// allocates nodes for the matchers, from the arena if there's one.
+static inline struct ast * new_ast(struct gram_state * state, void * user_data, int from, int len, int num_children) {
+  if (!state->arena)
+    return allocate_ast(user_data, from, len, num_children);
+  struct ast * ast = arena_alloc(state->arena, sizeof (struct ast) + sizeof (struct ast*) * (num_children+1));
+  ast->user_data = user_data;
+  ast->from = from;
+  ast->len = len;
+  ast->refs = 0; // arena nodes are not reference counted.
+  ast->children[num_children] = NULL;
+  return ast;
+}
+
+// grams without user_data record no event, theirs go to their parent.
+static inline void gram_state_event(struct gram_state * state, void * user_data, int from, int len, int size) {
+  if (!user_data)
+    return;
+  if (state->nodes_count == state->events_size)
+    gram_state_grow_events(state);
+  state->events[state->nodes_count++] = (struct gram_event){user_data, from, len, size};
+}
+
+/**
+ * replaces every node pushed since mark by a new node having them as
+ * children.
+ */
+static inline void gram_state_reduce(struct gram_state * state, struct gram_mark mark,
+    void * user_data, int from, int len) {
+  if (!state->build)
+    return;
+  if (state->record_events) {
+    gram_state_event(state, user_data, from, len, state->nodes_count - mark.nodes + 1);
+    return;
+  }
+  int n = state->nodes_count - mark.nodes;
+  struct ast * ast = new_ast(state, user_data, from, len, n);
+  if (n) // nodes may still be NULL.
+    memcpy(ast->children, state->nodes + mark.nodes, sizeof (struct ast *) * n);
+  state->nodes_count = mark.nodes;
+  gram_state_push(state, ast);
+}
+
+static inline void gram_state_leaf(struct gram_state * state, void * user_data, int from, int len) {
+  if (!state->build)
+    return;
+  if (state->record_events)
+    gram_state_event(state, user_data, from, len, 1);
+  else
+    gram_state_push(state, new_ast(state, user_data, from, len, 0));
+}
+
+/**
+ * discards every node pushed since mark.
+ */
+void gram_state_drop(struct gram_state * state, struct gram_mark mark);
+
+/**
+ * runs prog (see gramvm.h) with state as run by parse, from cursor 0 up to
+ * state->len. It returns the length of the match, or -1.
+ */
+int gram_program_run(struct gram_program * prog, const char * text, struct gram_state * state);
+
+#endif
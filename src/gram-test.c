@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -136,10 +138,866 @@ void test4(void) {
   printf("test4 passed!\n\n");
 }
 
+static int ast_equal(struct ast * a, struct ast * b) {
+  int i;
+  if (a->user_data != b->user_data || a->from != b->from || a->len != b->len)
+    return 0;
+  for (i = 0; a->children[i] && b->children[i]; i++)
+    if (!ast_equal(a->children[i], b->children[i]))
+      return 0;
+  return !a->children[i] && !b->children[i];
+}
+
+void test5(void) {
+  struct gram * a, * e, * e_ref;
+  // a = 'a' (e / e / .);
+  // e = !(a 'j') a;
+  // exponential without memoization (see peggrep.c's print_help).
+  a = new_gram_cat((void*)0xa,
+      new_gram_string(NULL, "a"),
+      e_ref = new_gram_alt(NULL,
+	  (struct gram *)(-1),
+	  (struct gram *)(-1),
+	  new_gram_dot(NULL)));
+  e = new_gram_cat((void*)0xe,
+      new_gram_negla(NULL,
+	  new_gram_cat(NULL, a, new_gram_string(NULL, "j"))),
+      a);
+  gram_set_child(e_ref, e, 0);
+  gram_set_child(e_ref, e, 1);
+  int last = -42, memo_last = -42;
+  const char * text = "aaaaaaaaaaa";
+  struct ast * ast = parse(text, e, &last);
+  struct ast * memo_ast = parse_ex(text, e, &memo_last, PARSE_PACKRAT);
+  printf("matching \"%s\" with and without memoization\nlast = %d, memo_last = %d\n",
+      text, last, memo_last);
+  assert(ast && memo_ast);
+  assert(last == memo_last);
+  assert(ast_equal(ast, memo_ast));
+  free_ast(ast);
+  free_ast(memo_ast);
+  // this would take ages without memoization:
+  text = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  memo_last = -42;
+  memo_ast = parse_ex(text, e, &memo_last, PARSE_PACKRAT);
+  assert(memo_ast);
+  assert(memo_ast->len == strlen(text));
+  free_ast(memo_ast);
+  // failures are memoized as well:
+  memo_last = 0;
+  assert(!parse_ex("b", e, &memo_last, PARSE_PACKRAT));
+  assert(memo_last == 0);
+  printf("test5 passed!\n\n");
+}
+
+void test6(void) {
+  struct gram * a, * e, * e_ref;
+  struct gram_memo_stats stats;
+  // same grammar as test5, but with selective memoization:
+  a = new_gram_cat((void*)0xa,
+      new_gram_string(NULL, "a"),
+      e_ref = new_gram_alt(NULL,
+	  (struct gram *)(-1),
+	  (struct gram *)(-1),
+	  new_gram_dot(NULL)));
+  e = new_gram_cat((void*)0xe,
+      new_gram_negla(NULL,
+	  new_gram_cat(NULL, a, new_gram_string(NULL, "j"))),
+      a);
+  gram_set_child(e_ref, e, 0);
+  gram_set_child(e_ref, e, 1);
+  int last = 0;
+  const char * text = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  struct ast * ast = parse_ex(text, e, &last, PARSE_MEMO);
+  assert(ast && ast->len == strlen(text));
+  free_ast(ast);
+  gram_get_memo_stats(a, &stats);
+  printf("a: policy=%d, hits=%lu, misses=%lu\n", stats.policy, stats.hits, stats.misses);
+  assert(stats.policy == GRAM_MEMO_AUTO && stats.hits > 0);
+  gram_get_memo_stats(e, &stats);
+  printf("e: policy=%d, hits=%lu, misses=%lu\n", stats.policy, stats.hits, stats.misses);
+  assert(stats.policy == GRAM_MEMO_AUTO && stats.hits > 0);
+
+  // unnamed grams are memoized once they are matched again at the same place:
+  struct gram * u = new_gram_cat(NULL, new_gram_string(NULL, "a"), new_gram_string(NULL, "a"));
+  struct gram * abcd = new_gram_alt(NULL,
+      new_gram_cat(NULL, u, new_gram_string(NULL, "b")),
+      new_gram_cat(NULL, u, new_gram_string(NULL, "c")),
+      new_gram_cat(NULL, u, new_gram_string(NULL, "d")));
+  last = 0;
+  ast = parse_ex("aad", abcd, &last, PARSE_MEMO);
+  assert(ast && ast->len == 3);
+  free_ast(ast);
+  gram_get_memo_stats(u, &stats);
+  assert(stats.hits == 1 && stats.misses == 1);
+
+  // a named rule whose results are never reused stops being memoized:
+  struct gram * x = new_gram_cat((void*)0x1, new_gram_string(NULL, "x"));
+  struct gram * xs = new_gram_aster(NULL, x);
+  char buff[4096];
+  memset(buff, 'x', sizeof buff - 1);
+  buff[sizeof buff - 1] = 0;
+  last = 0;
+  ast = parse_ex(buff, xs, &last, PARSE_MEMO);
+  assert(ast && ast->len == sizeof buff - 1);
+  free_ast(ast);
+  gram_get_memo_stats(x, &stats);
+  printf("x: policy=%d, hits=%lu, misses=%lu\n", stats.policy, stats.hits, stats.misses);
+  assert(stats.policy == GRAM_MEMO_NEVER && stats.hits == 0);
+  assert(stats.misses < sizeof buff - 1);
+  gram_set_memo_policy(x, GRAM_MEMO_AUTO);
+  gram_get_memo_stats(x, &stats);
+  assert(stats.policy == GRAM_MEMO_AUTO && stats.misses == 0);
+  printf("test6 passed!\n\n");
+}
+
+void test7(void) {
+  struct gram * gram;
+  // gram = ('a' / 'b')* !.;
+  gram = new_gram_cat(NULL,
+      new_gram_aster(NULL,
+	  new_gram_alt(NULL,
+	      new_gram_string((void*)0xa, "a"),
+	      new_gram_string((void*)0xb, "b"))),
+      new_gram_negla(NULL,
+	  new_gram_dot(NULL)));
+  // long enough for several ptrbuff chunks:
+  char text[3000];
+  int i;
+  for (i = 0; i < sizeof text - 1; i++)
+    text[i] = i % 3 ? 'a' : 'b';
+  text[sizeof text - 1] = 0;
+  struct ast_arena * arena = new_ast_arena();
+  int last = 0, arena_last = 0;
+  struct ast * ast = parse(text, gram, &last);
+  struct ast * arena_ast = parse_arena(arena, text, gram, &arena_last, 0);
+  assert(ast && arena_ast);
+  assert(last == arena_last && last == sizeof text - 1);
+  assert(ast_equal(ast, arena_ast));
+  for (i = 0; i < sizeof text - 1; i++) {
+    struct ast * child = arena_ast->children[0]->children[i];
+    assert(child->from == i && child->children[0]->user_data == (i % 3 ? (void*)0xa : (void*)0xb));
+  }
+  free_ast(ast);
+  // failed matches leave nothing behind:
+  ast_arena_reset(arena);
+  text[sizeof text - 2] = '!';
+  arena_last = 0;
+  assert(!parse_arena(arena, text, gram, &arena_last, 0));
+  assert(arena_last == sizeof text - 2);
+  // it may be used together with memoization:
+  text[sizeof text - 2] = 'a';
+  arena_last = 0;
+  arena_ast = parse_arena(arena, text, gram, &arena_last, PARSE_PACKRAT);
+  assert(arena_ast && arena_ast->len == sizeof text - 1);
+  free_ast_arena(arena);
+  printf("test7 passed!\n\n");
+}
+
+void test8(void) {
+  struct gram * gram;
+  // gram = (('0'..'9')+ / '(' gram ')') !'x';
+  struct gram * tmp;
+  gram = new_gram_cat(NULL,
+      new_gram_alt(NULL,
+	  new_gram_plus((void*)0x1, new_gram_range(NULL, '0', '9')),
+	  tmp = new_gram_cat(NULL,
+	      new_gram_string(NULL, "("),
+	      (struct gram *)(-1),
+	      new_gram_string(NULL, ")"))),
+      new_gram_negla(NULL, new_gram_string(NULL, "x")));
+  gram_set_child(tmp, gram, 1);
+  const char * texts[] = {"42", "((7))", "((7)", "(8)x", "((12)", "", NULL};
+  int i;
+  for (i = 0; texts[i]; i++) {
+    int last = 0, match_last = 0;
+    struct ast * ast = parse(texts[i], gram, &last);
+    int len = match(texts[i], gram, &match_last);
+    printf("matching \"%s\": len = %d, last = %d\n", texts[i], len, match_last);
+    assert(last == match_last);
+    assert(ast ? ast->len == len : len == -1);
+    match_last = 0;
+    assert(match_ex(texts[i], gram, &match_last, PARSE_PACKRAT) == len);
+    assert(last == match_last);
+    if (ast)
+      free_ast(ast);
+  }
+  printf("test8 passed!\n\n");
+}
+
+void test9(void) {
+  struct gram * begin, * insert, * start, * opt, * gram;
+  struct gram_memo_stats stats;
+  // gram = (begin / insert / start / '-'?) !.;
+  begin = new_gram_cat((void*)0x1, new_gram_string(NULL, "begin"), new_gram_int(NULL));
+  insert = new_gram_cat((void*)0x2, new_gram_string(NULL, "insert"), new_gram_dot(NULL));
+  opt = new_gram_opt((void*)0x3, new_gram_string(NULL, "-"));
+  start = new_gram_cat((void*)0x4,
+      new_gram_alt(NULL, new_gram_range(NULL, 'a', 'z'), new_gram_string(NULL, "_")),
+      new_gram_aster(NULL, new_gram_range(NULL, 'a', 'z')));
+  gram = new_gram_cat(NULL,
+      new_gram_alt(NULL, begin, insert, start, opt),
+      new_gram_negla(NULL, new_gram_dot(NULL)));
+  const char * texts[] = {"begin 12", "insert!", "-", "", "start", "_ab", "b-", "begin", NULL};
+  int i, lasts[8], lens[8];
+  struct ast * asts[8];
+  for (i = 0; texts[i]; i++) {
+    lasts[i] = -42;
+    asts[i] = parse(texts[i], gram, &lasts[i]);
+    lens[i] = asts[i] ? asts[i]->len : -1;
+  }
+  // same results, but the alternatives that can't match are skipped:
+  gram_analyze(gram);
+  for (i = 0; texts[i]; i++) {
+    int last = -42;
+    struct ast * ast = parse(texts[i], gram, &last);
+    printf("matching \"%s\": len = %d, last = %d\n", texts[i], ast ? ast->len : -1, last);
+    assert(last == lasts[i]);
+    assert(ast ? asts[i] && ast_equal(ast, asts[i]) : !asts[i]);
+    last = -42;
+    assert(match(texts[i], gram, &last) == lens[i] && last == lasts[i]);
+    if (ast) {
+      free_ast(ast);
+      free_ast(asts[i]);
+    }
+  }
+  int last = 0;
+  struct ast * ast = parse_ex("start", gram, &last, PARSE_PACKRAT);
+  free_ast(ast);
+  gram_get_memo_stats(begin, &stats);
+  assert(stats.misses == 0);
+  gram_get_memo_stats(insert, &stats);
+  assert(stats.misses == 0);
+  gram_get_memo_stats(start, &stats);
+  assert(stats.misses == 1);
+  // nullable alternatives are always tried:
+  ast = parse_ex("", gram, &last, PARSE_PACKRAT);
+  free_ast(ast);
+  gram_get_memo_stats(start, &stats);
+  assert(stats.misses == 1);
+  gram_get_memo_stats(opt, &stats);
+  assert(stats.misses == 1);
+  printf("test9 passed!\n\n");
+}
+
+void test10(void) {
+  unsigned char set[32] = {0};
+  int c, last;
+  // digits and the bytes >= 0x80.
+  for (c = '0'; c <= '9'; c++)
+    set[c >> 3] |= 1 << (c & 7);
+  for (c = 0x80; c < 0x100; c++)
+    set[c >> 3] |= 1 << (c & 7);
+  set[0] |= 1; // the terminating NUL is the end of the text, so not matched.
+  struct gram * digit = new_gram_class((void *)0x1, set, 0);
+  struct gram * other = new_gram_class((void *)0x2, set, 1);
+  struct gram * gram = new_gram_cat(NULL,
+      new_gram_plus(NULL, digit), new_gram_aster(NULL, other));
+  last = 0;
+  struct ast * ast = parse("12\xc3\xb1" "9a b", gram, &last);
+  dump_ast(ast, 2, NULL);
+  assert(ast && ast->len == 8 && last == 8);
+  assert(ast->children[0]->children[4]->len == 1);
+  assert(ast->children[0]->children[4]->user_data == (void *)0x1);
+  assert(ast->children[1]->children[2]->user_data == (void *)0x2);
+  free_ast(ast);
+  last = 0;
+  assert(match("a", gram, &last) == -1 && last == 0);
+  assert(match("7", gram, &last) == 1 && last == 1);
+  gram_analyze(gram);
+  last = 0;
+  assert(match("\x80-", gram, &last) == 2 && last == 2);
+  printf("test10 passed!\n\n");
+}
+
+void test11(void) {
+  // spans must match as much as the repetition of their class.
+  unsigned char sets[4][32] = {{0}};
+  int c, i, j, k, n, last1, last2;
+  for (c = 'a'; c <= 'z'; c++) // 1 range.
+    sets[0][c >> 3] |= 1 << (c & 7);
+  for (c = 0x80; c < 0x100; c++) // 2 ranges (with 'a'..'z').
+    sets[1][c >> 3] = sets[0][c >> 3] | 1 << (c & 7);
+  for (c = 0; c < 256; c += 2) // too many ranges.
+    sets[2][c >> 3] |= 1 << (c & 7);
+  sets[3]['\n' >> 3] |= 1 << ('\n' & 7); // negated: 2 ranges.
+  char * text = malloc(300);
+  for (i = 0; i < 4; i++) {
+    for (n = 0; n < 3; n++) {
+      struct gram * span = new_gram_span((void *)0x1, sets[i], i == 3, n);
+      struct gram * rep = new_gram_class((void *)0x1, sets[i], i == 3);
+      if (n)
+	rep = new_gram_cat(NULL, n > 1 ? rep : new_gram_string(NULL, ""), rep,
+	    new_gram_aster(NULL, rep));
+      else
+	rep = new_gram_aster(NULL, rep);
+      // runs of every length at every alignment, ending on a mismatch or
+      // at the end of the text.
+      for (j = 0; j < 70; j++) {
+	for (k = 0; k < 40; k++) {
+	  memset(text, 0, 300);
+	  for (c = 0; c < j; c++)
+	    text[k + c] = i == 0 ? 'a' + c % 26 : i == 1 ? 0x80 + c : i == 2 ? 2 * c + 2 : ' ' + c % 80;
+	  if (j % 3)
+	    text[k + j] = i == 3 ? '\n' : '-';
+	  last1 = last2 = 0;
+	  struct ast * ast = parse(text + k, span, &last1);
+	  int len = match(text + k, rep, &last2);
+	  assert(ast ? ast->len == len && !ast->children[0] : len == -1);
+	  assert(last1 == last2);
+	  if (ast) {
+	    assert(ast->user_data == (void *)0x1 && ast->from == 0);
+	    free_ast(ast);
+	  }
+	}
+      }
+    }
+  }
+  free(text);
+  printf("test11 passed!\n\n");
+}
+
+// a copy of the len bytes at text without a terminating NUL.
+static char * unterminated(const char * text, int len) {
+  char * copy = malloc(len);
+  memcpy(copy, text, len);
+  return copy;
+}
+
+static int match_bytes(const char * text, int len, struct gram * gram, int * last) {
+  char * copy = unterminated(text, len);
+  *last = 0;
+  int res = match_n(copy, len, gram, last);
+  free(copy);
+  return res;
+}
+
+void test12(void) {
+  // binary texts, which are never read past their length.
+  unsigned char set[32] = {0};
+  int last;
+  set['\n' >> 3] |= 1 << ('\n' & 7);
+  struct gram * line = new_gram_cat(NULL,
+      new_gram_span(NULL, set, 1, 0), new_gram_opt(NULL, new_gram_string(NULL, "\n")));
+  assert(match_bytes("a\0b\nc", 5, line, &last) == 4 && last == 4);
+  assert(match_bytes("a\0b\0c", 5, line, &last) == 5 && last == 5);
+  assert(match_bytes("\0\0", 2, new_gram_class(NULL, set, 1), &last) == 1);
+  assert(match_bytes("\0", 1, new_gram_aster(NULL, new_gram_dot(NULL)), &last) == 1);
+  assert(match_bytes("a\0", 1, new_gram_aster(NULL, new_gram_dot(NULL)), &last) == 1);
+  assert(match_bytes("", 0, new_gram_dot(NULL), &last) == -1);
+  assert(match_bytes("abc", 2, new_gram_string(NULL, "abc"), &last) == -1 && last == 0);
+  assert(match_bytes("abc", 3, new_gram_string(NULL, "abc"), &last) == 3 && last == 3);
+  assert(match_bytes("abc", 2, new_gram_range(NULL, 'a', 'c'), &last) == 1);
+  // ints as strtol, but bounded.
+  struct gram * num = new_gram_int(NULL);
+  assert(match_bytes("12345", 3, num, &last) == 3 && last == 3);
+  assert(match_bytes(" -0x1fz", 7, num, &last) == 6 && last == 6);
+  assert(match_bytes("0x", 2, num, &last) == 1 && last == 1);
+  assert(match_bytes("0x1", 2, num, &last) == 1 && last == 1);
+  assert(match_bytes("089", 3, num, &last) == 1 && last == 1);
+  assert(match_bytes("-", 1, num, &last) == -1 && last == 0);
+  assert(match_bytes("-9223372036854775808", 20, num, &last) == 20);
+  assert(match_bytes("9223372036854775808", 19, num, &last) == -1 && last == 19);
+  // the same results as the NUL terminated text.
+  struct gram * gram = new_gram_cat(NULL,
+      new_gram_plus(NULL, new_gram_alt(NULL,
+	  new_gram_string(NULL, "ab"), num,
+	  new_gram_cat(NULL, new_gram_span(NULL, set, 1, 1), new_gram_opt(NULL, new_gram_string(NULL, "\n"))),
+	  new_gram_string(NULL, "\n"))),
+      new_gram_negla(NULL, new_gram_dot(NULL)));
+  gram_analyze(gram);
+  const char * texts[] = {"ab12\nab", "", "abab12 x\n\n", "ab\n-7", NULL};
+  int i, last2;
+  for (i = 0; texts[i]; i++) {
+    int len = strlen(texts[i]);
+    char * copy = unterminated(texts[i], len);
+    last = last2 = 0;
+    struct ast * ast1 = parse(texts[i], gram, &last);
+    struct ast * ast2 = parse_n(copy, len, gram, &last2);
+    assert(ast1 ? ast2 && ast_equal(ast1, ast2) : !ast2);
+    assert(last == last2);
+    if (ast1) {
+      free_ast(ast1);
+      free_ast(ast2);
+    }
+    free(copy);
+  }
+  printf("test12 passed!\n\n");
+}
+
+void test13(void) {
+  // doc = (pair / ' ')* !.;
+  // pair = key ' '* '=' ' '* (int / '"' (!'"' .)* '"') ';';
+  // key = ('a'..'z')+;
+  unsigned char lower[32] = {0};
+  int i;
+  for (i = 'a'; i <= 'z'; i++)
+    lower[i >> 3] |= 1 << (i & 7);
+  struct gram * spaces = new_gram_aster(NULL, new_gram_string(NULL, " "));
+  struct gram * pair = new_gram_cat((void *)2,
+      new_gram_span((void *)3, lower, 0, 1),
+      spaces,
+      new_gram_string(NULL, "="),
+      spaces,
+      new_gram_alt((void *)4,
+	new_gram_int((void *)5),
+	new_gram_cat(NULL,
+	  new_gram_string(NULL, "\""),
+	  new_gram_aster(NULL, new_gram_cat(NULL,
+	      new_gram_negla(NULL, new_gram_string(NULL, "\"")),
+	      new_gram_dot((void *)6))),
+	  new_gram_string(NULL, "\""))),
+      new_gram_string(NULL, ";"));
+  struct gram * doc_gram = new_gram_cat((void *)1,
+      new_gram_aster(NULL, new_gram_alt(NULL, pair, new_gram_string(NULL, " "))),
+      new_gram_negla(NULL, new_gram_dot(NULL)));
+  gram_analyze(doc_gram);
+  char text[4096] = "";
+  for (i = 0; i < 100; i++)
+    strcat(text, i % 3 ? "key = 12; " : "st=\"a b\"; ");
+  struct gram_doc * doc = new_gram_doc(doc_gram, text, strlen(text));
+  struct gram_memo_stats stats;
+  gram_get_memo_stats(pair, &stats);
+  unsigned long misses = stats.misses;
+  // an edit in the middle matches again only the pair it touched.
+  assert(gram_doc_edit(doc, 506, 2, "1234", 4, NULL));
+  gram_get_memo_stats(pair, &stats);
+  printf("pairs matched: %lu for the text, %lu after an edit\n", misses, stats.misses - misses);
+  assert(stats.misses - misses < 5);
+  // random edits (each one undone right after), either way the same as
+  // parsing from scratch.
+  const char * inserts[] = {"", "x", ";", "=", "7", "\"", " ", "ab=1; ", "q=\"\";"};
+  unsigned seed = 1;
+  int parsed = 0, offset = 0, removed = 0, inserted = 0;
+  char undo[4];
+  for (i = 0; i < 2000; i++) {
+    int len, last1 = 0, last2 = 0;
+    const char * t = gram_doc_get_text(doc, &len);
+    struct ast * ast1;
+    if (i % 2) {
+      ast1 = gram_doc_edit(doc, offset, inserted, undo, removed, &last1);
+    } else {
+      seed = seed * 1103515245 + 12345;
+      const char * ins = inserts[(seed >> 16) % (sizeof inserts / sizeof inserts[0])];
+      offset = i % 10 == 8 ? len : (seed >> 8) % (len + 1); // at the end too.
+      removed = (seed >> 4) % 4;
+      if (offset + removed > len)
+	removed = len - offset;
+      inserted = strlen(ins);
+      memcpy(undo, t + offset, removed);
+      ast1 = gram_doc_edit(doc, offset, removed, ins, inserted, &last1);
+    }
+    t = gram_doc_get_text(doc, &len);
+    struct ast * ast2 = parse_arena_n(NULL, t, len, doc_gram, &last2, 0);
+    assert(ast1 ? ast2 && ast_equal(ast1, ast2) : !ast2);
+    assert(last1 == last2);
+    if (ast2) {
+      parsed++;
+      free_ast(ast2);
+    }
+  }
+  assert(parsed > 1000);
+  assert(!gram_doc_edit(doc, 1, 1 << 20, "", 0, NULL));
+  free_gram_doc(doc);
+  printf("test13 passed!\n\n");
+}
+
+struct shared_parse {
+  struct gram * gram;
+  const char * text;
+  struct ast * expected;
+  bool ok;
+};
+
+static void * parse_shared(void * arg) {
+  struct shared_parse * p = arg;
+  struct gram_context * ctx = new_gram_context();
+  int i, flags[] = {0, PARSE_MEMO, PARSE_PACKRAT, PARSE_ITERATIVE};
+  p->ok = true;
+  for (i = 0; i < 400; i++) {
+    int last = 0;
+    struct ast * ast = parse_context(ctx, NULL, p->text, strlen(p->text), p->gram, &last, flags[i % 4]);
+    p->ok = p->ok && ast && ast_equal(ast, p->expected) && last == strlen(p->text);
+    if (ast)
+      free_ast(ast);
+  }
+  free_gram_context(ctx);
+  return NULL;
+}
+
+void test14(void) {
+  // frozen grammars are shared by threads, each one with its own context.
+  struct gram * gram = new_gram_aster((void *)1, new_gram_alt((void *)2,
+	new_gram_cat((void *)3, new_gram_int((void *)4), new_gram_string(NULL, ",")),
+	new_gram_string((void *)5, " ")));
+  const char * text = "1, 22, 333, 0x1f, -5,";
+  struct ast * expected = parse(text, gram, NULL);
+  assert(gram_freeze(gram) == gram);
+  struct gram_memo_stats stats;
+  assert(parse_ex(text, gram, NULL, PARSE_PACKRAT));
+  gram_get_memo_stats(gram, &stats);
+  assert(!stats.hits && !stats.misses);
+  struct shared_parse parses[4];
+  pthread_t threads[4];
+  int i;
+  for (i = 0; i < 4; i++) {
+    parses[i] = (struct shared_parse){gram, text, expected};
+    assert(!pthread_create(&threads[i], NULL, parse_shared, &parses[i]));
+  }
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    assert(parses[i].ok);
+  }
+  free_ast(expected);
+  printf("test14 passed!\n\n");
+}
+
+// n nested parens.
+static char * nested(int n) {
+  char * text = malloc(2 * n + 1);
+  int i;
+  for (i = 0; i < n; i++) {
+    text[i] = '(';
+    text[2 * n - 1 - i] = ')';
+  }
+  text[2 * n] = '\0';
+  return text;
+}
+
+void test15(void) {
+  // too deep for the C stack: the parse fails, unless it's iterative.
+  struct gram * opt, * gram = new_gram_cat((void *)1,
+      new_gram_string(NULL, "("),
+      opt = new_gram_opt((void *)2, (struct gram *)(-1)),
+      new_gram_string(NULL, ")"));
+  gram_set_child(opt, gram, 0);
+  char * text = nested(100000);
+  int last = 0;
+  assert(!parse(text, gram, &last));
+  assert(match_ex(text, gram, NULL, PARSE_PACKRAT) == -1);
+  struct ast_arena * arena = new_ast_arena();
+  struct ast * ast = parse_arena(arena, text, gram, &last, PARSE_ITERATIVE);
+  assert(ast && ast->len == 200000 && last == 200000);
+  assert(match_ex(text, gram, NULL, PARSE_ITERATIVE) == 200000);
+  text[100000] = '(';
+  assert(match_ex(text, gram, NULL, PARSE_ITERATIVE) == -1);
+  // a context tells why it failed.
+  struct gram_context * ctx = new_gram_context();
+  assert(match_context(ctx, text, 200000, gram, NULL, PARSE_ITERATIVE) == -1);
+  assert(!gram_context_overflow(ctx));
+  text[100000] = ')';
+  assert(match_context(ctx, text, 200000, gram, NULL, 0) == -1);
+  assert(gram_context_overflow(ctx));
+  assert(match_context(ctx, text, 200000, gram, NULL, PARSE_ITERATIVE) == 200000);
+  assert(!gram_context_overflow(ctx));
+  free(text);
+  // otherwise both engines build the same trees.
+  text = nested(1000);
+  struct ast * expected = parse(text, gram, NULL);
+  assert(expected);
+  ast = parse_ex(text, gram, NULL, PARSE_ITERATIVE);
+  assert(ast_equal(ast, expected));
+  free_ast(ast);
+  // frozen grammars are compiled once, by the first iterative parse.
+  gram_freeze(gram);
+  int i;
+  for (i = 0; i < 3; i++) {
+    ast_arena_reset(arena);
+    ast = parse_context(ctx, arena, text, 2000, gram, NULL, PARSE_ITERATIVE);
+    assert(ast_equal(ast, expected));
+  }
+  free_gram_context(ctx);
+  free_ast_arena(arena);
+  free_ast(expected);
+  free(text);
+  printf("test15 passed!\n\n");
+}
+
+static void expect_literal(struct gram * gram, const char * expected, int expected_anchored) {
+  char literal[64];
+  int anchored = -1, len = gram_required_literal(gram, literal, sizeof literal, &anchored);
+  printf("literal \"%.*s\", anchored=%d\n", len, literal, anchored);
+  assert(len == strlen(expected) && !memcmp(literal, expected, len));
+  assert(!len || anchored == expected_anchored);
+}
+
+void test16(void) {
+  struct gram * hello = new_gram_string(NULL, "hello");
+  struct gram * dot = new_gram_dot(NULL);
+  // (!"hello".)*"hello"
+  expect_literal(new_gram_cat(NULL, new_gram_aster(NULL, new_gram_cat(NULL,
+	  new_gram_negla(NULL, hello), dot)), hello), "hello", 0);
+  // "hel" "lo" . "x"+ "yz": the prefix is as long as the other strings.
+  expect_literal(new_gram_cat(NULL, new_gram_string(NULL, "hel"), new_gram_string(NULL, "lo"),
+	dot, new_gram_plus(NULL, new_gram_string(NULL, "x")), new_gram_string(NULL, "yz")), "hello", 1);
+  // ("ab" / "ac") "d"? . "xyz" ("ww" "a" / "www"): a joint, the common prefix.
+  expect_literal(new_gram_cat(NULL, new_gram_alt(NULL, new_gram_string(NULL, "ab"),
+	  new_gram_string(NULL, "ac")), new_gram_opt(NULL, new_gram_string(NULL, "d")), dot,
+	new_gram_string(NULL, "xyz"), new_gram_alt(NULL, new_gram_cat(NULL,
+	    new_gram_string(NULL, "ww"), new_gram_string(NULL, "a")), new_gram_string(NULL, "www"))),
+      "xyzww", 0);
+  // "a" | . : nothing.
+  expect_literal(new_gram_alt(NULL, new_gram_string(NULL, "a"), dot), "", 0);
+  // a = "(" a ")" / "x": the alternatives share nothing.
+  struct gram * parens = new_gram_cat(NULL, new_gram_string(NULL, "("), (struct gram *)-1,
+      new_gram_string(NULL, ")"));
+  struct gram * a = new_gram_alt(NULL, parens, new_gram_string(NULL, "x"));
+  gram_set_child(parens, a, 1);
+  expect_literal(a, "", 0);
+  printf("test16 passed!\n\n");
+}
+
+static void add_span(int from, int len, void * privdata) {
+  char ** spans = privdata;
+  *spans += sprintf(*spans, "%d:%d ", from, len);
+}
+
+static void expect_search_all(struct gram_context * ctx, const char * text, struct gram * gram,
+    const char * expected) {
+  char buf[256], * spans = buf;
+  const char * p;
+  int count = 0;
+  *buf = '\0';
+  for (p = expected; *p; p++)
+    count += *p == ' ';
+  int found = search_all(ctx, text, strlen(text), gram, 0, &add_span, &spans);
+  printf("search_all \"%s\": %s\n", text, buf);
+  assert(found == count);
+  assert(!strcmp(buf, expected));
+}
+
+void test17(void) {
+  struct gram_context * ctx = new_gram_context();
+  unsigned char digits[32] = {0};
+  int c, len = -1;
+  for (c = '0'; c <= '9'; c++)
+    digits[c >> 3] |= 1 << (c & 7);
+  struct gram * number = new_gram_span(NULL, digits, 0, 1);
+  struct gram * hello = new_gram_cat(NULL, new_gram_string(NULL, "hello"),
+      new_gram_negla(NULL, new_gram_string(NULL, "!")));
+  struct gram * as = new_gram_aster(NULL, new_gram_string(NULL, "a"));
+  gram_analyze(number);
+  gram_analyze(hello);
+  gram_analyze(as);
+  assert(search(ctx, "ab12cd345", 9, number, &len, 0) == 2 && len == 2);
+  assert(search(NULL, "abcd", 4, number, &len, 0) == -1);
+  assert(search(ctx, "hello! hello", 12, hello, &len, PARSE_ITERATIVE) == 7 && len == 5);
+  expect_search_all(ctx, "ab12cd345", number, "2:2 6:3 ");
+  expect_search_all(ctx, "hello hello! hellohello", hello, "0:5 13:5 18:5 ");
+  expect_search_all(NULL, "baa", as, "0:0 1:2 3:0 ");
+  expect_search_all(ctx, "", number, "");
+  free_gram_context(ctx);
+  printf("test17 passed!\n\n");
+}
+
+// the nodes of ast are those of flat from *node on, in the same order.
+static void expect_flat(struct ast * ast, const struct ast_flat * flat, unsigned * node) {
+  const struct ast_node * n = &flat->nodes[*node];
+  unsigned first = (*node)++;
+  int i;
+  assert(flat->rules[n->rule] == ast->user_data);
+  assert(n->from == ast->from && n->len == ast->len);
+  for (i = 0; ast->children[i]; i++)
+    expect_flat(ast->children[i], flat, node);
+  assert(n->size == *node - first);
+}
+
+void test18(void) {
+  // list = '(' (list / atom / ' ')* ')';
+  // atom = [a-z]+;
+  unsigned char letters[32] = {0};
+  int c, last = 0, depth = 0, children = 0;
+  for (c = 'a'; c <= 'z'; c++)
+    letters[c >> 3] |= 1 << (c & 7);
+  struct gram * list_ref;
+  struct gram * list = new_gram_cat((void*)0x1,
+      new_gram_string(NULL, "("),
+      new_gram_aster(NULL, list_ref = new_gram_alt(NULL,
+	  (struct gram *)(-1),
+	  new_gram_span((void*)0xa, letters, 0, 1),
+	  new_gram_string(NULL, " "))),
+      new_gram_string(NULL, ")"));
+  gram_set_child(list_ref, list, 0);
+  const char * text = "(ab (c d) (e (f)) g)";
+  struct gram_context * ctx = new_gram_context();
+  struct ast * ast = parse(text, list, &last);
+  struct ast_flat * flat = parse_flat(ctx, text, strlen(text), list, &last, 0);
+  assert(ast && flat);
+  unsigned node = 0;
+  expect_flat(ast, flat, &node);
+  assert(node == flat->count && flat->nodes[0].size == flat->count);
+  assert(flat->rules_count == 3 && !flat->rules[0]);
+  // the same tree, flattened afterwards or converted back:
+  struct ast_flat * copy = flatten_ast(ast);
+  assert(copy->count == flat->count && copy->rules_count == flat->rules_count);
+  assert(!memcmp(copy->nodes, flat->nodes, sizeof (struct ast_node) * flat->count));
+  struct ast * back = ast_flat_to_ast(flat, 0);
+  assert(ast_equal(ast, back));
+  // the root is '(' (node 1), the repetition (node 2) and ')'. The
+  // repetition has 7 alternatives matched: 2 atoms, 2 lists and 3 ' '.
+  struct ast_iter it;
+  const struct ast_node * child;
+  ast_iter_children(&it, flat, 2);
+  while ((child = ast_iter_next(&it)))
+    children++;
+  for (c = 0; ast->children[1]->children[c]; c++)
+    ;
+  assert(children == c && c == 7);
+  ast_iter_subtree(&it, flat, 0);
+  for (node = 0; (child = ast_iter_next(&it)); node++)
+    assert(child == &flat->nodes[node]);
+  assert(node == flat->count);
+  // the cursor visits them in preorder too.
+  struct ast_cursor cursor;
+  ast_cursor_init(&cursor, flat);
+  node = 0;
+  do {
+    assert(cursor.node == node++ && cursor.depth == depth);
+    if (ast_cursor_first_child(&cursor)) {
+      depth++;
+      continue;
+    }
+    while (!ast_cursor_next_sibling(&cursor) && ast_cursor_parent(&cursor))
+      depth--;
+  } while (cursor.depth);
+  assert(node == flat->count && !ast_cursor_parent(&cursor));
+  ast_cursor_release(&cursor);
+  assert(!parse_flat(NULL, "(a", 2, list, &last, PARSE_ITERATIVE));
+  free_ast(ast);
+  free_ast(back);
+  free_ast_flat(flat);
+  free_ast_flat(copy);
+  free_gram_context(ctx);
+  printf("test18 passed!\n\n");
+}
+
+static void print_enter(void * user_data, int from, int len, void * privdata) {
+  char ** events = privdata;
+  *events += sprintf(*events, "<%lx:%d:%d", (long)user_data, from, len);
+}
+
+static void print_exit(void * user_data, int from, int len, void * privdata) {
+  char ** events = privdata;
+  *events += sprintf(*events, ">%lx", (long)user_data);
+}
+
+// the events expected for the nodes with user_data of ast.
+static void print_tree_events(struct ast * ast, char ** events) {
+  int i;
+  if (ast->user_data)
+    print_enter(ast->user_data, ast->from, ast->len, events);
+  for (i = 0; ast->children[i]; i++)
+    print_tree_events(ast->children[i], events);
+  if (ast->user_data)
+    print_exit(ast->user_data, ast->from, ast->len, events);
+}
+
+void test19(void) {
+  // list = '(' (list / atom / ' ')* ')';
+  // atom = [a-z]+;
+  unsigned char letters[32] = {0};
+  int c, last = 0;
+  for (c = 'a'; c <= 'z'; c++)
+    letters[c >> 3] |= 1 << (c & 7);
+  struct gram * list_ref, * atom = new_gram_span((void*)0xa, letters, 0, 1);
+  struct gram * list = new_gram_cat((void*)0x1,
+      new_gram_string(NULL, "("),
+      new_gram_aster(NULL, list_ref = new_gram_alt(NULL,
+	  (struct gram *)(-1), atom, new_gram_string(NULL, " "))),
+      new_gram_string(NULL, ")"));
+  gram_set_child(list_ref, list, 0);
+  // pair = atom ';' / atom ',' atom;  (the first atom is matched twice)
+  struct gram * pair = new_gram_alt(NULL,
+      new_gram_cat((void*)0x2, atom, new_gram_string(NULL, ";"), NULL),
+      new_gram_cat((void*)0x3, atom, new_gram_string(NULL, ","), atom, NULL));
+  const char * text = "(ab (c d) (e (f)) g)";
+  char expected[512], buf[512], * events;
+  struct gram_context * ctx = new_gram_context();
+  struct ast * ast = parse(text, list, &last);
+  events = expected;
+  print_tree_events(ast, &events);
+  events = buf;
+  assert(parse_events(ctx, text, strlen(text), list, &last, 0, &print_enter, &print_exit, &events) == 20);
+  printf("events: %s\n", buf);
+  assert(!strcmp(buf, expected));
+  events = buf;
+  assert(parse_events(NULL, text, strlen(text), list, &last, PARSE_ITERATIVE, &print_enter, &print_exit, &events) == 20);
+  assert(!strcmp(buf, expected));
+  // no event of the failed alternative, nor of the failed parse.
+  events = buf;
+  assert(parse_events(ctx, "ab,cd", 5, pair, &last, 0, &print_enter, &print_exit, &events) == 5);
+  printf("events: %s\n", buf);
+  assert(!strcmp(buf, "<3:0:5<a:0:2>a<a:3:2>a>3"));
+  events = buf;
+  *buf = '\0';
+  assert(parse_events(ctx, "(ab (c", 6, list, &last, 0, &print_enter, &print_exit, &events) == -1);
+  assert(!*buf);
+  events = buf;
+  assert(parse_events(ctx, "ab;", 3, pair, &last, PARSE_MEMO, &print_enter, NULL, &events) == 3);
+  assert(!strcmp(buf, "<2:0:3<a:0:2"));
+  free_ast(ast);
+  free_gram_context(ctx);
+  printf("test19 passed!\n\n");
+}
+
+void test20(void) {
+  // list = '(' (list / atom / sp)* ')';  with the nested lists unwrapped
+  // atom = [a-z]+;
+  // sp = ' ';  discarded
+  unsigned char letters[32] = {0};
+  int c, last = 0;
+  for (c = 'a'; c <= 'z'; c++)
+    letters[c >> 3] |= 1 << (c & 7);
+  struct gram * list_ref, * sp = new_gram_string((void*)0x5, " ");
+  struct gram * list = new_gram_cat((void*)0x1,
+      new_gram_string(NULL, "("),
+      new_gram_aster(NULL, list_ref = new_gram_alt(NULL,
+	  (struct gram *)(-1), new_gram_span((void*)0xa, letters, 0, 1), sp)),
+      new_gram_string(NULL, ")"));
+  gram_set_child(list_ref, list, 0);
+  gram_set_filter(list, FILTER_AST_ONLY_KEEP_CHILDREN);
+  gram_set_filter(sp, FILTER_AST_DISCARD);
+  assert(gram_get_filter(sp) == FILTER_AST_DISCARD);
+  // the root is kept, the nested lists are not.
+  const char * text = "(ab (c d) (e (f)) g)";
+  const char * expected = "<1:0:20<a:1:2>a<a:5:1>a<a:7:1>a<a:11:1>a<a:14:1>a<a:18:1>a>1";
+  char buf[512], * events;
+  struct ast_arena * arena = new_ast_arena();
+  struct ast * ast = parse_arena(arena, text, list, &last, 0);
+  events = buf;
+  print_tree_events(ast, &events);
+  printf("events: %s\n", buf);
+  assert(!strcmp(buf, expected));
+  events = buf;
+  assert(parse_events(NULL, text, strlen(text), list, &last, 0, &print_enter, &print_exit, &events) == 20);
+  assert(!strcmp(buf, expected));
+  events = buf;
+  assert(parse_events(NULL, text, strlen(text), list, &last, PARSE_ITERATIVE, &print_enter, &print_exit, &events) == 20);
+  assert(!strcmp(buf, expected));
+  free_ast_arena(arena);
+  printf("test20 passed!\n\n");
+}
+
 int main(void) {
   test1();
   test2();
   test3();
   test4();
+  test5();
+  test6();
+  test7();
+  test8();
+  test9();
+  test10();
+  test11();
+  test12();
+  test13();
+  test14();
+  test15();
+  test16();
+  test17();
+  test18();
+  test19();
+  test20();
   return 0;
 }
@@ -1,108 +1,133 @@
 #include <assert.h>
-#include <errno.h>
+#include <ctype.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "gram.h"
+#include "gram-private.h"
+#include "gramvm.h"
 
-#define PTRBUFF_SIZE (1<<4)
-#define PTRBUFF_SIZE2 (1<<10)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SPAN_AVX2 1
+#endif
+
+#define WALK_LOCAL 32
 
 /************************************************************************\
-*				 PTRBUFF				 *
-* This type works like a kind of obstack, but useless functions were	 *
-* removed, and the code was optimized for handling pointers only.	 *
+*				  WALK					 *
+* Depth first walks of trees with an explicit stack grown on the heap,	 *
+* so trees as deep as the iterative engine builds them don't overflow	 *
+* the C stack.								 *
 \************************************************************************/
 
-struct ptrbuff_chunk {
-  struct ptrbuff_chunk * prev;
-  void * ptrs[PTRBUFF_SIZE2];
+struct walk_frame {
+  struct ast * ast;
+  int child; // the next child to visit.
+  int data; // whatever the walker remembers of the node.
 };
 
-struct ptrbuff {
-  int count;
-  struct ptrbuff_chunk * last;
-  void * ptrs[PTRBUFF_SIZE];
+struct walk {
+  struct walk_frame * frames;
+  int depth, size;
+  struct walk_frame local[WALK_LOCAL]; // enough for most trees.
 };
 
-static inline void ptrbuff_init(struct ptrbuff * buff) {
-  buff->count = 0;
-  buff->last = NULL;
+static inline void walk_init(struct walk * w) {
+  w->frames = w->local;
+  w->depth = 0;
+  w->size = WALK_LOCAL;
 }
 
-// please, do not call directly, but from ptrbuff_push.
-static void ptrbuff_push2(struct ptrbuff * buff, void * ptr) {
-  int c = (buff->count - PTRBUFF_SIZE) & (PTRBUFF_SIZE2 - 1);
-  if (c == 0) {
-    struct ptrbuff_chunk * newchunk = malloc(sizeof (struct ptrbuff_chunk));
-    newchunk->prev = buff->last;
-    buff->last = newchunk;
-  }
-  buff->last->ptrs[c] = ptr;
+static void walk_grow(struct walk * w) {
+  w->size *= 2;
+  if (w->frames == w->local) {
+    w->frames = malloc(sizeof (struct walk_frame) * w->size);
+    memcpy(w->frames, w->local, sizeof w->local);
+  } else
+    w->frames = realloc(w->frames, sizeof (struct walk_frame) * w->size);
 }
 
-static inline void ptrbuff_push(struct ptrbuff * buff, void * ptr) {
-  if (buff->count >= PTRBUFF_SIZE)
-    ptrbuff_push2(buff, ptr);
-  else
-    buff->ptrs[buff->count] = ptr;
-  buff->count++;
+static inline void walk_push(struct walk * w, struct ast * ast, int data) {
+  if (w->depth == w->size)
+    walk_grow(w);
+  w->frames[w->depth++] = (struct walk_frame){ast, 0, data};
 }
 
-/**
- * Use this function to close the ptrbuff.
- *   * All the pointers stored will be copied (in order) to dest.
- *   * Its size will return to zero, and
- *   * all the extra chunks will be freed (but not the ptrbuff).
- * So you may use this ptrbuff again.
- */
-static void ptrbuff_finalize(void ** dest, struct ptrbuff * buff) {
-  // simple case first.
-  if (buff->count <= PTRBUFF_SIZE) {
-    memcpy(dest, buff->ptrs, sizeof (void *) * buff->count);
-    buff->count = 0;
-    return;
-  }
-  // copy the first (full) array of pointers
-  memcpy(dest, buff->ptrs, PTRBUFF_SIZE);
-  buff->count -= PTRBUFF_SIZE;
-  dest += PTRBUFF_SIZE;
-  // copy the last array of pointers which may be partially full.
-  int pos = (buff->count - 1) & ~(PTRBUFF_SIZE2 - 1);
-  int c = ((buff->count - 1) & (PTRBUFF_SIZE2 - 1)) + 1;
-  struct ptrbuff_chunk * tmp = buff->last->prev;
-  memcpy(dest + pos, buff->last->ptrs, sizeof (void *) * c);
-  free(buff->last);
-  buff->last = tmp;
-  while (buff->last) {
-    pos -= PTRBUFF_SIZE2;
-    memcpy(dest + pos, buff->last->ptrs, sizeof (void *) * PTRBUFF_SIZE2);
-    tmp = buff->last->prev;
-    free(buff->last);
-    buff->last = tmp;
-  }
-  buff->count = 0;
-}
-
-static void ptrbuff_reset(struct ptrbuff * buff, void(*freefn)(void *)) {
-  int i;
-  if (buff->count <= PTRBUFF_SIZE) {
-    if (freefn)
-      for (i = 0; i < buff->count; i++)
-	freefn(buff->ptrs[i]);
-    return;
+// the next child of the node on top, or NULL once they were all visited.
+static inline struct ast * walk_next_child(struct walk * w) {
+  struct walk_frame * f = &w->frames[w->depth - 1];
+  struct ast * child = f->ast->children[f->child];
+  if (child)
+    f->child++;
+  return child;
+}
+
+static inline void walk_release(struct walk * w) {
+  if (w->frames != w->local)
+    free(w->frames);
+}
+
+/************************************************************************\
+*				  ARENA					 *
+* A bump allocator for ast nodes. Nodes are never freed one by one: the	 *
+* arena may be rewound to a previous mark (discarding everything	 *
+* allocated after it), or reset/freed as a whole.			 *
+\************************************************************************/
+
+#define ARENA_BLOCK_SIZE (1<<16)
+
+static struct ast_arena_block * new_arena_block(size_t size, struct ast_arena_block * next) {
+  struct ast_arena_block * block = malloc(sizeof (struct ast_arena_block) + size);
+  block->next = next;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+struct ast_arena * new_ast_arena(void) {
+  struct ast_arena * arena = malloc(sizeof (struct ast_arena));
+  arena->first = arena->current = new_arena_block(ARENA_BLOCK_SIZE, NULL);
+  return arena;
+}
+
+void * arena_alloc_block(struct ast_arena * arena, size_t size) {
+  struct ast_arena_block * block = arena->current;
+  // blocks after current were left there by a rewind, so reuse them.
+  if (!block->next || block->next->size < size) {
+    size_t newsize = block->size * 2;
+    while (newsize < size)
+      newsize *= 2;
+    block->next = new_arena_block(newsize, block->next);
   }
-  buff->count -= PTRBUFF_SIZE;
-  while (buff->last) {
-    int c = ((buff->count - 1) & (PTRBUFF_SIZE2 - 1)) + 1;
-    struct ptrbuff_chunk * prev = buff->last->prev;
-    free(buff->last);
-    buff->last = prev;
-    buff->count -= c;
+  block = arena->current = block->next;
+  block->used = size;
+  return block->data;
+}
+
+static inline void arena_rewind(struct ast_arena * arena, struct arena_mark mark) {
+  arena->current = mark.block;
+  mark.block->used = mark.used;
+}
+
+void ast_arena_reset(struct ast_arena * arena) {
+  arena->current = arena->first;
+  arena->first->used = 0;
+}
+
+void free_ast_arena(struct ast_arena * arena) {
+  struct ast_arena_block * block, * next;
+  for (block = arena->first; block; block = next) {
+    next = block->next;
+    free(block);
   }
-  assert(buff->count == 0);
+  free(arena);
 }
 
 /************************************************************************\
@@ -111,15 +136,24 @@ static void ptrbuff_reset(struct ptrbuff * buff, void(*freefn)(void *)) {
 * expression grammars) support.						 *
 \************************************************************************/
 
-struct gram {
-  void * user_data;
-  struct ast * (*matcher)(const char * text, int cursor, struct gram * gram, struct gram_state * state);
-};
-
-struct gram_state {
-  int last;
-  int depth;
-};
+static void init_gram(struct gram * gram, void * user_data, enum gram_type type,
+    int (*matcher)(const char * text, int cursor, struct gram * gram, struct gram_state * state)) {
+  gram->user_data = user_data;
+  gram->type = type;
+  gram->matcher = matcher;
+  gram->filter = FILTER_AST_KEEP;
+  gram->memo_policy = GRAM_MEMO_AUTO;
+  gram->memo_hits = gram->memo_misses = 0;
+  gram->seen_serial = 0;
+  gram->seen_cursor = -1;
+  gram->memo_hot = false;
+  gram->frozen = false;
+  // until analyzed, it may start with anything.
+  gram->analysis_serial = 0;
+  gram->nullable = true;
+  memset(gram->first, 0xff, sizeof gram->first);
+  gram->program = NULL;
+}
 
 inline void gram_state_update_last(struct gram_state * state, int val) {
   if (val > state->last)
@@ -130,108 +164,1128 @@ inline int gram_state_get_last(struct gram_state * state) {
   return state->last;
 }
 
-void gram_state_incr_depth_stack_overflow() {
-  fprintf(stderr, "STACK OVERFLOW! Make sure the grammar consume input before doing\n"
-      "infinite loops, e.g. left recursions are not allowed.\n");
-  exit(1);
+int gram_state_get_len(struct gram_state * state) {
+  return state->len;
 }
-inline void gram_state_incr_depth(struct gram_state * state) {
-  state->depth++;
-  if (state->depth & ~0xfff)
-    gram_state_incr_depth_stack_overflow();
+
+static bool gram_state_overflow(struct gram_state * state) {
+  state->depth--;
+  state->overflow = true;
+  // every matcher fails from now on, so the parse unwinds quickly.
+  state->max_depth = 0;
+  return false;
 }
 
-inline void gram_state_decr_depth(struct gram_state * state) {
+// matchers calling others must give up (failing) when it returns false.
+static inline bool gram_state_incr_depth(struct gram_state * state) {
+  if (++state->depth > state->max_depth)
+    return gram_state_overflow(state);
+  return true;
+}
+
+static inline void gram_state_decr_depth(struct gram_state * state) {
   state->depth--;
 }
 
-static struct ast * allocate_ast(void * user_data, int from, int len, int num_children) {
+struct ast * allocate_ast(void * user_data, int from, int len, int num_children) {
   struct ast * ast = malloc(sizeof (struct ast) + sizeof (struct ast*) * (num_children+1));
   ast->user_data = user_data;
   ast->from = from;
   ast->len = len;
+  ast->refs = 1;
   memset(ast->children, 0, sizeof (struct ast*) * (num_children+1));
   return ast;
 }
 
+void gram_state_grow_nodes(struct gram_state * state) {
+  state->nodes_size = state->nodes_size ? 2 * state->nodes_size : 64;
+  state->nodes = realloc(state->nodes, sizeof (struct ast *) * state->nodes_size);
+}
+
+void gram_state_grow_events(struct gram_state * state) {
+  state->events_size = state->events_size ? 2 * state->events_size : 64;
+  state->events = realloc(state->events, sizeof (struct gram_event) * state->events_size);
+}
+
+
+void gram_state_drop(struct gram_state * state, struct gram_mark mark) {
+  int i;
+  if (state->record_events) {
+    // the events are just forgotten.
+  } else if (!state->arena) {
+    for (i = mark.nodes; i < state->nodes_count; i++)
+      free_ast(state->nodes[i]);
+  } else if (!state->memo) {
+    // memoized nodes may still be referenced from the memo table.
+    arena_rewind(state->arena, mark.arena);
+  }
+  state->nodes_count = mark.nodes;
+}
+
+/************************************************************************\
+*				   MEMO					 *
+* Packrat memoization table: an open addressing hash table mapping	 *
+* (gram, cursor) to the result of that match (-1 on failure). Every	 *
+* stored ast holds a reference, so it can be shared by several parents.	 *
+\************************************************************************/
+
+#define MEMO_INITIAL_SIZE (1<<8)
+
+struct memo_entry {
+  struct gram * gram; // NULL for empty slots.
+  int cursor;
+  int len;
+  int last; // max last reached while matching, or -1 if untouched.
+  int reach; // the result holds as long as [cursor, reach) isn't edited.
+  struct ast * ast; // NULL when not building the tree.
+};
+
+struct memo {
+  int size; // always a power of two.
+  int count;
+  struct memo_entry * entries;
+};
+
+static void memo_init(struct memo * memo) {
+  memo->size = MEMO_INITIAL_SIZE;
+  memo->count = 0;
+  memo->entries = calloc(memo->size, sizeof (struct memo_entry));
+}
+
+static void memo_clear(struct memo * memo) {
+  int i;
+  if (!memo->count)
+    return;
+  for (i = 0; i < memo->size; i++)
+    if (memo->entries[i].gram && memo->entries[i].ast && memo->entries[i].ast->refs)
+      free_ast(memo->entries[i].ast);
+  memset(memo->entries, 0, sizeof (struct memo_entry) * memo->size);
+  memo->count = 0;
+}
+
+static void memo_destroy(struct memo * memo) {
+  memo_clear(memo);
+  free(memo->entries);
+}
+
+static inline unsigned memo_hash(struct gram * gram, int cursor) {
+  uintptr_t h = (uintptr_t)gram >> 4;
+  h ^= (uintptr_t)cursor * 0x9e3779b1u;
+  return (unsigned)(h ^ (h >> 15));
+}
+
+// returns the entry for (gram, cursor), or the empty slot where it belongs.
+static struct memo_entry * memo_slot(struct memo * memo, struct gram * gram, int cursor) {
+  unsigned mask = memo->size - 1;
+  unsigned i = memo_hash(gram, cursor) & mask;
+  while (memo->entries[i].gram
+      && (memo->entries[i].gram != gram || memo->entries[i].cursor != cursor))
+    i = (i + 1) & mask;
+  return &memo->entries[i];
+}
+
+static void memo_grow(struct memo * memo) {
+  struct memo_entry * old = memo->entries;
+  int i, oldsize = memo->size;
+  memo->size *= 2;
+  memo->entries = calloc(memo->size, sizeof (struct memo_entry));
+  for (i = 0; i < oldsize; i++)
+    if (old[i].gram)
+      *memo_slot(memo, old[i].gram, old[i].cursor) = old[i];
+  free(old);
+}
+
+static void memo_insert(struct memo * memo, struct gram * gram, int cursor, int len, int last,
+    int reach, struct ast * ast) {
+  if (2 * (memo->count + 1) > memo->size)
+    memo_grow(memo);
+  struct memo_entry * e = memo_slot(memo, gram, cursor);
+  assert(!e->gram);
+  e->gram = gram;
+  e->cursor = cursor;
+  e->len = len;
+  e->last = last;
+  e->reach = reach;
+  e->ast = ast;
+  if (ast && ast->refs)
+    ast->refs++;
+  memo->count++;
+}
+
+// an AUTO gram needs this many misses before its hit rate is judged.
+#define MEMO_PROBATION 1024
+
+static int memo_match(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  struct memo_entry * e = memo_slot(state->memo, gram, cursor);
+  if (e->gram) {
+    if (!gram->frozen)
+      gram->memo_hits++;
+    gram_state_update_last(state, e->last);
+    if (e->reach > state->reach)
+      state->reach = e->reach;
+    if (e->ast) {
+      if (e->ast->refs)
+	e->ast->refs++;
+      gram_state_push(state, e->ast);
+    }
+    return e->len;
+  }
+  // match with a clean last, so we know how far this gram alone reached.
+  int outer_last = state->last, outer_reach = state->reach;
+  state->last = -1;
+  // it looks at the cursor at least (e.g. alternations choose by its byte),
+  // and custom grams are trusted to set last to what they read.
+  state->reach = cursor + 1;
+  int len = gram->matcher(text, cursor, gram, state);
+  if (state->last + 1 > state->reach)
+    state->reach = state->last + 1;
+  // the table may have been resized by recursive calls, so look it up again.
+  memo_insert(state->memo, gram, cursor, len, state->last, state->reach,
+      len >= 0 && state->build ? state->nodes[state->nodes_count - 1] : NULL);
+  gram_state_update_last(state, outer_last);
+  if (outer_reach > state->reach)
+    state->reach = outer_reach;
+  if (gram->frozen)
+    return len;
+  gram->memo_misses++;
+  if (gram->memo_policy == GRAM_MEMO_AUTO && gram->memo_misses >= MEMO_PROBATION
+      && gram->memo_hits < gram->memo_misses / 64)
+    gram->memo_policy = GRAM_MEMO_NEVER;
+  return len;
+}
+
+// decides whether the result of gram at cursor must be memoized with PARSE_MEMO.
+static inline bool memo_wanted(int cursor, struct gram * gram, struct gram_state * state) {
+  if (gram->memo_policy != GRAM_MEMO_AUTO)
+    return gram->memo_policy == GRAM_MEMO_ALWAYS;
+  if (gram->user_data || gram->memo_hot)
+    return true;
+  if (gram->frozen) // shared by other threads, so it learns nothing.
+    return false;
+  if (gram->seen_serial == state->serial && gram->seen_cursor == cursor) {
+    // matched twice in a row at the same place, it's worth remembering.
+    gram->memo_hot = true;
+    return true;
+  }
+  gram->seen_serial = state->serial;
+  gram->seen_cursor = cursor;
+  return false;
+}
+
+// matches a terminal when memoizing, keeping track of how far it looked.
+static int terminal_match(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  int len = gram->matcher(text, cursor, gram, state), reach = cursor + 1;
+  if (gram->type == GRAM_STRING)
+    reach = cursor + ((struct gram_string *)gram)->len;
+  else if (gram->type == GRAM_SPAN) // up to the byte stopping the run.
+    reach = cursor + (len >= 0 ? len : ((struct gram_span *)gram)->min) + 1;
+  if (reach > state->reach)
+    state->reach = reach;
+  return len;
+}
+
+// matches gram pushing its node, whatever its filter (as for the root).
+static inline int gram_match_node(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  if (state->memo) {
+    // terminals are cheaper to match again than to memoize.
+    if (gram->type <= GRAM_SPAN)
+      return terminal_match(text, cursor, gram, state);
+    if ((state->flags & PARSE_PACKRAT) || memo_wanted(cursor, gram, state))
+      return memo_match(text, cursor, gram, state);
+  }
+  return gram->matcher(text, cursor, gram, state);
+}
+
+// replaces the node on top of the stack by its children.
+static void unwrap_node(struct gram_state * state, struct gram * gram) {
+  struct ast * ast;
+  int i;
+  if (state->record_events) {
+    if (gram->user_data) // (then its event is the last one)
+      state->nodes_count--;
+    return;
+  }
+  ast = state->nodes[--state->nodes_count];
+  for (i = 0; ast->children[i]; i++) {
+    // the children of a shared node get one more owner.
+    if (ast->refs > 1 && ast->children[i]->refs)
+      ast->children[i]->refs++;
+    gram_state_push(state, ast->children[i]);
+  }
+  if (ast->refs == 1) // its children were moved.
+    free(ast);
+  else if (ast->refs)
+    ast->refs--;
+}
+
+// matches a gram whose node is filtered while building the tree.
+static int filter_match(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  struct gram_mark mark = gram_state_mark(state);
+  int len;
+  // the subtrees of LEAF and DISCARD grams aren't even built, unless the
+  // memo table may hand them to other matches.
+  if (gram->filter != FILTER_AST_ONLY_KEEP_CHILDREN && !state->memo) {
+    state->build = false;
+    len = gram_match_node(text, cursor, gram, state);
+    state->build = true;
+  } else {
+    len = gram_match_node(text, cursor, gram, state);
+  }
+  if (len < 0)
+    return len;
+  switch (gram->filter) {
+    case FILTER_AST_ONLY_KEEP_CHILDREN:
+      unwrap_node(state, gram);
+      break;
+    case FILTER_AST_LEAF:
+      gram_state_drop(state, mark);
+      gram_state_leaf(state, gram->user_data, cursor, len);
+      break;
+    default:
+      gram_state_drop(state, mark);
+      break;
+  }
+  return len;
+}
+
+/**
+ * every matcher must call its children through this function.
+ */
+static inline int gram_match(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  if (gram->filter != FILTER_AST_KEEP && state->build)
+    return filter_match(text, cursor, gram, state);
+  return gram_match_node(text, cursor, gram, state);
+}
+
+/**
+ * matches gram with the iterative engine, compiling it first. Frozen grams
+ * keep their program, the others may change before the next parse.
+ */
+static int run_program_of(struct gram_state * state, const char * text, struct gram * gram) {
+  struct gram_program * prog = NULL, * expected = NULL;
+  int len;
+  if (gram->frozen)
+    prog = __atomic_load_n(&gram->program, __ATOMIC_ACQUIRE);
+  if (!prog) {
+    prog = compile_gram(gram);
+    // other threads may be compiling it too: the first one wins.
+    if (gram->frozen && !__atomic_compare_exchange_n(&gram->program, &expected, prog,
+	  false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free_gram_program(prog);
+      prog = expected;
+    }
+  }
+  len = gram_program_run(prog, text, state);
+  if (!gram->frozen)
+    free_gram_program(prog);
+  return len;
+}
+
+/**
+ * matches gram at the beginning of text with a fresh state. If building,
+ * the root of the tree is left in state->nodes[0] (when it matched).
+ */
+static int run_gram(struct gram_state * state, const char * text, int len, struct gram * gram, int * last) {
+  static __thread unsigned parse_serial = 0;
+  struct memo memo;
+  bool own_memo = false;
+  struct gram_mark start;
+  state->len = len;
+  state->last = last ? *last : 0;
+  state->reach = 0;
+  state->depth = 0;
+  state->max_depth = GRAM_MAX_DEPTH;
+  state->overflow = false;
+  state->nodes_count = 0; // (its buffer may come from a gram_context)
+  state->serial = ++parse_serial;
+  if (state->flags & PARSE_ITERATIVE) {
+    state->memo = NULL;
+    len = run_program_of(state, text, gram);
+    if (last)
+      *last = state->last;
+    return len;
+  }
+  // unless it's given the memo table of a previous parse (see gram_doc).
+  if (!state->memo && (state->flags & (PARSE_PACKRAT | PARSE_MEMO))) {
+    memo_init(&memo);
+    state->memo = &memo;
+    own_memo = true;
+  }
+  start = gram_state_mark(state);
+  // the root is never filtered.
+  len = gram_match_node(text, 0, gram, state);
+  if (state->overflow) {
+    // whatever matched was cut short.
+    gram_state_drop(state, start);
+    len = -1;
+    // nor are the memoized failures true.
+    if (state->memo)
+      memo_clear(state->memo);
+  }
+  if (own_memo)
+    memo_destroy(&memo);
+  state->memo = NULL;
+  if (last)
+    *last = state->last;
+  return len;
+}
+
 struct ast * parse(const char * text, struct gram * gram, int * last) {
+  return parse_ex(text, gram, last, 0);
+}
+
+struct ast * parse_ex(const char * text, struct gram * gram, int * last, int flags) {
+  return parse_arena(NULL, text, gram, last, flags);
+}
+
+struct ast * parse_arena(struct ast_arena * arena, const char * text, struct gram * gram, int * last, int flags) {
+  return parse_arena_n(arena, text, strlen(text), gram, last, flags);
+}
+
+struct ast * parse_n(const char * text, int len, struct gram * gram, int * last) {
+  return parse_arena_n(NULL, text, len, gram, last, 0);
+}
+
+struct ast * parse_arena_n(struct ast_arena * arena, const char * text, int len,
+    struct gram * gram, int * last, int flags) {
   struct gram_state state = {
-    .last = 0,
-    .depth = 0
+    .build = true,
+    .arena = arena,
+    .flags = flags
   };
-  if (last)
-    state.last = *last;
-  struct ast * res = gram->matcher(text, 0, gram, &state);
-  if (last)
-    *last = state.last;
+  struct ast * res = NULL;
+  if (run_gram(&state, text, len, gram, last) >= 0)
+    res = state.nodes[0];
+  free(state.nodes);
+  free(state.frames);
   return res;
 }
 
+int match(const char * text, struct gram * gram, int * last) {
+  return match_n_ex(text, strlen(text), gram, last, 0);
+}
+
+int match_ex(const char * text, struct gram * gram, int * last, int flags) {
+  return match_n_ex(text, strlen(text), gram, last, flags);
+}
+
+int match_n(const char * text, int len, struct gram * gram, int * last) {
+  return match_n_ex(text, len, gram, last, 0);
+}
+
+int match_n_ex(const char * text, int len, struct gram * gram, int * last, int flags) {
+  struct gram_state state = {
+    .build = false,
+    .arena = NULL,
+    .flags = flags
+  };
+  len = run_gram(&state, text, len, gram, last);
+  free(state.frames);
+  return len;
+}
+
+/************************************************************************\
+*				 CONTEXT				 *
+* The buffers of a parse, kept for the next ones of the same thread.	 *
+\************************************************************************/
+
+struct gram_context {
+  struct ast ** nodes;
+  int nodes_size;
+  struct vm_frame * frames;
+  int frames_size;
+  struct memo memo; // always empty between parses.
+  struct ast_arena * arena; // for parse_flat, created by the first one.
+  // for parse_events:
+  struct gram_event * events;
+  int events_size;
+  int * pending;
+  int pending_size;
+  bool overflow; // the last parse went too deep.
+};
+
+struct gram_context * new_gram_context(void) {
+  struct gram_context * ctx = malloc(sizeof (struct gram_context));
+  ctx->nodes = NULL;
+  ctx->nodes_size = 0;
+  ctx->frames = NULL;
+  ctx->frames_size = 0;
+  memo_init(&ctx->memo);
+  ctx->arena = NULL;
+  ctx->events = NULL;
+  ctx->events_size = 0;
+  ctx->pending = NULL;
+  ctx->pending_size = 0;
+  ctx->overflow = false;
+  return ctx;
+}
+
+static int run_context(struct gram_context * ctx, struct gram_state * state,
+    const char * text, int len, struct gram * gram, int * last) {
+  state->nodes = ctx->nodes;
+  state->nodes_size = ctx->nodes_size;
+  state->frames = ctx->frames;
+  state->frames_size = ctx->frames_size;
+  if (state->flags & (PARSE_PACKRAT | PARSE_MEMO))
+    state->memo = &ctx->memo;
+  len = run_gram(state, text, len, gram, last);
+  ctx->overflow = state->overflow;
+  ctx->nodes = state->nodes;
+  ctx->nodes_size = state->nodes_size;
+  ctx->frames = state->frames;
+  ctx->frames_size = state->frames_size;
+  memo_clear(&ctx->memo);
+  return len;
+}
+
+struct ast * parse_context(struct gram_context * ctx, struct ast_arena * arena,
+    const char * text, int len, struct gram * gram, int * last, int flags) {
+  struct gram_state state = {
+    .build = true,
+    .arena = arena,
+    .flags = flags
+  };
+  if (run_context(ctx, &state, text, len, gram, last) >= 0)
+    return state.nodes[0];
+  return NULL;
+}
+
+int match_context(struct gram_context * ctx, const char * text, int len,
+    struct gram * gram, int * last, int flags) {
+  struct gram_state state = {
+    .build = false,
+    .flags = flags
+  };
+  return run_context(ctx, &state, text, len, gram, last);
+}
+
+int gram_context_overflow(struct gram_context * ctx) {
+  return ctx->overflow;
+}
+
+void free_gram_context(struct gram_context * ctx) {
+  memo_destroy(&ctx->memo);
+  if (ctx->arena)
+    free_ast_arena(ctx->arena);
+  free(ctx->events);
+  free(ctx->pending);
+  free(ctx->nodes);
+  free(ctx->frames);
+  free(ctx);
+}
+
+/************************************************************************\
+*				 SEARCH					 *
+* Anchored matches at every offset, but those whose byte the grammar	 *
+* can't start with (see gram_analyze) are skipped.			 *
+\************************************************************************/
+
+// the only byte gram may start with, or -1.
+static int only_first_byte(struct gram * gram) {
+  int c, byte = -1;
+  if (gram->nullable)
+    return -1;
+  for (c = 0; c < 256; c++)
+    if (gram_class_has(gram->first, c)) {
+      if (byte >= 0)
+	return -1;
+      byte = c;
+    }
+  return byte;
+}
+
+static int search_from(struct gram_context * ctx, const char * text, int len, int from,
+    struct gram * gram, int byte, int * match_len, int flags) {
+  const char * p;
+  int last;
+  for (; from <= len; from++) {
+    if (byte >= 0) {
+      if (!(p = memchr(text + from, byte, len - from)))
+	return -1;
+      from = p - text;
+    } else if (!gram->nullable) {
+      while (from < len && !gram_class_has(gram->first, text[from]))
+	from++;
+      if (from == len)
+	return -1;
+    }
+    last = 0;
+    *match_len = match_context(ctx, text + from, len - from, gram, &last, flags);
+    if (*match_len >= 0)
+      return from;
+  }
+  return -1;
+}
+
+int search(struct gram_context * ctx, const char * text, int len, struct gram * gram,
+    int * match_len, int flags) {
+  struct gram_context * own = ctx ? NULL : (ctx = new_gram_context());
+  int from = search_from(ctx, text, len, 0, gram, only_first_byte(gram), match_len, flags);
+  if (own)
+    free_gram_context(own);
+  return from;
+}
+
+int search_all(struct gram_context * ctx, const char * text, int len, struct gram * gram, int flags,
+    void (*fn)(int from, int len, void * privdata), void * privdata) {
+  struct gram_context * own = ctx ? NULL : (ctx = new_gram_context());
+  int from = 0, match_len, count = 0, byte = only_first_byte(gram);
+  while ((from = search_from(ctx, text, len, from, gram, byte, &match_len, flags)) >= 0) {
+    fn(from, match_len, privdata);
+    count++;
+    // an empty match is followed by the next offset.
+    from += match_len ? match_len : 1;
+  }
+  if (own)
+    free_gram_context(own);
+  return count;
+}
+
+/************************************************************************\
+*				  FLAT					 *
+* Trees as an array of nodes in preorder, each with the size of its	 *
+* subtree: the children of a node are found by skipping over the	 *
+* subtrees of the previous ones, and there is no pointer to chase.	 *
+\************************************************************************/
+
+struct rule_slot {
+  void * user_data; // NULL for empty slots (it's always rule 0).
+  unsigned rule;
+};
+
+struct flattener {
+  struct ast_flat * flat;
+  unsigned nodes_size, rules_size;
+  struct rule_slot * slots; // open addressing, by user_data.
+  unsigned slots_size;
+};
+
+static struct rule_slot * flattener_slot(struct flattener * f, void * user_data) {
+  unsigned mask = f->slots_size - 1;
+  uintptr_t h = (uintptr_t)user_data >> 4;
+  unsigned i = (unsigned)(h ^ (h >> 15)) * 0x9e3779b1u & mask;
+  while (f->slots[i].user_data && f->slots[i].user_data != user_data)
+    i = (i + 1) & mask;
+  return &f->slots[i];
+}
+
+static unsigned flattener_rule(struct flattener * f, void * user_data) {
+  struct ast_flat * flat = f->flat;
+  struct rule_slot * slot;
+  unsigned i;
+  if (!user_data)
+    return 0;
+  if ((slot = flattener_slot(f, user_data))->user_data)
+    return slot->rule;
+  if (2 * flat->rules_count > f->slots_size) {
+    free(f->slots);
+    f->slots_size *= 2;
+    f->slots = calloc(f->slots_size, sizeof (struct rule_slot));
+    for (i = 1; i < flat->rules_count; i++)
+      *flattener_slot(f, flat->rules[i]) = (struct rule_slot){flat->rules[i], i};
+    slot = flattener_slot(f, user_data);
+  }
+  if (flat->rules_count == f->rules_size) {
+    f->rules_size *= 2;
+    flat->rules = realloc(flat->rules, sizeof (void *) * f->rules_size);
+  }
+  flat->rules[flat->rules_count] = user_data;
+  *slot = (struct rule_slot){user_data, flat->rules_count};
+  return flat->rules_count++;
+}
+
+// appends the node of ast, its size is set once its subtree is done.
+static unsigned flatten_node(struct flattener * f, struct ast * ast) {
+  struct ast_flat * flat = f->flat;
+  unsigned node = flat->count++;
+  if (node == f->nodes_size) {
+    f->nodes_size *= 2;
+    flat->nodes = realloc(flat->nodes, sizeof (struct ast_node) * f->nodes_size);
+  }
+  flat->nodes[node] = (struct ast_node){flattener_rule(f, ast->user_data), ast->from, ast->len, 0};
+  return node;
+}
+
+struct ast_flat * flatten_ast(struct ast * ast) {
+  struct ast_flat * flat = malloc(sizeof (struct ast_flat));
+  struct flattener f = {flat, 64, 16, calloc(32, sizeof (struct rule_slot)), 32};
+  flat->nodes = malloc(sizeof (struct ast_node) * f.nodes_size);
+  flat->count = 0;
+  flat->rules = malloc(sizeof (void *) * f.rules_size);
+  flat->rules[0] = NULL;
+  flat->rules_count = 1;
+  struct walk w;
+  walk_init(&w);
+  walk_push(&w, ast, flatten_node(&f, ast));
+  while (w.depth) {
+    struct ast * child = walk_next_child(&w);
+    if (child) {
+      walk_push(&w, child, flatten_node(&f, child));
+    } else {
+      unsigned node = w.frames[--w.depth].data;
+      flat->nodes[node].size = flat->count - node;
+    }
+  }
+  walk_release(&w);
+  free(f.slots);
+  return flat;
+}
+
+struct ast_flat * parse_flat(struct gram_context * ctx, const char * text, int len,
+    struct gram * gram, int * last, int flags) {
+  struct gram_context * own = ctx ? NULL : (ctx = new_gram_context());
+  struct ast_flat * flat = NULL;
+  if (!ctx->arena)
+    ctx->arena = new_ast_arena();
+  // the tree is only built to be copied, so it's built in the arena.
+  struct ast * ast = parse_context(ctx, ctx->arena, text, len, gram, last, flags);
+  if (ast)
+    flat = flatten_ast(ast);
+  ast_arena_reset(ctx->arena);
+  if (own)
+    free_gram_context(own);
+  return flat;
+}
+
+struct ast * ast_flat_to_ast(const struct ast_flat * flat, unsigned node) {
+  // built from the last node back, so the children of a node are done
+  // before it, the first one on top of the stack.
+  struct ast ** stack = malloc(sizeof (struct ast *) * flat->nodes[node].size);
+  unsigned i, child, end;
+  int top = 0;
+  for (i = node + flat->nodes[node].size; i-- > node;) {
+    const struct ast_node * n = &flat->nodes[i];
+    int count = 0;
+    for (child = i + 1, end = i + n->size; child < end; child += flat->nodes[child].size)
+      count++;
+    struct ast * ast = allocate_ast(flat->rules[n->rule], n->from, n->len, count);
+    for (count = 0, child = i + 1; child < end; child += flat->nodes[child].size)
+      ast->children[count++] = stack[--top];
+    stack[top++] = ast;
+  }
+  struct ast * ast = stack[0];
+  free(stack);
+  return ast;
+}
+
+void free_ast_flat(struct ast_flat * flat) {
+  free(flat->nodes);
+  free(flat->rules);
+  free(flat);
+}
+
+void ast_iter_children(struct ast_iter * it, const struct ast_flat * flat, unsigned node) {
+  it->flat = flat;
+  it->next = node + 1;
+  it->end = node + flat->nodes[node].size;
+  it->children = 1;
+}
+
+void ast_iter_subtree(struct ast_iter * it, const struct ast_flat * flat, unsigned node) {
+  it->flat = flat;
+  it->next = node;
+  it->end = node + flat->nodes[node].size;
+  it->children = 0;
+}
+
+const struct ast_node * ast_iter_next(struct ast_iter * it) {
+  if (it->next >= it->end)
+    return NULL;
+  const struct ast_node * node = &it->flat->nodes[it->next];
+  // children skip over the subtree of the previous one.
+  it->next += it->children ? node->size : 1;
+  return node;
+}
+
+void ast_cursor_init(struct ast_cursor * cursor, const struct ast_flat * flat) {
+  cursor->flat = flat;
+  cursor->node = 0;
+  cursor->parents = NULL;
+  cursor->depth = cursor->size = 0;
+}
+
+void ast_cursor_release(struct ast_cursor * cursor) {
+  free(cursor->parents);
+  cursor->parents = NULL;
+  cursor->depth = cursor->size = 0;
+}
+
+int ast_cursor_first_child(struct ast_cursor * cursor) {
+  if (cursor->flat->nodes[cursor->node].size == 1)
+    return 0;
+  if (cursor->depth == cursor->size) {
+    cursor->size = cursor->size ? 2 * cursor->size : 16;
+    cursor->parents = realloc(cursor->parents, sizeof (unsigned) * cursor->size);
+  }
+  cursor->parents[cursor->depth++] = cursor->node++;
+  return 1;
+}
+
+int ast_cursor_next_sibling(struct ast_cursor * cursor) {
+  const struct ast_node * nodes = cursor->flat->nodes;
+  if (!cursor->depth)
+    return 0;
+  unsigned parent = cursor->parents[cursor->depth - 1];
+  unsigned next = cursor->node + nodes[cursor->node].size;
+  if (next >= parent + nodes[parent].size)
+    return 0;
+  cursor->node = next;
+  return 1;
+}
+
+int ast_cursor_parent(struct ast_cursor * cursor) {
+  if (!cursor->depth)
+    return 0;
+  cursor->node = cursor->parents[--cursor->depth];
+  return 1;
+}
+
+/************************************************************************\
+*				 EVENTS					 *
+* The nodes with user_data are recorded (in postorder, with the size of	 *
+* their subtree) rather than built, and dropped as nodes are when	 *
+* backtracking. Once the parse is done the survivors are replayed in	 *
+* document order.							 *
+\************************************************************************/
+
+static void replay_events(struct gram_context * ctx, int count,
+    void (*enter)(void * user_data, int from, int len, void * privdata),
+    void (*exit)(void * user_data, int from, int len, void * privdata),
+    void * privdata) {
+  const struct gram_event * events = ctx->events, * e;
+  int i, j, top = 0;
+  // every event is pending once: to be entered, or then to be exited (~i).
+  if (ctx->pending_size < count) {
+    ctx->pending_size = count;
+    ctx->pending = realloc(ctx->pending, sizeof (int) * count);
+  }
+  int * pending = ctx->pending;
+  // the roots (several when gram has no user_data), the last one first.
+  for (i = count - 1; i >= 0; i -= events[i].size)
+    pending[top++] = i;
+  while (top) {
+    if ((i = pending[--top]) < 0) {
+      e = &events[~i];
+      if (exit)
+	exit(e->user_data, e->from, e->len, privdata);
+      continue;
+    }
+    e = &events[i];
+    if (enter)
+      enter(e->user_data, e->from, e->len, privdata);
+    pending[top++] = ~i;
+    for (j = i - 1; j > i - e->size; j -= events[j].size)
+      pending[top++] = j;
+  }
+}
+
+int parse_events(struct gram_context * ctx, const char * text, int len, struct gram * gram,
+    int * last, int flags,
+    void (*enter)(void * user_data, int from, int len, void * privdata),
+    void (*exit)(void * user_data, int from, int len, void * privdata),
+    void * privdata) {
+  struct gram_context * own = ctx ? NULL : (ctx = new_gram_context());
+  struct gram_state state = {
+    .build = true,
+    .record_events = true,
+    .events = ctx->events,
+    .events_size = ctx->events_size,
+    // the memo table keeps trees, not events.
+    .flags = flags & ~(PARSE_PACKRAT | PARSE_MEMO)
+  };
+  len = run_context(ctx, &state, text, len, gram, last);
+  ctx->events = state.events;
+  ctx->events_size = state.events_size;
+  if (len >= 0)
+    replay_events(ctx, state.nodes_count, enter, exit, privdata);
+  if (own)
+    free_gram_context(own);
+  return len;
+}
+
+/************************************************************************\
+*				INCREMENTAL				 *
+* A document keeps its packrat memo table between parses. An edit drops	 *
+* the results whose examined bytes [cursor, reach) it touches, and shifts *
+* those after it (their trees included), so parsing again only matches	 *
+* the grams around the edit.						 *
+\************************************************************************/
+
+struct gram_doc {
+  struct gram * gram;
+  char * text;
+  int len, size;
+  struct memo memo;
+  struct ast * ast; // NULL if it didn't match.
+  int last;
+};
+
+static void doc_parse(struct gram_doc * doc) {
+  struct gram_state state = {
+    .build = true,
+    .memo = &doc->memo,
+    .flags = PARSE_PACKRAT
+  };
+  doc->last = 0;
+  doc->ast = NULL;
+  if (run_gram(&state, doc->text, doc->len, doc->gram, &doc->last) >= 0)
+    doc->ast = state.nodes[0];
+  free(state.nodes);
+}
+
+struct gram_doc * new_gram_doc(struct gram * gram, const char * text, int len) {
+  struct gram_doc * doc = malloc(sizeof (struct gram_doc));
+  doc->gram = gram;
+  doc->size = len + 1;
+  doc->text = malloc(doc->size);
+  memcpy(doc->text, text, len);
+  doc->len = len;
+  memo_init(&doc->memo);
+  doc_parse(doc);
+  return doc;
+}
+
+// a set of nodes, so that shared subtrees are shifted only once.
+struct node_set {
+  int size, count;
+  struct ast ** nodes;
+};
+
+static bool node_set_add(struct node_set * set, struct ast * ast) {
+  unsigned mask, i;
+  uintptr_t h = (uintptr_t)ast >> 4;
+  if (2 * (set->count + 1) > set->size) {
+    struct ast ** old = set->nodes;
+    int j, oldsize = set->size;
+    set->size = set->size ? 2 * set->size : 256;
+    set->nodes = calloc(set->size, sizeof (struct ast *));
+    set->count = 0;
+    for (j = 0; j < oldsize; j++)
+      if (old[j])
+	node_set_add(set, old[j]);
+    free(old);
+  }
+  mask = set->size - 1;
+  i = (unsigned)(h ^ (h >> 15)) * 0x9e3779b1u & mask;
+  while (set->nodes[i] && set->nodes[i] != ast)
+    i = (i + 1) & mask;
+  if (set->nodes[i])
+    return false;
+  set->nodes[i] = ast;
+  set->count++;
+  return true;
+}
+
+static void shift_ast(struct node_set * set, struct ast * ast, int delta) {
+  struct walk w;
+  if (!node_set_add(set, ast))
+    return;
+  ast->from += delta;
+  walk_init(&w);
+  walk_push(&w, ast, 0);
+  while (w.depth) {
+    struct ast * child = walk_next_child(&w);
+    if (!child) {
+      w.depth--;
+    } else if (node_set_add(set, child)) {
+      child->from += delta;
+      walk_push(&w, child, 0);
+    }
+  }
+  walk_release(&w);
+}
+
+struct ast * gram_doc_edit(struct gram_doc * doc, int offset, int removed,
+    const char * inserted, int inserted_len, int * last) {
+  int i, delta = inserted_len - removed;
+  if (offset < 0 || removed < 0 || inserted_len < 0 || offset + removed > doc->len) {
+    fprintf(stderr, "gram_doc_edit: the edit is out of the text.\n");
+    return NULL;
+  }
+  if (doc->len + delta >= doc->size) {
+    doc->size = 2 * (doc->len + delta) + 1;
+    doc->text = realloc(doc->text, doc->size);
+  }
+  memmove(doc->text + offset + inserted_len, doc->text + offset + removed,
+      doc->len - offset - removed);
+  memcpy(doc->text + offset, inserted, inserted_len);
+  doc->len += delta;
+  // the results before the edit stay, those after it are moved.
+  struct memo old = doc->memo;
+  struct node_set shifted = {0, 0, NULL};
+  doc->memo.count = 0;
+  doc->memo.entries = calloc(doc->memo.size, sizeof (struct memo_entry));
+  for (i = 0; i < old.size; i++) {
+    struct memo_entry * e = &old.entries[i];
+    if (!e->gram)
+      continue;
+    if (e->cursor >= offset + removed) {
+      e->cursor += delta;
+      e->reach += delta;
+      if (e->last >= 0)
+	e->last += delta;
+      if (e->ast && delta)
+	shift_ast(&shifted, e->ast, delta);
+    } else if (e->reach > offset) {
+      if (e->ast)
+	free_ast(e->ast);
+      continue;
+    }
+    *memo_slot(&doc->memo, e->gram, e->cursor) = *e;
+    doc->memo.count++;
+  }
+  free(old.entries);
+  free(shifted.nodes);
+  // its unchanged subtrees are still owned by the table.
+  if (doc->ast)
+    free_ast(doc->ast);
+  doc_parse(doc);
+  return gram_doc_get_ast(doc, last);
+}
+
+struct ast * gram_doc_get_ast(struct gram_doc * doc, int * last) {
+  if (last)
+    *last = doc->last;
+  return doc->ast;
+}
+
+const char * gram_doc_get_text(struct gram_doc * doc, int * len) {
+  if (len)
+    *len = doc->len;
+  return doc->text;
+}
+
+void free_gram_doc(struct gram_doc * doc) {
+  if (doc->ast)
+    free_ast(doc->ast);
+  memo_destroy(&doc->memo);
+  free(doc->text);
+  free(doc);
+}
+
+// drops a reference to ast, true if it was the last one.
+static bool release_ast(struct ast * ast) {
+  if (!ast->refs) {
+    fprintf(stderr, "ERROR: free_ast called with a node allocated in an ast_arena.\n");
+    fflush(stderr);
+    exit(1);
+  }
+  return --ast->refs == 0; // or it's still shared by someone else.
+}
+
 void free_ast(struct ast * ast) {
-  int i;
+  struct walk w;
   if (ast == NULL) {
     fprintf(stderr, "ERROR: free_ast called with a NULL pointer. Avoiding SIGSEGV.\n");
     fflush(stderr);
     exit(1);
   }
-  for (i = 0; ast->children[i]; i++)
-    free(ast->children[i]);
-  free(ast);
+  if (!release_ast(ast))
+    return;
+  walk_init(&w);
+  walk_push(&w, ast, 0);
+  while (w.depth) {
+    struct ast * child = walk_next_child(&w);
+    if (!child)
+      free(w.frames[--w.depth].ast);
+    else if (release_ast(child))
+      walk_push(&w, child, 0);
+  }
+  walk_release(&w);
 }
 
-void dump_ast(struct ast * ast, int indent, void (*debug)(void * user_data)) {
-  if (!ast) {
-    printf("%*sNULL\n", indent, "");
-    return;
-  } else if (debug) {
+static void dump_ast_node(struct ast * ast, int indent, void (*debug)(void * user_data)) {
+  if (debug) {
     printf("%*sfrom=%d, len=%d, userdata=", indent, "", ast->from, ast->len);
     debug(ast->user_data);
   } else {
     printf("%*sfrom=%d, len=%d, userdata=%p\n", indent, "",
 	ast->from, ast->len, ast->user_data);
   }
-  int ch;
-  for (ch = 0; ast->children[ch]; ch++)
-    dump_ast(ast->children[ch], indent + 2, debug);
 }
 
-static void filter_ast_flatten(struct ptrbuff * buff, struct ast * ast,
-    enum filter_ast_mode (*filter)(struct ast * node, void * privdata),
-    void * privdata) {
-  int i;
-  switch (filter(ast, privdata)) {
-    // keep the node itself and its children:
-    case FILTER_AST_KEEP:
-      ptrbuff_push(buff, filter_ast(ast, filter, privdata));
-      break;
-    // drop the node itself, but keep its children:
-    case FILTER_AST_ONLY_KEEP_CHILDREN:
-      for (i = 0; ast->children[i]; i++)
-	filter_ast_flatten(buff, ast->children[i], filter, privdata);
-      break;
-    // keep the element itself but drop its children:
-    case FILTER_AST_LEAF:
-      ptrbuff_push(buff, allocate_ast(ast->user_data, ast->from, ast->len, 0));
-      break;
-    // drop the element itself and its children:
-    case FILTER_AST_DISCARD:
-      break;
-    default:
-      fprintf(stderr, "{filter/purge}_ast callback function 'filter' returned invalid value.\n");
-      exit(1);
+void dump_ast(struct ast * ast, int indent, void (*debug)(void * user_data)) {
+  struct walk w;
+  if (!ast) {
+    printf("%*sNULL\n", indent, "");
+    return;
+  }
+  dump_ast_node(ast, indent, debug);
+  walk_init(&w);
+  walk_push(&w, ast, 0);
+  while (w.depth) {
+    struct ast * child = walk_next_child(&w);
+    if (child) {
+      dump_ast_node(child, indent + 2 * w.depth, debug);
+      walk_push(&w, child, 0);
+    } else {
+      w.depth--;
+    }
+  }
+  walk_release(&w);
+}
+
+// the nodes kept by filter_ast, whose parents are not done yet.
+struct kept_nodes {
+  struct ast ** nodes;
+  int count, size;
+};
+
+static void keep_node(struct kept_nodes * kept, struct ast * ast) {
+  if (kept->count == kept->size) {
+    kept->size = kept->size ? 2 * kept->size : 64;
+    kept->nodes = realloc(kept->nodes, sizeof (struct ast *) * kept->size);
   }
+  kept->nodes[kept->count++] = ast;
 }
 
 struct ast * filter_ast(struct ast * ast,
     enum filter_ast_mode (*filter)(struct ast * node, void * privdata),
     void * privdata) {
-  struct ptrbuff buff;
-  int i;
-  ptrbuff_init(&buff);
-  for (i = 0; ast->children[i]; i++)
-    filter_ast_flatten(&buff, ast->children[i], filter, privdata);
-  ast = allocate_ast(ast->user_data, ast->from, ast->len, buff.count);
-  ptrbuff_finalize((void**)ast->children, &buff);
+  struct kept_nodes kept = {NULL, 0, 0};
+  struct walk w;
+  walk_init(&w);
+  // the data of a node copied is where its kept children start, the
+  // children of those dropped go to their parent (-1).
+  walk_push(&w, ast, 0);
+  while (w.depth) {
+    struct ast * child = walk_next_child(&w);
+    if (!child) {
+      struct walk_frame * f = &w.frames[--w.depth];
+      if (f->data < 0)
+	continue;
+      int n = kept.count - f->data;
+      struct ast * node = allocate_ast(f->ast->user_data, f->ast->from, f->ast->len, n);
+      if (n)
+	memcpy(node->children, kept.nodes + f->data, sizeof (struct ast *) * n);
+      kept.count = f->data;
+      keep_node(&kept, node);
+      continue;
+    }
+    switch (filter(child, privdata)) {
+      // keep the node itself and its children:
+      case FILTER_AST_KEEP:
+	walk_push(&w, child, kept.count);
+	break;
+      // drop the node itself, but keep its children:
+      case FILTER_AST_ONLY_KEEP_CHILDREN:
+	walk_push(&w, child, -1);
+	break;
+      // keep the element itself but drop its children:
+      case FILTER_AST_LEAF:
+	keep_node(&kept, allocate_ast(child->user_data, child->from, child->len, 0));
+	break;
+      // drop the element itself and its children:
+      case FILTER_AST_DISCARD:
+	break;
+      default:
+	fprintf(stderr, "{filter/purge}_ast callback function 'filter' returned invalid value.\n");
+	exit(1);
+    }
+  }
+  walk_release(&w);
+  ast = kept.nodes[0];
+  free(kept.nodes);
   return ast;
 }
 
@@ -243,131 +1297,296 @@ struct ast * purge_ast(struct ast * ast) {
   return filter_ast(ast, &purge_ast_fn, NULL);
 }
 
-static struct ast * dot_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  if (text[cursor]) { // if we are not past the last char of the string.
+int gram_dot_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  if (cursor < state->len) { // if we are not past the last char of the string.
     gram_state_update_last(state, cursor + 1);
-    return allocate_ast(gram->user_data, cursor, 1, 0);
+    gram_state_leaf(state, gram->user_data, cursor, 1);
+    return 1;
   }
-  return NULL;
+  return -1;
 }
 
 struct gram * new_gram_dot(void * user_data) {
   struct gram * gram;
   gram = malloc(sizeof (struct gram));
-  gram->user_data = user_data;
-  gram->matcher = &dot_matcher;
+  init_gram(gram, user_data, GRAM_DOT, &gram_dot_matcher);
   return gram;
 }
 
-struct gram_string {
-  struct gram gram;
-  int len;
-  char text[];
-};
-
-static struct ast * string_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+int gram_string_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
   // safe cast cause we know this is only used from new_gram_string
   struct gram_string * g = (struct gram_string *)gram;
-  if (!strncmp(text + cursor, g->text, g->len)) {
+  if (g->len <= state->len - cursor && !memcmp(text + cursor, g->text, g->len)) {
     // string matches
     gram_state_update_last(state, cursor + g->len);
-    return allocate_ast(gram->user_data, cursor, g->len, 0);
+    gram_state_leaf(state, gram->user_data, cursor, g->len);
+    return g->len;
+  }
+  return -1;
+}
+
+struct gram * new_gram_string(void * user_data, const char * text) {
+  struct gram_string * g;
+  if (!text) {
+    fprintf(stderr, "new_gram_string: NULL text.\n");
+    return NULL;
+  }
+  int len = strlen(text);
+  g = malloc(sizeof (struct gram_string) + len + 1);
+  g->len = len;
+  init_gram(&g->gram, user_data, GRAM_STRING, &gram_string_matcher);
+  memcpy(g->text, text, len + 1);
+  return &g->gram;
+}
+
+int gram_range_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  // safe cast cause we know this is only used from new_gram_string
+  struct gram_range * g = (struct gram_range *)gram;
+  if (cursor < state->len && g->from <= text[cursor] && text[cursor] <= g->to) {
+    gram_state_update_last(state, cursor + 1);
+    gram_state_leaf(state, gram->user_data, cursor, 1);
+    return 1;
+  }
+  return -1;
+}
+
+struct gram * new_gram_range(void * user_data, char from, char to) {
+  struct gram_range * g;
+  if (from > to) {
+    fprintf(stderr, "new_gram_range: from must be <= than to.\n");
+    return NULL;
+  }
+  g = malloc(sizeof (struct gram_range));
+  init_gram(&g->gram, user_data, GRAM_RANGE, &gram_range_matcher);
+  g->from = from;
+  g->to = to;
+  return &g->gram;
+}
+
+int gram_class_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  // safe cast cause we know this is only used from new_gram_class
+  struct gram_class * g = (struct gram_class *)gram;
+  if (cursor < state->len && gram_class_has(g->set, text[cursor])) {
+    gram_state_update_last(state, cursor + 1);
+    gram_state_leaf(state, gram->user_data, cursor, 1);
+    return 1;
+  }
+  return -1;
+}
+
+struct gram * new_gram_class(void * user_data, const unsigned char * set, int negate) {
+  struct gram_class * g;
+  int i;
+  if (!set) {
+    fprintf(stderr, "new_gram_class: NULL set.\n");
+    return NULL;
+  }
+  g = malloc(sizeof (struct gram_class));
+  init_gram(&g->gram, user_data, GRAM_CLASS, &gram_class_matcher);
+  for (i = 0; i < 32; i++)
+    g->set[i] = negate ? ~set[i] : set[i];
+  return &g->gram;
+}
+
+/**
+ * spans compare every byte with their ranges in parallel: x is in the range
+ * [lo, lo + width] iff the (wrapping) byte x - lo is <= width. The loads
+ * are aligned, so they never cross a page and reading past the end of the
+ * text is safe (even though the address and thread sanitizers don't know it).
+ */
+#ifdef __SSE2__
+__attribute__((no_sanitize_address, no_sanitize_thread))
+static int span_sse2(const struct gram_span * g, const char * text, int n) {
+  unsigned skip = (uintptr_t)text & 15, miss = 0;
+  const char * p = text - skip;
+  __m128i lo[SPAN_RANGES], width[SPAN_RANGES];
+  int i;
+  for (i = 0; i < g->ranges; i++) {
+    lo[i] = _mm_set1_epi8((char)g->lo[i]);
+    width[i] = _mm_set1_epi8((char)g->width[i]);
+  }
+  for (; p < text + n; p += 16) {
+    __m128i x = _mm_load_si128((const __m128i *)p), in = _mm_setzero_si128();
+    for (i = 0; i < g->ranges; i++) {
+      __m128i d = _mm_sub_epi8(x, lo[i]);
+      in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, width[i]), d));
+    }
+    miss = ~_mm_movemask_epi8(in) & 0xffff;
+    miss &= ~0u << skip; // the bytes before text.
+    skip = 0;
+    if (miss)
+      break;
+  }
+  if (miss && p + __builtin_ctz(miss) - text < n)
+    return p + __builtin_ctz(miss) - text;
+  return n;
+}
+#endif
+
+#ifdef HAVE_SPAN_AVX2
+__attribute__((target("avx2"), no_sanitize_address, no_sanitize_thread))
+static int span_avx2(const struct gram_span * g, const char * text, int n) {
+  unsigned skip = (uintptr_t)text & 31, miss = 0;
+  const char * p = text - skip;
+  __m256i lo[SPAN_RANGES], width[SPAN_RANGES];
+  int i;
+  for (i = 0; i < g->ranges; i++) {
+    lo[i] = _mm256_set1_epi8((char)g->lo[i]);
+    width[i] = _mm256_set1_epi8((char)g->width[i]);
   }
-  return NULL;
+  for (; p < text + n; p += 32) {
+    __m256i x = _mm256_load_si256((const __m256i *)p), in = _mm256_setzero_si256();
+    for (i = 0; i < g->ranges; i++) {
+      __m256i d = _mm256_sub_epi8(x, lo[i]);
+      in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, width[i]), d));
+    }
+    miss = ~_mm256_movemask_epi8(in);
+    miss &= ~0u << skip;
+    skip = 0;
+    if (miss)
+      break;
+  }
+  // or the sse code that follows would run much slower.
+  _mm256_zeroupper();
+  if (miss && p + __builtin_ctz(miss) - text < n)
+    return p + __builtin_ctz(miss) - text;
+  return n;
 }
+#endif
 
-struct gram * new_gram_string(void * user_data, const char * text) {
-  struct gram_string * g;
-  if (!text) {
-    fprintf(stderr, "new_gram_string: NULL text.\n");
-    return NULL;
+int gram_span_length(const struct gram_span * g, const char * text, int n) {
+  int len = 0;
+  if (g->ranges) {
+#ifdef HAVE_SPAN_AVX2
+    // (set once by libgcc before main, so it's safe from any thread)
+    if (__builtin_cpu_supports("avx2"))
+      return span_avx2(g, text, n);
+#endif
+#ifdef __SSE2__
+    return span_sse2(g, text, n);
+#endif
   }
-  int len = strlen(text);
-  g = malloc(sizeof (struct gram_string) + len + 1);
-  g->len = len;
-  g->gram.user_data = user_data;
-  g->gram.matcher = &string_matcher;
-  memcpy(g->text, text, len + 1);
-  return &g->gram;
+  while (len < n && gram_class_has(g->set, text[len]))
+    len++;
+  return len;
 }
 
-struct gram_range {
-  struct gram gram;
-  char from, to;
-};
+int gram_span_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  // safe cast cause we know this is only used from new_gram_span
+  struct gram_span * g = (struct gram_span *)gram;
+  int len = gram_span_length(g, text + cursor, state->len - cursor);
+  if (len)
+    gram_state_update_last(state, cursor + len);
+  if (len < g->min)
+    return -1;
+  gram_state_leaf(state, gram->user_data, cursor, len);
+  return len;
+}
 
-static struct ast * range_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  // safe cast cause we know this is only used from new_gram_string
-  struct gram_range * g = (struct gram_range *)gram;
-  if (g->from <= text[cursor] && text[cursor] <= g->to) {
-    gram_state_update_last(state, cursor + 1);
-    return allocate_ast(gram->user_data, cursor, 1, 0);
+// describes the set of g as at most SPAN_RANGES ranges.
+static void span_ranges(struct gram_span * g) {
+  int c, from;
+  g->ranges = 0;
+  for (c = 0; c < 256; c++) {
+    if (!gram_class_has(g->set, c))
+      continue;
+    for (from = c; c + 1 < 256 && gram_class_has(g->set, c + 1); c++)
+      ;
+    if (g->ranges == SPAN_RANGES) {
+      g->ranges = 0; // too many, so they are looked up one by one.
+      return;
+    }
+    g->lo[g->ranges] = from;
+    g->width[g->ranges++] = c - from;
   }
-  return NULL;
 }
 
-struct gram * new_gram_range(void * user_data, char from, char to) {
-  struct gram_range * g;
-  if (from > to) {
-    fprintf(stderr, "new_gram_range: from must be <= than to.\n");
+struct gram * new_gram_span(void * user_data, const unsigned char * set, int negate, int min) {
+  struct gram_span * g;
+  int i;
+  if (!set) {
+    fprintf(stderr, "new_gram_span: NULL set.\n");
     return NULL;
   }
-  g = malloc(sizeof (struct gram_range));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &range_matcher;
-  g->from = from;
-  g->to = to;
+  if (min < 0) {
+    fprintf(stderr, "new_gram_span: min must be >= 0.\n");
+    return NULL;
+  }
+  g = malloc(sizeof (struct gram_span));
+  init_gram(&g->gram, user_data, GRAM_SPAN, &gram_span_matcher);
+  g->min = min;
+  for (i = 0; i < 32; i++)
+    g->set[i] = negate ? ~set[i] : set[i];
+  span_ranges(g);
   return &g->gram;
 }
 
-static struct ast * int_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  char * end = NULL;
+static int digit_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 10;
+  return 36;
+}
+
+int gram_int_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  int i = cursor, digits, base = 10;
+  unsigned long val = 0, max = LONG_MAX;
+  bool overflow = false;
   gram_state_update_last(state, cursor);
-  if (!text[cursor]) {
-    return NULL;
+  // the same numbers as strtol(text + cursor, &end, 0), but never past the
+  // end of the text.
+  while (i < state->len && isspace((unsigned char)text[i]))
+    i++;
+  if (i < state->len && (text[i] == '+' || text[i] == '-'))
+    if (text[i++] == '-')
+      max++;
+  if (i < state->len && text[i] == '0') {
+    base = 8;
+    if (i + 2 < state->len && (text[i + 1] == 'x' || text[i + 1] == 'X')
+	&& digit_value(text[i + 2]) < 16) {
+      base = 16;
+      i += 2;
+    }
   }
-  long int val = strtol(text + cursor, &end, 0);
-  if (errno == ERANGE && (val == LONG_MAX || val == LONG_MIN)) {
-    if (end) // endptr could also be updated...
-      gram_state_update_last(state, end - text);
-    return NULL;
+  for (digits = 0; i < state->len && digit_value(text[i]) < base; i++, digits++) {
+    int d = digit_value(text[i]);
+    if (val > (max - d) / base)
+      overflow = true;
+    else
+      val = val * base + d;
   }
-  if (end == text + cursor) // invalid
-    return NULL;
-  gram_state_update_last(state, end - text);
-  return allocate_ast(gram->user_data, cursor, end - (text + cursor), 0);
+  if (!digits) // invalid
+    return -1;
+  gram_state_update_last(state, i);
+  if (overflow)
+    return -1;
+  gram_state_leaf(state, gram->user_data, cursor, i - cursor);
+  return i - cursor;
 }
 
 struct gram * new_gram_int(void * user_data) {
   struct gram * gram;
   gram = malloc(sizeof (struct gram));
-  gram->user_data = user_data;
-  gram->matcher = &int_matcher;
+  init_gram(gram, user_data, GRAM_INT, &gram_int_matcher);
   return gram;
 }
 
-// used by new_gram_opt, new_gram_plus, new_gram_aster, new_gram_posla
-// and new_gram_negla.
-struct gram_child {
-  struct gram gram;
-  struct gram * child;
-};
-
-static struct ast * opt_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  struct ast * ast, * subast;
+int gram_opt_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
   // safe cast cause we know this is only used from new_gram_opt
   struct gram_child * g = (struct gram_child *)gram;
+  struct gram_mark mark = gram_state_mark(state);
   // recursive call:
-  gram_state_incr_depth(state);
-  subast = g->child->matcher(text, cursor, g->child, state);
-  if (subast) {
-    ast = allocate_ast(gram->user_data, cursor, subast->len, 1);
-    ast->children[0] = subast;
-  } else {
-    ast = allocate_ast(gram->user_data, cursor, 0, 0);
-  }
+  if (!gram_state_incr_depth(state))
+    return -1;
+  int len = gram_match(text, cursor, g->child, state);
+  if (len < 0)
+    len = 0;
+  gram_state_reduce(state, mark, gram->user_data, cursor, len);
   gram_state_decr_depth(state);
-  return ast;
+  return len;
 }
 
 struct gram * new_gram_opt(void * user_data, struct gram * child) {
@@ -377,47 +1596,41 @@ struct gram * new_gram_opt(void * user_data, struct gram * child) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_child));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &opt_matcher;
+  init_gram(&g->gram, user_data, GRAM_OPT, &gram_opt_matcher);
   g->child = child;
   return &g->gram;
 }
 
-static struct ast * plus_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  struct ast * ast, * subast;
-  int initial_cursor = cursor;
+int gram_plus_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  int len, initial_cursor = cursor;
   // safe cast cause we know this is only used from new_gram_plus
   struct gram_child * g = (struct gram_child *)gram;
+  struct gram_mark mark = gram_state_mark(state);
   // first recursive call:
-  gram_state_incr_depth(state);
-  subast = g->child->matcher(text, cursor, g->child, state);
-  if (!subast) {
+  if (!gram_state_incr_depth(state))
+    return -1;
+  len = gram_match(text, cursor, g->child, state);
+  if (len < 0) {
     gram_state_decr_depth(state);
-    return NULL;
+    return -1;
   }
-  struct ptrbuff buff;
-  ptrbuff_init(&buff);
-  cursor += subast->len;
-  ptrbuff_push(&buff, subast);
+  cursor += len;
   while (1) {
     // recursive call:
-    subast = g->child->matcher(text, cursor, g->child, state);
-    if (subast) {
-      if (subast->len == 0) {
-	// we reached a dead state... detecting deadlocks is a good thing :D
-	fprintf(stderr, "WARNING: «plus» parsing subgrammar with epsilon transitions. E.g: ('a'?)+\n"
-	    "\t(as a fallback) this match will fail, but you MUST fix the grammar.");
-	ptrbuff_reset(&buff, (void(*)(void*))&free_ast);
-	gram_state_decr_depth(state);
-	return NULL;
-      }
-      cursor += subast->len;
-      ptrbuff_push(&buff, subast);
+    len = gram_match(text, cursor, g->child, state);
+    if (len == 0) {
+      // we reached a dead state... detecting deadlocks is a good thing :D
+      fprintf(stderr, "WARNING: «plus» parsing subgrammar with epsilon transitions. E.g: ('a'?)+\n"
+	  "\t(as a fallback) this match will fail, but you MUST fix the grammar.");
+      gram_state_drop(state, mark);
+      gram_state_decr_depth(state);
+      return -1;
+    } else if (len > 0) {
+      cursor += len;
     } else {
-      ast = allocate_ast(gram->user_data, initial_cursor, cursor - initial_cursor, buff.count);
-      ptrbuff_finalize((void**)ast->children, &buff);
+      gram_state_reduce(state, mark, gram->user_data, initial_cursor, cursor - initial_cursor);
       gram_state_decr_depth(state);
-      return ast;
+      return cursor - initial_cursor;
     }
   }
 }
@@ -429,39 +1642,34 @@ struct gram * new_gram_plus(void * user_data, struct gram * child) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_child));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &plus_matcher;
+  init_gram(&g->gram, user_data, GRAM_PLUS, &gram_plus_matcher);
   g->child = child;
   return &g->gram;
 }
 
-static struct ast * aster_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  struct ast * ast, * subast;
-  int initial_cursor = cursor;
-  struct ptrbuff buff;
-  ptrbuff_init(&buff);
+int gram_aster_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  int len, initial_cursor = cursor;
   // safe cast cause we know this is only used from new_gram_aster
   struct gram_child * g = (struct gram_child *)gram;
-  gram_state_incr_depth(state);
+  struct gram_mark mark = gram_state_mark(state);
+  if (!gram_state_incr_depth(state))
+    return -1;
   while (1) {
     // recursive call:
-    subast = g->child->matcher(text, cursor, g->child, state);
-    if (subast) {
-      if (subast->len == 0) {
-	// we reached a dead state... detecting deadlocks is a good thing :D
-	fprintf(stderr, "WARNING: «aster» parsing subgrammar with epsilon transitions. E.g: ('a'?)*\n"
-	    "\t(as a fallback) this match will fail, but you MUST fix the grammar.");
-	ptrbuff_reset(&buff, (void(*)(void*))&free_ast);
-	gram_state_decr_depth(state);
-	return NULL;
-      }
-      cursor += subast->len;
-      ptrbuff_push(&buff, subast);
+    len = gram_match(text, cursor, g->child, state);
+    if (len == 0) {
+      // we reached a dead state... detecting deadlocks is a good thing :D
+      fprintf(stderr, "WARNING: «aster» parsing subgrammar with epsilon transitions. E.g: ('a'?)*\n"
+	  "\t(as a fallback) this match will fail, but you MUST fix the grammar.");
+      gram_state_drop(state, mark);
+      gram_state_decr_depth(state);
+      return -1;
+    } else if (len > 0) {
+      cursor += len;
     } else {
-      ast = allocate_ast(gram->user_data, initial_cursor, cursor - initial_cursor, buff.count);
-      ptrbuff_finalize((void**)ast->children, &buff);
+      gram_state_reduce(state, mark, gram->user_data, initial_cursor, cursor - initial_cursor);
       gram_state_decr_depth(state);
-      return ast;
+      return cursor - initial_cursor;
     }
   }
 }
@@ -473,37 +1681,36 @@ struct gram * new_gram_aster(void * user_data, struct gram * child) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_child));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &aster_matcher;
+  init_gram(&g->gram, user_data, GRAM_ASTER, &gram_aster_matcher);
   g->child = child;
   return &g->gram;
 }
 
-// used by new_gram_alt and new_gram_cat.
-struct gram_children {
-  struct gram gram;
-  struct gram * children[];
-};
-
-static struct ast * alt_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  int ch;
+int gram_alt_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+  int ch = 0;
+  bool end = cursor >= state->len;
+  unsigned char c = end ? 0 : text[cursor];
   // safe cast cause we know this is only used from new_gram_alt
   struct gram_children * g = (struct gram_children *)gram;
-  gram_state_incr_depth(state);
-  for (ch = 0; g->children[ch]; ch++) {
+  struct gram_mark mark = gram_state_mark(state);
+  if (!gram_state_incr_depth(state))
+    return -1;
+  if (g->dispatch && !end)
+    ch = g->dispatch[c];
+  for (; g->children[ch]; ch++) {
+    // children that can't start with c (or the end) would fail right away.
+    if (g->dispatch && (end ? !g->children[ch]->nullable : !gram_may_start(g->children[ch], c)))
+      continue;
     // recursive call:
-    struct ast * subast;
-    subast = g->children[ch]->matcher(text, cursor, g->children[ch], state);
-    if (subast) {
-      struct ast * ast;
-      ast = allocate_ast(gram->user_data, cursor, subast->len, 1);
-      ast->children[0] = subast;
+    int len = gram_match(text, cursor, g->children[ch], state);
+    if (len >= 0) {
+      gram_state_reduce(state, mark, gram->user_data, cursor, len);
       gram_state_decr_depth(state);
-      return ast;
+      return len;
     }
   }
   gram_state_decr_depth(state);
-  return NULL;
+  return -1;
 }
 
 struct gram * new_gram_alt_arr(void * user_data, struct gram ** children) {
@@ -516,39 +1723,36 @@ struct gram * new_gram_alt_arr(void * user_data, struct gram ** children) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_children) + sizeof (struct gram *) * (children_count + 1));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &alt_matcher;
+  init_gram(&g->gram, user_data, GRAM_ALT, &gram_alt_matcher);
+  g->dispatch = NULL;
   for (i = 0; i < children_count; i++)
     g->children[i] = children[i];
   g->children[children_count] = NULL;
   return &g->gram;
 }
 
-static struct ast * cat_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  struct ast * ast, * subast;
+int gram_cat_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
   int initial_cursor = cursor;
   int ch;
-  struct ptrbuff buff;
-  ptrbuff_init(&buff);
   // safe cast cause we know this is only used from new_gram_cat
   struct gram_children * g = (struct gram_children *)gram;
-  gram_state_incr_depth(state);
+  struct gram_mark mark = gram_state_mark(state);
+  if (!gram_state_incr_depth(state))
+    return -1;
   for (ch = 0; g->children[ch]; ch++) {
     // recursive call:
-    subast = g->children[ch]->matcher(text, cursor, g->children[ch], state);
-    if (subast) {
-      cursor += subast->len;
-      ptrbuff_push(&buff, subast);
+    int len = gram_match(text, cursor, g->children[ch], state);
+    if (len >= 0) {
+      cursor += len;
     } else {
-      ptrbuff_reset(&buff, (void(*)(void*))&free_ast);
+      gram_state_drop(state, mark);
       gram_state_decr_depth(state);
-      return NULL;
+      return -1;
     }
   }
-  ast = allocate_ast(gram->user_data, initial_cursor, cursor - initial_cursor, buff.count);
-  ptrbuff_finalize((void**)ast->children, &buff);
+  gram_state_reduce(state, mark, gram->user_data, initial_cursor, cursor - initial_cursor);
   gram_state_decr_depth(state);
-  return ast;
+  return cursor - initial_cursor;
 }
 
 // @args: children, last child must be NULL.
@@ -562,28 +1766,29 @@ struct gram * new_gram_cat_arr(void * user_data, struct gram ** children) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_children) + sizeof (struct gram *) * (children_count + 1));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &cat_matcher;
+  init_gram(&g->gram, user_data, GRAM_CAT, &gram_cat_matcher);
+  g->dispatch = NULL;
   for (i = 0; i < children_count; i++)
     g->children[i] = children[i];
+  g->children[children_count] = NULL;
   return &g->gram;
 }
 
-static struct ast * posla_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  struct ast * ast = NULL, * subast;
+int gram_posla_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
   // safe cast cause we know this is only used from new_gram_posla
   struct gram_child * g = (struct gram_child *)gram;
+  struct gram_mark mark = gram_state_mark(state);
   // recursive call (we must not use the same last):
   int rememberedlast = state->last;
-  gram_state_incr_depth(state);
-  subast = g->child->matcher(text, cursor, g->child, state);
+  if (!gram_state_incr_depth(state))
+    return -1;
+  int len = gram_match(text, cursor, g->child, state);
   gram_state_decr_depth(state);
   state->last = rememberedlast;
-  if (subast) {
-    ast = allocate_ast(gram->user_data, cursor, 0, 1);
-    ast->children[0] = subast;
-  }
-  return ast;
+  if (len < 0)
+    return -1;
+  gram_state_reduce(state, mark, gram->user_data, cursor, 0);
+  return 0;
 }
 
 struct gram * new_gram_posla(void * user_data, struct gram * child) {
@@ -593,26 +1798,28 @@ struct gram * new_gram_posla(void * user_data, struct gram * child) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_child));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &posla_matcher;
+  init_gram(&g->gram, user_data, GRAM_POSLA, &gram_posla_matcher);
   g->child = child;
   return &g->gram;
 }
 
-static struct ast * negla_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
-  struct ast * ast = NULL, * subast;
+int gram_negla_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
   // safe cast cause we know this is only used from new_gram_posla
   struct gram_child * g = (struct gram_child *)gram;
+  struct gram_mark mark = gram_state_mark(state);
   // recursive call (we must not use the same last):
   int rememberedlast = state->last;
-  gram_state_incr_depth(state);
-  subast = g->child->matcher(text, cursor, g->child, state);
+  if (!gram_state_incr_depth(state))
+    return -1;
+  int len = gram_match(text, cursor, g->child, state);
   gram_state_decr_depth(state);
   state->last = rememberedlast;
-  if (!subast) {
-    ast = allocate_ast(gram->user_data, cursor, 0, 0);
+  if (len >= 0) {
+    gram_state_drop(state, mark);
+    return -1;
   }
-  return ast;
+  gram_state_leaf(state, gram->user_data, cursor, 0);
+  return 0;
 }
 
 struct gram * new_gram_negla(void * user_data, struct gram * child) {
@@ -622,29 +1829,22 @@ struct gram * new_gram_negla(void * user_data, struct gram * child) {
     return NULL;
   }
   g = malloc(sizeof (struct gram_child));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &negla_matcher;
+  init_gram(&g->gram, user_data, GRAM_NEGLA, &gram_negla_matcher);
   g->child = child;
   return &g->gram;
 }
 
-// used by new_gram_custom.
-struct gram_custom {
-  struct gram gram;
-  int (*matcher)(const char * text, int cursor, void * priv_data, struct gram_state * state);
-  void * priv_data;
-};
-
-static struct ast * custom_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
+static int custom_matcher(const char * text, int cursor, struct gram * gram, struct gram_state * state) {
   // safe cast cause we know this is only used from new_gram_custom
   struct gram_custom * g = (struct gram_custom *)gram;
   // recursive call:
-  gram_state_incr_depth(state);
+  if (!gram_state_incr_depth(state))
+    return -1;
   int len = g->matcher(text, cursor, g->priv_data, state);
   gram_state_decr_depth(state);
   if (len >= 0)
-    return allocate_ast(gram->user_data, cursor, len, 0);
-  return NULL;
+    gram_state_leaf(state, gram->user_data, cursor, len);
+  return len < 0 ? -1 : len;
 }
 
 struct gram * new_gram_custom(
@@ -657,17 +1857,25 @@ struct gram * new_gram_custom(
     return NULL;
   }
   g = malloc(sizeof (struct gram_custom));
-  g->gram.user_data = user_data;
-  g->gram.matcher = &custom_matcher;
+  init_gram(&g->gram, user_data, GRAM_CUSTOM, &custom_matcher);
   g->matcher = matcher;
   g->priv_data = priv_data;
   return &g->gram;
 }
 
+// the grams of gram_freeze must never change.
+static void check_not_frozen(struct gram * gram, const char * fn) {
+  if (gram->frozen) {
+    fprintf(stderr, "%s called for a frozen grammar.\n", fn);
+    exit(1);
+  }
+}
+
 void gram_set_child(struct gram * gram, struct gram * child, int pos) {
-  if (gram->matcher == opt_matcher || gram->matcher == plus_matcher
-      || gram->matcher == aster_matcher || gram->matcher == posla_matcher
-      || gram->matcher == negla_matcher) {
+  check_not_frozen(gram, "gram_set_child");
+  if (gram->matcher == gram_opt_matcher || gram->matcher == gram_plus_matcher
+      || gram->matcher == gram_aster_matcher || gram->matcher == gram_posla_matcher
+      || gram->matcher == gram_negla_matcher) {
     if (pos != 0) {
       fprintf(stderr, "gram_set_child called with pos>0 for single child grammar.\n");
       exit(1);
@@ -675,7 +1883,7 @@ void gram_set_child(struct gram * gram, struct gram * child, int pos) {
     // 100% safe cast:
     struct gram_child * g = (struct gram_child *) gram;
     g->child = child;
-  } else if (gram->matcher == alt_matcher || gram->matcher == cat_matcher) {
+  } else if (gram->matcher == gram_alt_matcher || gram->matcher == gram_cat_matcher) {
     struct gram_children * g = (struct gram_children *) gram;
     int children_count = 0;
     while (g->children[children_count])
@@ -686,16 +1894,25 @@ void gram_set_child(struct gram * gram, struct gram * child, int pos) {
       exit(1);
     }
     g->children[pos] = child;
-  } else if (gram->matcher == dot_matcher) {
+    // its dispatch table is stale now.
+    free(g->dispatch);
+    g->dispatch = NULL;
+  } else if (gram->matcher == gram_dot_matcher) {
     printf("gram_set_child MUST NOT be called for grammars created with new_gram_dot.\n");
     exit(1);
-  } else if (gram->matcher == string_matcher) {
+  } else if (gram->matcher == gram_string_matcher) {
     printf("gram_set_child MUST NOT be called for grammars created with new_gram_string.\n");
     exit(1);
-  } else if (gram->matcher == range_matcher) {
+  } else if (gram->matcher == gram_range_matcher) {
     printf("gram_set_child MUST NOT be called for grammars created with new_gram_range.\n");
     exit(1);
-  } else if (gram->matcher == int_matcher) {
+  } else if (gram->matcher == gram_class_matcher) {
+    printf("gram_set_child MUST NOT be called for grammars created with new_gram_class.\n");
+    exit(1);
+  } else if (gram->matcher == gram_span_matcher) {
+    printf("gram_set_child MUST NOT be called for grammars created with new_gram_span.\n");
+    exit(1);
+  } else if (gram->matcher == gram_int_matcher) {
     printf("gram_set_child MUST NOT be called for grammars created with new_gram_int.\n");
     exit(1);
   } else if (gram->matcher == custom_matcher) {
@@ -711,6 +1928,7 @@ void gram_set_user_data(struct gram * gram, void * user_data) {
     fprintf(stderr, "gram_set_user_data: NULL grammar.\n");
     exit(1);
   }
+  check_not_frozen(gram, "gram_set_user_data");
   gram->user_data = user_data;
 }
 
@@ -722,9 +1940,642 @@ void * gram_get_user_data(struct gram * gram) {
   return gram->user_data;
 }
 
+void gram_set_filter(struct gram * gram, enum filter_ast_mode filter) {
+  if (!gram) {
+    fprintf(stderr, "gram_set_filter: NULL grammar.\n");
+    exit(1);
+  }
+  if (filter < FILTER_AST_KEEP || filter > FILTER_AST_DISCARD) {
+    fprintf(stderr, "gram_set_filter: invalid filter %d.\n", filter);
+    exit(1);
+  }
+  check_not_frozen(gram, "gram_set_filter");
+  gram->filter = filter;
+}
+
+enum filter_ast_mode gram_get_filter(struct gram * gram) {
+  if (!gram) {
+    fprintf(stderr, "gram_get_filter: NULL grammar.\n");
+    exit(1);
+  }
+  return gram->filter;
+}
+
+void gram_get_memo_stats(struct gram * gram, struct gram_memo_stats * stats) {
+  if (!gram) {
+    fprintf(stderr, "gram_get_memo_stats: NULL grammar.\n");
+    exit(1);
+  }
+  stats->policy = gram->memo_policy;
+  stats->hits = gram->memo_hits;
+  stats->misses = gram->memo_misses;
+}
+
+void gram_set_memo_policy(struct gram * gram, enum gram_memo_policy policy) {
+  if (!gram) {
+    fprintf(stderr, "gram_set_memo_policy: NULL grammar.\n");
+    exit(1);
+  }
+  check_not_frozen(gram, "gram_set_memo_policy");
+  gram->memo_policy = policy;
+  gram->memo_hits = gram->memo_misses = 0;
+  gram->memo_hot = false;
+}
+
 void free_gram(struct gram * gram) {
-  //if (gram->matcher == foo_matcher) {
-  //  free(gram->additional_field);
-  //}
+  if (gram->program)
+    free_gram_program(gram->program);
+  if (gram->type == GRAM_ALT)
+    free(((struct gram_children *)gram)->dispatch);
   free(gram);
 }
+
+/************************************************************************\
+*				 ANALYSIS				 *
+* First byte sets and nullability of every gram, computed as a fixed	 *
+* point over the (possibly cyclic) graph.				 *
+\************************************************************************/
+
+struct analysis {
+  unsigned serial;
+  struct gram ** grams; // children before their parents (when acyclic).
+  int count, size;
+};
+
+static void analysis_collect(struct analysis * a, struct gram * gram) {
+  int i;
+  // frozen grams keep their analysis, other threads may be reading it.
+  if (gram->analysis_serial == a->serial || gram->frozen)
+    return;
+  gram->analysis_serial = a->serial;
+  // start from the least fixed point: nothing matches.
+  gram->nullable = false;
+  memset(gram->first, 0, sizeof gram->first);
+  switch (gram->type) {
+    case GRAM_OPT: case GRAM_PLUS: case GRAM_ASTER:
+    case GRAM_POSLA: case GRAM_NEGLA:
+      analysis_collect(a, ((struct gram_child *)gram)->child);
+      break;
+    case GRAM_ALT: case GRAM_CAT:
+      for (i = 0; ((struct gram_children *)gram)->children[i]; i++)
+	analysis_collect(a, ((struct gram_children *)gram)->children[i]);
+      break;
+    default:
+      break;
+  }
+  if (a->count == a->size) {
+    a->size = a->size ? 2 * a->size : 64;
+    a->grams = realloc(a->grams, sizeof (struct gram *) * a->size);
+  }
+  a->grams[a->count++] = gram;
+}
+
+static inline void first_add(unsigned char * first, unsigned char c) {
+  first[c >> 3] |= 1 << (c & 7);
+}
+
+static inline void first_union(unsigned char * first, const unsigned char * other) {
+  int i;
+  for (i = 0; i < 32; i++)
+    first[i] |= other[i];
+}
+
+// recomputes nullable and first from the children, true if they changed.
+static bool analysis_update(struct gram * gram) {
+  unsigned char first[32] = {0};
+  bool nullable = false;
+  struct gram * child, ** children;
+  int i;
+  switch (gram->type) {
+    case GRAM_DOT:
+      memset(first, 0xff, sizeof first);
+      break;
+    case GRAM_STRING:
+      if (((struct gram_string *)gram)->len)
+	first_add(first, ((struct gram_string *)gram)->text[0]);
+      else
+	nullable = true;
+      break;
+    case GRAM_RANGE:
+      for (i = ((struct gram_range *)gram)->from; i <= ((struct gram_range *)gram)->to; i++)
+	first_add(first, i);
+      break;
+    case GRAM_CLASS:
+      memcpy(first, ((struct gram_class *)gram)->set, sizeof first);
+      break;
+    case GRAM_SPAN:
+      memcpy(first, ((struct gram_span *)gram)->set, sizeof first);
+      nullable = ((struct gram_span *)gram)->min == 0;
+      break;
+    case GRAM_INT: case GRAM_CUSTOM:
+      // they may update last even when failing, so never skip them.
+      memset(first, 0xff, sizeof first);
+      nullable = true;
+      break;
+    case GRAM_OPT: case GRAM_ASTER: case GRAM_PLUS:
+      child = ((struct gram_child *)gram)->child;
+      memcpy(first, child->first, sizeof first);
+      nullable = gram->type != GRAM_PLUS || child->nullable;
+      break;
+    case GRAM_POSLA: case GRAM_NEGLA:
+      // lookaheads consume nothing, and restore last.
+      nullable = true;
+      break;
+    case GRAM_ALT:
+      for (children = ((struct gram_children *)gram)->children; *children; children++) {
+	first_union(first, (*children)->first);
+	nullable = nullable || (*children)->nullable;
+      }
+      break;
+    case GRAM_CAT:
+      nullable = true;
+      for (children = ((struct gram_children *)gram)->children; *children && nullable; children++) {
+	first_union(first, (*children)->first);
+	nullable = (*children)->nullable;
+      }
+      break;
+  }
+  if (nullable == gram->nullable && !memcmp(first, gram->first, sizeof first))
+    return false;
+  gram->nullable = nullable;
+  memcpy(gram->first, first, sizeof first);
+  return true;
+}
+
+static void analysis_dispatch(struct gram_children * g) {
+  int c, ch, n;
+  for (n = 0; g->children[n]; n++)
+    ;
+  if (n > USHRT_MAX)
+    return;
+  if (!g->dispatch)
+    g->dispatch = malloc(sizeof (unsigned short) * 256);
+  for (c = 0; c < 256; c++) {
+    for (ch = 0; ch < n && !gram_may_start(g->children[ch], c); ch++)
+      ;
+    g->dispatch[c] = ch;
+  }
+}
+
+void gram_analyze(struct gram * gram) {
+  static unsigned analysis_serial = 0;
+  struct analysis a = {__atomic_add_fetch(&analysis_serial, 1, __ATOMIC_RELAXED), NULL, 0, 0};
+  bool changed;
+  int i;
+  if (!gram) {
+    fprintf(stderr, "gram_analyze: NULL grammar.\n");
+    exit(1);
+  }
+  analysis_collect(&a, gram);
+  do {
+    changed = false;
+    for (i = 0; i < a.count; i++)
+      changed |= analysis_update(a.grams[i]);
+  } while (changed);
+  for (i = 0; i < a.count; i++)
+    if (a.grams[i]->type == GRAM_ALT)
+      analysis_dispatch((struct gram_children *)a.grams[i]);
+  free(a.grams);
+}
+
+static void freeze(struct gram * gram) {
+  int i;
+  if (gram->frozen)
+    return;
+  gram->frozen = true;
+  switch (gram->type) {
+    case GRAM_OPT: case GRAM_PLUS: case GRAM_ASTER:
+    case GRAM_POSLA: case GRAM_NEGLA:
+      freeze(((struct gram_child *)gram)->child);
+      break;
+    case GRAM_ALT: case GRAM_CAT:
+      for (i = 0; ((struct gram_children *)gram)->children[i]; i++)
+	freeze(((struct gram_children *)gram)->children[i]);
+      break;
+    default:
+      break;
+  }
+}
+
+struct gram * gram_freeze(struct gram * gram) {
+  if (!gram) {
+    fprintf(stderr, "gram_freeze: NULL grammar.\n");
+    exit(1);
+  }
+  gram_analyze(gram);
+  freeze(gram);
+  return gram;
+}
+
+/************************************************************************\
+*				OPTIMIZER				 *
+* Copies a grammar simplifying the grams without user_data, whose nodes	 *
+* are dropped by purge_ast anyway. Named grams are copied one to one,	 *
+* so the purged trees stay the same.					 *
+\************************************************************************/
+
+struct gram_copy {
+  struct gram * gram, * copy; // gram is NULL for empty slots.
+};
+
+struct optimizer {
+  struct gram_copy * copies; // open addressing, by gram.
+  int size, count;
+  // the grams being flattened into their parents, to stop at cycles.
+  struct gram * flattening[64];
+  int flattening_count;
+  void (*on_copy)(struct gram * gram, struct gram * copy, int created, void * privdata);
+  void * privdata;
+};
+
+static struct gram_copy * optimizer_slot(struct optimizer * o, struct gram * gram) {
+  unsigned mask = o->size - 1;
+  uintptr_t h = (uintptr_t)gram >> 4;
+  unsigned i = (unsigned)(h ^ (h >> 15)) * 0x9e3779b1u & mask;
+  while (o->copies[i].gram && o->copies[i].gram != gram)
+    i = (i + 1) & mask;
+  return &o->copies[i];
+}
+
+// records what gram became (a copy, if created).
+static void optimizer_put(struct optimizer * o, struct gram * gram, struct gram * copy, bool created) {
+  if (gram && 2 * (o->count + 1) > o->size) {
+    struct gram_copy * old = o->copies;
+    int i, oldsize = o->size;
+    o->size *= 2;
+    o->copies = calloc(o->size, sizeof (struct gram_copy));
+    for (i = 0; i < oldsize; i++)
+      if (old[i].gram)
+	*optimizer_slot(o, old[i].gram) = old[i];
+    free(old);
+  }
+  if (gram) {
+    *optimizer_slot(o, gram) = (struct gram_copy){gram, copy};
+    o->count++;
+  }
+  if (o->on_copy)
+    o->on_copy(gram, copy, created, o->privdata);
+}
+
+// whether gram builds a node that purge_ast drops anyway, so it may be
+// simplified (a filtered gram changes the tree as it is).
+static inline bool unnamed(struct gram * gram) {
+  return !gram->user_data && gram->filter == FILTER_AST_KEEP;
+}
+
+// unnamed sequences and choices of a single child are just that child.
+static struct gram * skip_wrappers(struct gram * gram) {
+  int i;
+  for (i = 0; i < 64 && unnamed(gram) && (gram->type == GRAM_CAT || gram->type == GRAM_ALT)
+      && !((struct gram_children *)gram)->children[1]; i++)
+    gram = ((struct gram_children *)gram)->children[0];
+  return gram;
+}
+
+// whether gram is unnamed and always matches a single char: if so, its
+// chars are added to set.
+static bool single_char_set(struct gram * gram, unsigned char * set) {
+  int i, c;
+  if (!unnamed(gram))
+    return false;
+  switch (gram->type) {
+    case GRAM_DOT:
+      memset(set, 0xff, 32);
+      return true;
+    case GRAM_STRING:
+      if (((struct gram_string *)gram)->len != 1)
+	return false;
+      c = (unsigned char)((struct gram_string *)gram)->text[0];
+      set[c >> 3] |= 1 << (c & 7);
+      return true;
+    case GRAM_RANGE:
+      // ranges compare chars, whatever their signedness.
+      for (i = ((struct gram_range *)gram)->from; i <= ((struct gram_range *)gram)->to; i++) {
+	c = (unsigned char)i;
+	set[c >> 3] |= 1 << (c & 7);
+      }
+      return true;
+    case GRAM_CLASS:
+      for (i = 0; i < 32; i++)
+	set[i] |= ((struct gram_class *)gram)->set[i];
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct gram_list {
+  struct gram ** grams;
+  int count, size;
+};
+
+static void gram_list_push(struct gram_list * list, struct gram * gram) {
+  if (list->count == list->size) {
+    list->size = list->size ? 2 * list->size : 8;
+    list->grams = realloc(list->grams, sizeof (struct gram *) * list->size);
+  }
+  list->grams[list->count++] = gram;
+}
+
+// the children of gram, with those of its unnamed children of the same
+// type (a sequence in a sequence, or a choice in a choice) in their place.
+static void flatten(struct optimizer * o, struct gram * gram, struct gram_list * list) {
+  struct gram ** children = ((struct gram_children *)gram)->children;
+  int i, j;
+  o->flattening[o->flattening_count++] = gram;
+  for (i = 0; children[i]; i++) {
+    struct gram * child = skip_wrappers(children[i]);
+    bool cycle = false;
+    for (j = 0; j < o->flattening_count; j++)
+      cycle = cycle || o->flattening[j] == child;
+    if (unnamed(child) && child->type == gram->type && !cycle
+	&& o->flattening_count < sizeof o->flattening / sizeof o->flattening[0])
+      flatten(o, child, list);
+    else
+      gram_list_push(list, child);
+  }
+  o->flattening_count--;
+}
+
+// merges the runs of unnamed strings of a sequence, or of single chars of
+// a choice (then the order among them doesn't matter).
+static void merge_runs(struct optimizer * o, enum gram_type type, struct gram_list * list) {
+  int i, j, n = 0, len;
+  for (i = 0; i < list->count; i = j) {
+    unsigned char set[32] = {0};
+    struct gram * merged = NULL;
+    j = i + 1;
+    if (type == GRAM_CAT && list->grams[i]->type == GRAM_STRING && unnamed(list->grams[i])) {
+      len = ((struct gram_string *)list->grams[i])->len;
+      for (; j < list->count && list->grams[j]->type == GRAM_STRING && unnamed(list->grams[j]); j++)
+	len += ((struct gram_string *)list->grams[j])->len;
+      if (j - i > 1) {
+	char text[len + 1];
+	for (len = 0; i < j; i++) {
+	  struct gram_string * s = (struct gram_string *)list->grams[i];
+	  memcpy(text + len, s->text, s->len);
+	  len += s->len;
+	}
+	text[len] = '\0';
+	merged = new_gram_string(NULL, text);
+      }
+    } else if (type == GRAM_ALT && single_char_set(list->grams[i], set)) {
+      while (j < list->count && single_char_set(list->grams[j], set))
+	j++;
+      if (j - i > 1)
+	merged = new_gram_class(NULL, set, 0);
+    }
+    if (merged) {
+      optimizer_put(o, NULL, merged, true);
+      list->grams[n++] = merged;
+    } else {
+      list->grams[n++] = list->grams[i];
+    }
+  }
+  list->count = n;
+}
+
+static struct gram * optimize(struct optimizer * o, struct gram * gram) {
+  struct gram_copy * slot = optimizer_slot(o, gram);
+  struct gram * copy, * child;
+  unsigned char set[32] = {0};
+  int i;
+  if (slot->gram)
+    return slot->copy;
+  switch (gram->type) {
+    case GRAM_OPT: case GRAM_PLUS: case GRAM_ASTER:
+    case GRAM_POSLA: case GRAM_NEGLA:
+      child = skip_wrappers(((struct gram_child *)gram)->child);
+      // a repeated single char is a run, whose node is a leaf.
+      if ((gram->type == GRAM_PLUS || gram->type == GRAM_ASTER) && single_char_set(child, set)) {
+	copy = new_gram_span(gram->user_data, set, 0, gram->type == GRAM_PLUS);
+	copy->memo_policy = gram->memo_policy;
+	copy->filter = gram->filter;
+	optimizer_put(o, gram, copy, true);
+	break;
+      }
+      if (gram->type == GRAM_OPT)
+	copy = new_gram_opt(gram->user_data, (struct gram *)-1);
+      else if (gram->type == GRAM_PLUS)
+	copy = new_gram_plus(gram->user_data, (struct gram *)-1);
+      else if (gram->type == GRAM_ASTER)
+	copy = new_gram_aster(gram->user_data, (struct gram *)-1);
+      else if (gram->type == GRAM_POSLA)
+	copy = new_gram_posla(gram->user_data, (struct gram *)-1);
+      else
+	copy = new_gram_negla(gram->user_data, (struct gram *)-1);
+      // (before its child, which may lead back to it)
+      copy->memo_policy = gram->memo_policy;
+      copy->filter = gram->filter;
+      optimizer_put(o, gram, copy, true);
+      ((struct gram_child *)copy)->child = optimize(o, child);
+      break;
+    case GRAM_ALT: case GRAM_CAT: {
+      struct gram_list list = {NULL, 0, 0};
+      flatten(o, gram, &list);
+      merge_runs(o, gram->type, &list);
+      if (list.count == 1 && unnamed(gram) && list.grams[0] != gram) {
+	copy = optimize(o, list.grams[0]);
+	// it may have been reached again through its child.
+	if (!optimizer_slot(o, gram)->gram)
+	  optimizer_put(o, gram, copy, false);
+	free(list.grams);
+	break;
+      }
+      // the children are set once it's recorded.
+      struct gram * placeholders[list.count + 1];
+      for (i = 0; i < list.count; i++)
+	placeholders[i] = (struct gram *)-1;
+      placeholders[i] = NULL;
+      copy = gram->type == GRAM_ALT ? new_gram_alt_arr(gram->user_data, placeholders)
+	: new_gram_cat_arr(gram->user_data, placeholders);
+      copy->memo_policy = gram->memo_policy;
+      copy->filter = gram->filter;
+      optimizer_put(o, gram, copy, true);
+      for (i = 0; i < list.count; i++)
+	((struct gram_children *)copy)->children[i] = optimize(o, list.grams[i]);
+      free(list.grams);
+      break;
+    }
+    default:
+      // terminals are shared.
+      copy = gram;
+      optimizer_put(o, gram, copy, false);
+      break;
+  }
+  return copy;
+}
+
+struct gram * gram_optimize(struct gram * gram,
+    void (*on_copy)(struct gram * gram, struct gram * copy, int created, void * privdata),
+    void * privdata) {
+  struct optimizer o = {
+    .size = 256,
+    .on_copy = on_copy,
+    .privdata = privdata,
+  };
+  if (!gram) {
+    fprintf(stderr, "gram_optimize: NULL grammar.\n");
+    return NULL;
+  }
+  o.copies = calloc(o.size, sizeof (struct gram_copy));
+  gram = optimize(&o, gram);
+  free(o.copies);
+  return gram;
+}
+
+/************************************************************************\
+*				LITERALS				 *
+* The strings every match contains, found bottom up: what a gram always *
+* starts and ends with, and the longest string found inside, joining	 *
+* the end of a gram with the start of the next one in sequences.	 *
+\************************************************************************/
+
+#define LITERAL_MAX 64
+
+struct literals {
+  bool exact; // it always matches prefix (then suffix and inner are the same).
+  int prefix_len, suffix_len, inner_len;
+  char prefix[LITERAL_MAX], suffix[LITERAL_MAX], inner[LITERAL_MAX];
+};
+
+struct literal_walk {
+  struct gram * stack[64]; // the grams being walked, to stop at cycles.
+  int depth, budget;
+};
+
+static const struct literals no_literals = {false, 0, 0, 0};
+
+static void literals_of_string(struct literals * l, const char * text, int len) {
+  l->exact = len <= LITERAL_MAX;
+  l->prefix_len = l->suffix_len = l->inner_len = len < LITERAL_MAX ? len : LITERAL_MAX;
+  memcpy(l->prefix, text, l->prefix_len);
+  memcpy(l->suffix, text + len - l->suffix_len, l->suffix_len);
+  memcpy(l->inner, text, l->inner_len);
+}
+
+// keeps the longest known string inside.
+static void literals_inner(struct literals * l, const char * text, int len) {
+  if (len > l->inner_len) {
+    l->inner_len = len < LITERAL_MAX ? len : LITERAL_MAX;
+    memcpy(l->inner, text, l->inner_len);
+  }
+}
+
+// a is followed by b.
+static void literals_cat(struct literals * a, const struct literals * b) {
+  char joint[2 * LITERAL_MAX];
+  int i, len;
+  if (a->exact && b->exact) {
+    memcpy(joint, a->prefix, a->prefix_len);
+    memcpy(joint + a->prefix_len, b->prefix, b->prefix_len);
+    literals_of_string(a, joint, a->prefix_len + b->prefix_len);
+    return;
+  }
+  memcpy(joint, a->suffix, a->suffix_len);
+  memcpy(joint + a->suffix_len, b->prefix, b->prefix_len);
+  len = a->suffix_len + b->prefix_len;
+  literals_inner(a, b->inner, b->inner_len);
+  literals_inner(a, joint, len);
+  if (a->exact) {
+    a->prefix_len = len < LITERAL_MAX ? len : LITERAL_MAX;
+    memcpy(a->prefix, joint, a->prefix_len);
+  }
+  if (b->exact) {
+    // the joint ends with all of b.
+    i = len < LITERAL_MAX ? 0 : len - LITERAL_MAX;
+    a->suffix_len = len - i;
+    memcpy(a->suffix, joint + i, a->suffix_len);
+  } else {
+    a->suffix_len = b->suffix_len;
+    memcpy(a->suffix, b->suffix, b->suffix_len);
+  }
+  a->exact = false;
+}
+
+// a or b: only what they both start or end with is kept.
+static void literals_alt(struct literals * a, const struct literals * b) {
+  int i;
+  if (a->exact && b->exact && a->prefix_len == b->prefix_len
+      && !memcmp(a->prefix, b->prefix, a->prefix_len))
+    return;
+  for (i = 0; i < a->prefix_len && i < b->prefix_len && a->prefix[i] == b->prefix[i]; i++)
+    ;
+  a->prefix_len = i;
+  for (i = 0; i < a->suffix_len && i < b->suffix_len
+      && a->suffix[a->suffix_len - 1 - i] == b->suffix[b->suffix_len - 1 - i]; i++)
+    ;
+  memmove(a->suffix, a->suffix + a->suffix_len - i, i);
+  a->suffix_len = i;
+  if (a->inner_len != b->inner_len || memcmp(a->inner, b->inner, a->inner_len))
+    a->inner_len = 0;
+  literals_inner(a, a->prefix, a->prefix_len);
+  literals_inner(a, a->suffix, a->suffix_len);
+  a->exact = false;
+}
+
+static struct literals literals_of(struct literal_walk * w, struct gram * gram) {
+  struct literals l = no_literals, child;
+  struct gram ** children;
+  int i;
+  for (i = 0; i < w->depth; i++)
+    if (w->stack[i] == gram)
+      return no_literals;
+  if (w->depth == sizeof w->stack / sizeof w->stack[0] || --w->budget < 0)
+    return no_literals;
+  w->stack[w->depth++] = gram;
+  switch (gram->type) {
+    case GRAM_STRING:
+      literals_of_string(&l, ((struct gram_string *)gram)->text, ((struct gram_string *)gram)->len);
+      break;
+    case GRAM_POSLA: case GRAM_NEGLA:
+      // they match nothing.
+      literals_of_string(&l, "", 0);
+      break;
+    case GRAM_PLUS:
+      l = literals_of(w, ((struct gram_child *)gram)->child);
+      l.exact = false;
+      break;
+    case GRAM_CAT:
+      children = ((struct gram_children *)gram)->children;
+      l = literals_of(w, children[0]);
+      for (i = 1; children[i]; i++) {
+	child = literals_of(w, children[i]);
+	literals_cat(&l, &child);
+      }
+      break;
+    case GRAM_ALT:
+      children = ((struct gram_children *)gram)->children;
+      l = literals_of(w, children[0]);
+      for (i = 1; children[i]; i++) {
+	child = literals_of(w, children[i]);
+	literals_alt(&l, &child);
+      }
+      break;
+    default:
+      // optional, or matching chars from a set: nothing is known.
+      break;
+  }
+  w->depth--;
+  return l;
+}
+
+int gram_required_literal(struct gram * gram, char * literal, int size, int * anchored) {
+  struct literal_walk w = {.depth = 0, .budget = 10000};
+  struct literals l;
+  if (!gram) {
+    fprintf(stderr, "gram_required_literal: NULL grammar.\n");
+    return 0;
+  }
+  l = literals_of(&w, gram);
+  // a prefix is as good as any string of its length, and cheaper to check.
+  *anchored = l.prefix_len && l.prefix_len >= l.inner_len;
+  if (*anchored) {
+    l.inner_len = l.prefix_len;
+    memcpy(l.inner, l.prefix, l.prefix_len);
+  }
+  if (l.inner_len > size)
+    l.inner_len = size;
+  memcpy(literal, l.inner, l.inner_len);
+  return l.inner_len;
+}
@@ -7,16 +7,114 @@ struct gram_state;
 struct ast {
   void * user_data;
   int from, len;
+  int refs; // number of owners, subtrees may be shared when memoizing.
   struct ast * children[]; // NULL terminated array of children.
 };
 
 struct ast * parse(const char * text, struct gram * gram, int * last);
 
+enum parse_flags {
+  // memoize the result of every (gram, cursor) pair (packrat parsing), so
+  // any grammar is parsed in linear time, at the cost of O(grams * text)
+  // memory during the parse. Memoized subtrees are shared in the result.
+  PARSE_PACKRAT = 1 << 0,
+  // selective memoization: only named grams, and those seen being matched
+  // again at the same cursor, are memoized. Grams whose memoized results
+  // are (almost) never reused stop being memoized.
+  PARSE_MEMO = 1 << 1,
+  // runs the grammar compiled (see gramvm.h) on a stack grown in the heap,
+  // rather than recursing on the C stack, which fails the parses nesting
+  // more than 4095 grams (see gram_context_overflow). Nothing is memoized (the flags above are
+  // ignored), and unless the grammar is frozen (see gram_freeze) it's
+  // compiled again for every parse.
+  PARSE_ITERATIVE = 1 << 2,
+};
+
+/**
+ * same as parse, but flags is a combination of enum parse_flags.
+ */
+struct ast * parse_ex(const char * text, struct gram * gram, int * last, int flags);
+
+/**
+ * same as parse, but the text is the len bytes at text, which may have
+ * NULs and doesn't need to be NUL terminated (it's never read past them).
+ * The functions without a len use strlen(text).
+ */
+struct ast * parse_n(const char * text, int len, struct gram * gram, int * last);
+
 /**
- *  destroys the whole tree (subtrees included)
+ * same as parse_ex, but the text is only recognized: it returns the length
+ * of the match (or -1 if it didn't match) and updates last, without
+ * building the tree. Nothing is allocated unless memoizing.
+ */
+int match(const char * text, struct gram * gram, int * last);
+int match_ex(const char * text, struct gram * gram, int * last, int flags);
+int match_n(const char * text, int len, struct gram * gram, int * last);
+int match_n_ex(const char * text, int len, struct gram * gram, int * last, int flags);
+
+struct gram_doc;
+
+/**
+ * a text to be parsed again after every edit, as with parse_ex and
+ * PARSE_PACKRAT (text is copied, and may have NULs). The memoized results
+ * are kept between parses, and an edit only discards those whose matches
+ * examined some edited byte (or the end of the text, if the edit is there).
+ * Custom grams are assumed to read no further than the last they set.
+ */
+struct gram_doc * new_gram_doc(struct gram * gram, const char * text, int len);
+
+/**
+ * replaces the removed bytes at offset by the inserted_len bytes at inserted
+ * and parses the text again, reusing the subtrees out of the edit (those
+ * after it are moved by the change in length). It returns the new tree, as
+ * gram_doc_get_ast, or NULL if the edit is out of the text.
+ */
+struct ast * gram_doc_edit(struct gram_doc * doc, int offset, int removed,
+    const char * inserted, int inserted_len, int * last);
+
+/**
+ * the tree of the last parse (NULL if it didn't match) and its last. It
+ * belongs to doc, and it's freed (or changed) by the next edit.
+ */
+struct ast * gram_doc_get_ast(struct gram_doc * doc, int * last);
+
+const char * gram_doc_get_text(struct gram_doc * doc, int * len);
+
+void free_gram_doc(struct gram_doc * doc);
+
+/**
+ *  destroys the whole tree (subtrees included). Shared subtrees are only
+ * destroyed when their last owner is freed.
  */
 void free_ast(struct ast * ast);
 
+struct ast_arena;
+
+/**
+ * an arena is a bump allocator for ast nodes, which may be reused for
+ * several parses.
+ */
+struct ast_arena * new_ast_arena(void);
+
+/**
+ * same as parse_ex, but every node of the resulting tree is allocated in
+ * arena (contiguously, children before their parents), and the nodes of
+ * failed alternatives are discarded just by rewinding it. Those nodes must
+ * NOT be freed with free_ast, but all at once with ast_arena_reset or
+ * free_ast_arena. arena may be NULL, meaning malloc as in parse_ex.
+ */
+struct ast * parse_arena(struct ast_arena * arena, const char * text, struct gram * gram, int * last, int flags);
+struct ast * parse_arena_n(struct ast_arena * arena, const char * text, int len,
+    struct gram * gram, int * last, int flags);
+
+/**
+ * releases every node allocated in the arena so far, keeping its memory
+ * for the following parses.
+ */
+void ast_arena_reset(struct ast_arena * arena);
+
+void free_ast_arena(struct ast_arena * arena);
+
 /**
  * this function dumps the ast as a kind of tree, adding 2 spaces
  * for every new indentation level, starting at indent.
@@ -101,6 +199,23 @@ struct gram * new_gram_string(void * user_data, const char * text);
 
 struct gram * new_gram_range(void * user_data, char from, char to);
 
+/**
+ * matches a single character whose bit is set in the 256-bit bitmap set
+ * (bit c % 8 of set[c / 8], for the unsigned value c of the character), or
+ * whose bit is not set if negate is non zero. As every gram, it never
+ * matches past the end of the text (e.g. the terminating '\0' of parse).
+ * set is copied.
+ */
+struct gram * new_gram_class(void * user_data, const unsigned char * set, int negate);
+
+/**
+ * same as new_gram_aster(user_data, new_gram_class(NULL, set, negate)) when
+ * min is 0, or new_gram_plus when it's 1, but the run of chars is scanned at
+ * once (several bytes per instruction when possible), and its node is a leaf.
+ * In general it fails if the run is shorter than min chars.
+ */
+struct gram * new_gram_span(void * user_data, const unsigned char * set, int negate, int min);
+
 struct gram * new_gram_int(void * user_data);
 
 struct gram * new_gram_opt(void * user_data, struct gram * child);
@@ -130,7 +245,8 @@ struct gram * new_gram_negla(void * user_data, struct gram * child);
 
 // @param matcher: If it matches, return the number of characters eaten,
 //    or -1 if it didn't match.
-//    "text" is the text being parsed.
+//    "text" is the text being parsed, it must not be read past
+//    gram_state_get_len(state) chars (it may not be NUL terminated).
 //    "cursor" is the index inside text where this matcher should look.
 //    "state"(last) if this matcher (or any "sub-matcher" if this applies)
 //    have consumed text at any point, this should be updated to the max
@@ -159,9 +275,243 @@ void gram_set_user_data(struct gram * gram, void * user_data);
 
 void * gram_get_user_data(struct gram * gram);
 
+/**
+ * sets what parses keep of the nodes of gram, as filter_ast would do with a
+ * filter returning it for them. Their subtrees are then filtered out as
+ * they're matched rather than copied afterwards: the nodes of DISCARD and
+ * LEAF grams aren't even built (unless memoizing, which keeps them for
+ * other matches; PARSE_ITERATIVE builds them and drops them at once). The
+ * root of the tree is never filtered. It's FILTER_AST_KEEP by default.
+ */
+void gram_set_filter(struct gram * gram, enum filter_ast_mode filter);
+
+enum filter_ast_mode gram_get_filter(struct gram * gram);
+
 void free_gram(struct gram * gram);
 
+/**
+ * computes the bytes every gram reachable from gram may start with (and
+ * whether it may match the empty string), and gives every alternation a
+ * table of the alternatives worth trying for each byte. Then alternatives
+ * that can't start with the byte at the cursor are skipped, keeping the
+ * order of choice and the results. Call it once the grammar is complete,
+ * and again after gram_set_child.
+ */
+void gram_analyze(struct gram * gram);
+
+/**
+ * returns a simplified copy of the grammar of gram, leaving it untouched.
+ * Only the grams without user_data nor filter are simplified (their nodes
+ * are purged anyway): nested sequences and choices are flattened, and the wrappers of
+ * a single gram removed; runs of strings in a sequence are merged into
+ * one, as are runs of single chars in a choice into a class, and repeated
+ * single chars into spans. The named grams are copied, so purge_ast gives
+ * the same trees (though last may differ when a merged string fails).
+ * on_copy, when not NULL, is called once for every gram reached with what
+ * replaces it, and created tells whether copy is new (then it's up to the
+ * caller to free it). Merged grams come with a NULL gram, and terminals
+ * are shared by both grammars. Call gram_analyze on the result afterwards.
+ */
+struct gram * gram_optimize(struct gram * gram,
+    void (*on_copy)(struct gram * gram, struct gram * copy, int created, void * privdata),
+    void * privdata);
+
+/**
+ * analyzes gram (see gram_analyze) and makes it, and every gram reachable
+ * from it, immutable: gram_set_child, gram_set_user_data and
+ * gram_set_memo_policy exit with an error on them, and parses don't update
+ * their memo stats (nor switch their AUTO policy) anymore. Then any number
+ * of threads may parse with it at the same time. It returns gram.
+ */
+struct gram * gram_freeze(struct gram * gram);
+
+/**
+ * finds a string every match of gram contains, for a quick search to skip
+ * the texts it can't match. The longest one found (up to size bytes) is
+ * copied to literal, and its length returned: 0 if none was found (e.g.
+ * for grammars made of classes). *anchored is set to 1 if every match
+ * starts with it, or 0 if it may be anywhere in the match.
+ */
+int gram_required_literal(struct gram * gram, char * literal, int size, int * anchored);
+
+struct gram_context;
+
+/**
+ * the buffers of a parse (its stack of nodes and memo table), kept for the
+ * following ones. A context must not be used by two threads at once, so
+ * every thread parsing a shared grammar should have its own.
+ */
+struct gram_context * new_gram_context(void);
+
+/**
+ * same as parse_arena_n and match_n_ex, with the buffers of ctx.
+ */
+struct ast * parse_context(struct gram_context * ctx, struct ast_arena * arena,
+    const char * text, int len, struct gram * gram, int * last, int flags);
+int match_context(struct gram_context * ctx, const char * text, int len,
+    struct gram * gram, int * last, int flags);
+
+/**
+ * returns 1 if the last parse (or match) with ctx failed because the text
+ * nests deeper than the engine goes (more than 4095 grams, or than memory
+ * holds with PARSE_ITERATIVE), or the grammar recursed to the left, rather
+ * than because it doesn't match; 0 otherwise.
+ */
+int gram_context_overflow(struct gram_context * ctx);
+
+void free_gram_context(struct gram_context * ctx);
+
+/**
+ * finds the leftmost match of gram in the len bytes at text, i.e. matches
+ * it (as match_context) at every offset until it succeeds, skipping the
+ * bytes it can't start with once it's analyzed (see gram_analyze). It
+ * returns the offset of the match and sets *match_len, or returns -1 if
+ * there is none. A match at an offset never sees the bytes before it, nor
+ * is anything memoized kept from one offset to the next. ctx may be NULL,
+ * then a context is created for the search.
+ */
+int search(struct gram_context * ctx, const char * text, int len, struct gram * gram,
+    int * match_len, int flags);
+
+/**
+ * same as search, but fn is called for every match, from left to right,
+ * going on after the end of the previous one (or the next byte, after an
+ * empty match). It returns the number of matches.
+ */
+int search_all(struct gram_context * ctx, const char * text, int len, struct gram * gram, int flags,
+    void (*fn)(int from, int len, void * privdata), void * privdata);
+
+/**
+ * same as parse_context, but rather than building the tree it calls enter
+ * and exit (either may be NULL) for every node with user_data, as they
+ * would be met walking the purged tree (see purge_ast), the children of a
+ * node between its enter and its exit (a root without user_data has none,
+ * so its children come one after the other). They're only called once the
+ * parse succeeded, so they never see the nodes of alternatives that
+ * failed. It returns the length of the match, or -1. Nothing is memoized
+ * (PARSE_PACKRAT and PARSE_MEMO are ignored). ctx may be NULL, then a
+ * context is created for the parse.
+ */
+int parse_events(struct gram_context * ctx, const char * text, int len, struct gram * gram,
+    int * last, int flags,
+    void (*enter)(void * user_data, int from, int len, void * privdata),
+    void (*exit)(void * user_data, int from, int len, void * privdata),
+    void * privdata);
+
+/**
+ * a node of a flat tree. Its children follow it, the first one right
+ * after it and every other one after the subtree of the previous one.
+ */
+struct ast_node {
+  unsigned rule; // the index of its user_data in the rules of the tree.
+  int from, len;
+  unsigned size; // the number of nodes of its subtree, itself included.
+};
+
+/**
+ * a tree as a single array of nodes in preorder (the root first), so the
+ * subtree of nodes[i] is nodes[i] to nodes[i + size - 1]. Nodes refer to
+ * their user_data by rule: rules[0] is always NULL, then every other
+ * user_data in the order of their first node.
+ */
+struct ast_flat {
+  struct ast_node * nodes;
+  unsigned count;
+  void ** rules;
+  unsigned rules_count;
+};
+
+/**
+ * same as parse_context, but the tree is returned flat (NULL if it didn't
+ * match). ctx may be NULL, then a context is created for the parse.
+ */
+struct ast_flat * parse_flat(struct gram_context * ctx, const char * text, int len,
+    struct gram * gram, int * last, int flags);
+
+/**
+ * the flat copy of the tree of ast (shared subtrees are copied every time).
+ */
+struct ast_flat * flatten_ast(struct ast * ast);
+
+/**
+ * the subtree of node as a tree of struct ast, to be freed with free_ast.
+ */
+struct ast * ast_flat_to_ast(const struct ast_flat * flat, unsigned node);
+
+void free_ast_flat(struct ast_flat * flat);
+
+/**
+ * walks the nodes of a flat tree, e.g.:
+ *   struct ast_iter it;
+ *   const struct ast_node * child;
+ *   ast_iter_children(&it, flat, node);
+ *   while ((child = ast_iter_next(&it)))
+ *     ...
+ */
+struct ast_iter {
+  const struct ast_flat * flat;
+  unsigned next, end;
+  int children;
+};
+
+// the children of node, in order.
+void ast_iter_children(struct ast_iter * it, const struct ast_flat * flat, unsigned node);
+// the subtree of node in preorder, node included.
+void ast_iter_subtree(struct ast_iter * it, const struct ast_flat * flat, unsigned node);
+// the next node, or NULL when there are no more.
+const struct ast_node * ast_iter_next(struct ast_iter * it);
+
+/**
+ * a position in a flat tree that moves to the first child, next sibling
+ * or parent of its node, remembering the way back up.
+ */
+struct ast_cursor {
+  const struct ast_flat * flat;
+  unsigned node;
+  unsigned * parents; // the ancestors of node, the root first.
+  int depth, size;
+};
+
+// starts at the root. The cursor is released with ast_cursor_release.
+void ast_cursor_init(struct ast_cursor * cursor, const struct ast_flat * flat);
+void ast_cursor_release(struct ast_cursor * cursor);
+
+// they return 0 (and the cursor stays) if there is no such node, else 1.
+int ast_cursor_first_child(struct ast_cursor * cursor);
+int ast_cursor_next_sibling(struct ast_cursor * cursor);
+int ast_cursor_parent(struct ast_cursor * cursor);
+
+enum gram_memo_policy {
+  GRAM_MEMO_AUTO,   // decided by the engine with PARSE_MEMO (default).
+  GRAM_MEMO_ALWAYS, // memoized whenever memoization is enabled.
+  GRAM_MEMO_NEVER,  // only memoized when parsing with PARSE_PACKRAT.
+};
+
+struct gram_memo_stats {
+  enum gram_memo_policy policy;
+  unsigned long hits;   // results taken from the memo table.
+  unsigned long misses; // results computed and stored in the memo table.
+};
+
+/**
+ * the counters are accumulated over every memoizing parse since the gram
+ * was created (or since its last gram_set_memo_policy). With PARSE_MEMO,
+ * an AUTO gram is switched to NEVER once it has missed often enough and
+ * its hits stay below 1/64 of the misses.
+ */
+void gram_get_memo_stats(struct gram * gram, struct gram_memo_stats * stats);
+
+/**
+ * sets the policy and resets the counters of the gram.
+ */
+void gram_set_memo_policy(struct gram * gram, enum gram_memo_policy policy);
+
 void gram_state_update_last(struct gram_state * state, int last);
 int gram_state_get_last(struct gram_state * state);
 
+/**
+ * the length of the text being parsed.
+ */
+int gram_state_get_len(struct gram_state * state);
+
 #endif
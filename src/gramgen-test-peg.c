@@ -0,0 +1,2028 @@
+// generated by gramgen, do not edit.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gram.h"
+#include "gramgen-test-peg.h"
+
+const char gramgen_test_main_name[] = "main"; // KEEP
+const char gramgen_test_bs_name[] = "bs"; // DISCARD
+const char gramgen_test_space_name[] = "space"; // KEEP
+const char gramgen_test_comment_name[] = "comment"; // KEEP
+const char gramgen_test_statement_name[] = "statement"; // KEEP
+const char gramgen_test_select_statement_name[] = "select_statement"; // KEEP
+const char gramgen_test_columns_name[] = "columns"; // ONLY_KEEP_CHILDREN
+const char gramgen_test_insert_statement_name[] = "insert_statement"; // KEEP
+const char gramgen_test_commit_statement_name[] = "commit_statement"; // KEEP
+const char gramgen_test_select_kw_name[] = "select_kw"; // KEEP
+const char gramgen_test_from_kw_name[] = "from_kw"; // KEEP
+const char gramgen_test_where_kw_name[] = "where_kw"; // KEEP
+const char gramgen_test_insert_kw_name[] = "insert_kw"; // KEEP
+const char gramgen_test_into_kw_name[] = "into_kw"; // KEEP
+const char gramgen_test_values_kw_name[] = "values_kw"; // KEEP
+const char gramgen_test_commit_kw_name[] = "commit_kw"; // KEEP
+const char gramgen_test_work_kw_name[] = "work_kw"; // KEEP
+const char gramgen_test_and_kw_name[] = "and_kw"; // KEEP
+const char gramgen_test_or_kw_name[] = "or_kw"; // KEEP
+const char gramgen_test_expr_name[] = "expr"; // KEEP
+const char gramgen_test_term_name[] = "term"; // KEEP
+const char gramgen_test_number_name[] = "number"; // KEEP
+const char gramgen_test_quotes_name[] = "quotes"; // LEAF
+const char gramgen_test_tbl_name_name[] = "tbl_name"; // KEEP
+const char gramgen_test_col_name_name[] = "col_name"; // KEEP
+const char gramgen_test_identifier_name[] = "identifier"; // KEEP
+const char gramgen_test_keyword_name[] = "keyword"; // KEEP
+const char gramgen_test_ident_char_name[] = "ident_char"; // KEEP
+
+// deeper than this the C stack may not hold, and the parse fails.
+#ifndef PEG_MAX_DEPTH
+#define PEG_MAX_DEPTH 0xfff
+#endif
+
+struct peg {
+  const char * text;
+  int len; // the text ends here, whatever its bytes are.
+  int last;
+  int depth, max_depth;
+  bool overflow; // nested deeper than max_depth: the parse fails.
+  bool build;
+  struct ast ** nodes;
+  int count, size;
+};
+
+// rules must give up (failing) when it returns false.
+static inline bool peg_enter(struct peg * p) {
+  if (++p->depth <= p->max_depth)
+    return true;
+  p->depth--;
+  p->overflow = true;
+  // every rule fails from now on, so the parse unwinds quickly.
+  p->max_depth = 0;
+  return false;
+}
+
+static inline int peg_match(struct peg * p, int cursor, int len) {
+  if (cursor + len > p->last)
+    p->last = cursor + len;
+  return len;
+}
+
+static inline int peg_dot(struct peg * p, int cursor) {
+  return cursor < p->len ? peg_match(p, cursor, 1) : -1;
+}
+
+static inline int peg_char(struct peg * p, int cursor, char c) {
+  return cursor < p->len && p->text[cursor] == c ? peg_match(p, cursor, 1) : -1;
+}
+
+static inline int peg_string(struct peg * p, int cursor, const char * s, int len) {
+  return len <= p->len - cursor && !memcmp(p->text + cursor, s, len)
+    ? peg_match(p, cursor, len) : -1;
+}
+
+static inline int peg_range(struct peg * p, int cursor, char from, char to) {
+  if (cursor >= p->len)
+    return -1;
+  char c = p->text[cursor];
+  return from <= c && c <= to ? peg_match(p, cursor, 1) : -1;
+}
+
+static inline int peg_class(struct peg * p, int cursor, const unsigned char * bits) {
+  if (cursor >= p->len)
+    return -1;
+  unsigned char c = p->text[cursor];
+  return bits[c >> 3] >> (c & 7) & 1 ? peg_match(p, cursor, 1) : -1;
+}
+
+static inline int peg_span(struct peg * p, int cursor, const unsigned char * bits, int min) {
+  int len = 0;
+  unsigned char c;
+  while (cursor + len < p->len && (c = p->text[cursor + len], bits[c >> 3] >> (c & 7) & 1))
+    len++;
+  if (len)
+    peg_match(p, cursor, len);
+  return len >= min ? len : -1;
+}
+
+static inline void peg_push(struct peg * p, struct ast * ast) {
+  if (p->count == p->size) {
+    p->size = p->size ? 2 * p->size : 64;
+    p->nodes = realloc(p->nodes, sizeof (struct ast *) * p->size);
+  }
+  p->nodes[p->count++] = ast;
+}
+
+// replaces the nodes pushed since mark by a node having them as children.
+static inline void peg_reduce(struct peg * p, int mark, const char * name, int from, int len) {
+  int n = p->count - mark;
+  struct ast * ast = malloc(sizeof (struct ast) + sizeof (struct ast *) * (n + 1));
+  ast->user_data = (void *)name;
+  ast->from = from;
+  ast->len = len;
+  ast->refs = 1;
+  if (n) // nodes may still be NULL.
+    memcpy(ast->children, p->nodes + mark, sizeof (struct ast *) * n);
+  ast->children[n] = NULL;
+  p->count = mark;
+  peg_push(p, ast);
+}
+
+static inline void peg_drop(struct peg * p, int mark) {
+  while (p->count > mark)
+    free_ast(p->nodes[--p->count]);
+}
+
+static inline void peg_epsilon(struct peg * p, int mark) {
+  fprintf(stderr, "WARNING: repetition parsing subgrammar with epsilon transitions. E.g: ('a'?)*\n"
+      "\t(as a fallback) this match will fail, but you MUST fix the grammar.");
+  peg_drop(p, mark);
+}
+
+static int rule_main(struct peg * p, int c);
+static int rule_bs(struct peg * p, int c);
+static int rule_space(struct peg * p, int c);
+static int rule_comment(struct peg * p, int c);
+static int rule_statement(struct peg * p, int c);
+static int rule_select_statement(struct peg * p, int c);
+static int rule_columns(struct peg * p, int c);
+static int rule_insert_statement(struct peg * p, int c);
+static int rule_commit_statement(struct peg * p, int c);
+static int rule_select_kw(struct peg * p, int c);
+static int rule_from_kw(struct peg * p, int c);
+static int rule_where_kw(struct peg * p, int c);
+static int rule_insert_kw(struct peg * p, int c);
+static int rule_into_kw(struct peg * p, int c);
+static int rule_values_kw(struct peg * p, int c);
+static int rule_commit_kw(struct peg * p, int c);
+static int rule_work_kw(struct peg * p, int c);
+static int rule_expr(struct peg * p, int c);
+static int rule_term(struct peg * p, int c);
+static int rule_number(struct peg * p, int c);
+static int rule_quotes(struct peg * p, int c);
+static int rule_tbl_name(struct peg * p, int c);
+static int rule_col_name(struct peg * p, int c);
+static int rule_identifier(struct peg * p, int c);
+static int rule_keyword(struct peg * p, int c);
+static int rule_ident_char(struct peg * p, int c);
+
+static const unsigned char class0[32] = {
+  0x00, 0x26, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class1[32] = {
+  0xff, 0xfb, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const unsigned char class2[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class3[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class4[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class5[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class6[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class7[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class8[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x40, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class9[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class10[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class11[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class12[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class13[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class14[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class15[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class16[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class17[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class18[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class19[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class20[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class21[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class22[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class23[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class24[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class25[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class26[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class27[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class28[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class29[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class30[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x20, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class31[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class32[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class33[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class34[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class35[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class36[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x20, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class37[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class38[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class39[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class40[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class41[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class42[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class43[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x70,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class44[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x03,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char class45[32] = {
+  0xff, 0xff, 0xff, 0xff, 0x7f, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const unsigned char class46[32] = {
+  0xff, 0xff, 0xff, 0xff, 0xfb, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const unsigned char class47[32] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const unsigned char class48[32] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x03,
+  0xfe, 0xff, 0xff, 0x87, 0xfe, 0xff, 0xff, 0x07,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static int rule_main(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c0 = c, m0 = p->count;
+    do {
+      res = rule_bs(p, c0);
+      if (res < 0)
+        break;
+      c0 += res;
+      {
+        int c1 = c0, r1, n1 = 0, m1 = p->count;
+        for (;;) {
+          {
+            int c2 = c1, m2 = p->count;
+            do {
+              r1 = rule_statement(p, c2);
+              if (r1 < 0)
+                break;
+              c2 += r1;
+              r1 = rule_bs(p, c2);
+              if (r1 < 0)
+                break;
+              c2 += r1;
+              do {
+                r1 = peg_char(p, c2, ';');
+                if (r1 >= 0)
+                  break;
+                {
+                  int r3, l3 = p->last, m3 = p->count;
+                  r3 = peg_dot(p, c2);
+                  p->last = l3;
+                  r1 = r3 < 0 ? 0 : -1;
+                  if (r3 >= 0)
+                    peg_drop(p, m3);
+                }
+              } while (0);
+              if (r1 < 0)
+                break;
+              c2 += r1;
+              r1 = rule_bs(p, c2);
+              if (r1 < 0)
+                break;
+              c2 += r1;
+              r1 = c2 - c1;
+            } while (0);
+            if (r1 < 0)
+              peg_drop(p, m2);
+          }
+          if (r1 < 0)
+            break;
+          if (r1 == 0) {
+            peg_epsilon(p, m1);
+            c1 = -1;
+            break;
+          }
+          c1 += r1;
+          n1++;
+        }
+        res = c1 < 0 ? -1 : c1 - c0;
+      }
+      if (res < 0)
+        break;
+      c0 += res;
+      {
+        int r4, l4 = p->last, m4 = p->count;
+        r4 = peg_dot(p, c0);
+        p->last = l4;
+        res = r4 < 0 ? 0 : -1;
+        if (r4 >= 0)
+          peg_drop(p, m4);
+      }
+      if (res < 0)
+        break;
+      c0 += res;
+      res = c0 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m0);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_main_name, c, res);
+  }
+  return res;
+}
+
+static int rule_bs(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c5 = c, r5, n5 = 0, m5 = p->count;
+    for (;;) {
+      r5 = rule_space(p, c5);
+      if (r5 < 0)
+        break;
+      if (r5 == 0) {
+        peg_epsilon(p, m5);
+        c5 = -1;
+        break;
+      }
+      c5 += r5;
+      n5++;
+    }
+    res = c5 < 0 ? -1 : c5 - c;
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_drop(p, m);
+  }
+  return res;
+}
+
+static int rule_space(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    res = peg_class(p, c, class0);
+    if (res >= 0)
+      break;
+    res = rule_comment(p, c);
+  } while (0);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_space_name, c, res);
+  }
+  return res;
+}
+
+static int rule_comment(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    {
+      int c6 = c, m6 = p->count;
+      do {
+        res = peg_string(p, c6, "--", 2);
+        if (res < 0)
+          break;
+        c6 += res;
+        res = peg_span(p, c6, class1, 0);
+        if (res < 0)
+          break;
+        c6 += res;
+        do {
+          res = peg_char(p, c6, '\x0a');
+          if (res >= 0)
+            break;
+          {
+            int r7, l7 = p->last, m7 = p->count;
+            r7 = peg_dot(p, c6);
+            p->last = l7;
+            res = r7 < 0 ? 0 : -1;
+            if (r7 >= 0)
+              peg_drop(p, m7);
+          }
+        } while (0);
+        if (res < 0)
+          break;
+        c6 += res;
+        res = c6 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m6);
+    }
+    if (res >= 0)
+      break;
+    {
+      int c8 = c, m8 = p->count;
+      do {
+        res = peg_string(p, c8, "/*", 2);
+        if (res < 0)
+          break;
+        c8 += res;
+        {
+          int c9 = c8, r9, n9 = 0, m9 = p->count;
+          for (;;) {
+            {
+              int c10 = c9, m10 = p->count;
+              do {
+                {
+                  int r11, l11 = p->last, m11 = p->count;
+                  r11 = peg_string(p, c10, "*/", 2);
+                  p->last = l11;
+                  r9 = r11 < 0 ? 0 : -1;
+                  if (r11 >= 0)
+                    peg_drop(p, m11);
+                }
+                if (r9 < 0)
+                  break;
+                c10 += r9;
+                r9 = peg_dot(p, c10);
+                if (r9 < 0)
+                  break;
+                c10 += r9;
+                r9 = c10 - c9;
+              } while (0);
+              if (r9 < 0)
+                peg_drop(p, m10);
+            }
+            if (r9 < 0)
+              break;
+            if (r9 == 0) {
+              peg_epsilon(p, m9);
+              c9 = -1;
+              break;
+            }
+            c9 += r9;
+            n9++;
+          }
+          res = c9 < 0 ? -1 : c9 - c8;
+        }
+        if (res < 0)
+          break;
+        c8 += res;
+        res = peg_string(p, c8, "*/", 2);
+        if (res < 0)
+          break;
+        c8 += res;
+        res = c8 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m8);
+    }
+  } while (0);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_comment_name, c, res);
+  }
+  return res;
+}
+
+static int rule_statement(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    res = rule_select_statement(p, c);
+    if (res >= 0)
+      break;
+    res = rule_insert_statement(p, c);
+    if (res >= 0)
+      break;
+    res = rule_commit_statement(p, c);
+  } while (0);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_statement_name, c, res);
+  }
+  return res;
+}
+
+static int rule_select_statement(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c12 = c, m12 = p->count;
+    do {
+      res = rule_select_kw(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      res = rule_bs(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      res = rule_columns(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      res = rule_bs(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      res = rule_from_kw(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      res = rule_bs(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      res = rule_tbl_name(p, c12);
+      if (res < 0)
+        break;
+      c12 += res;
+      {
+        int c13 = c12, m13 = p->count;
+        do {
+          res = rule_bs(p, c13);
+          if (res < 0)
+            break;
+          c13 += res;
+          res = rule_where_kw(p, c13);
+          if (res < 0)
+            break;
+          c13 += res;
+          res = rule_bs(p, c13);
+          if (res < 0)
+            break;
+          c13 += res;
+          res = rule_expr(p, c13);
+          if (res < 0)
+            break;
+          c13 += res;
+          res = c13 - c12;
+        } while (0);
+        if (res < 0)
+          peg_drop(p, m13);
+      }
+      if (res < 0)
+        res = 0;
+      if (res < 0)
+        break;
+      c12 += res;
+      res = c12 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m12);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_select_statement_name, c, res);
+  }
+  return res;
+}
+
+static int rule_columns(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    res = peg_char(p, c, '*');
+    if (res >= 0)
+      break;
+    {
+      int c14 = c, m14 = p->count;
+      do {
+        res = rule_col_name(p, c14);
+        if (res < 0)
+          break;
+        c14 += res;
+        res = rule_bs(p, c14);
+        if (res < 0)
+          break;
+        c14 += res;
+        {
+          int c15 = c14, r15, n15 = 0, m15 = p->count;
+          for (;;) {
+            {
+              int c16 = c15, m16 = p->count;
+              do {
+                r15 = peg_char(p, c16, ',');
+                if (r15 < 0)
+                  break;
+                c16 += r15;
+                r15 = rule_bs(p, c16);
+                if (r15 < 0)
+                  break;
+                c16 += r15;
+                r15 = rule_col_name(p, c16);
+                if (r15 < 0)
+                  break;
+                c16 += r15;
+                r15 = rule_bs(p, c16);
+                if (r15 < 0)
+                  break;
+                c16 += r15;
+                r15 = c16 - c15;
+              } while (0);
+              if (r15 < 0)
+                peg_drop(p, m16);
+            }
+            if (r15 < 0)
+              break;
+            if (r15 == 0) {
+              peg_epsilon(p, m15);
+              c15 = -1;
+              break;
+            }
+            c15 += r15;
+            n15++;
+          }
+          res = c15 < 0 ? -1 : c15 - c14;
+        }
+        if (res < 0)
+          break;
+        c14 += res;
+        res = c14 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m14);
+    }
+  } while (0);
+  p->depth--;
+  (void)m;
+  return res;
+}
+
+static int rule_insert_statement(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c17 = c, m17 = p->count;
+    do {
+      res = rule_insert_kw(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_bs(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      {
+        int c18 = c17, m18 = p->count;
+        do {
+          res = rule_into_kw(p, c18);
+          if (res < 0)
+            break;
+          c18 += res;
+          res = rule_bs(p, c18);
+          if (res < 0)
+            break;
+          c18 += res;
+          res = c18 - c17;
+        } while (0);
+        if (res < 0)
+          peg_drop(p, m18);
+      }
+      if (res < 0)
+        res = 0;
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_tbl_name(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_bs(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      {
+        int c19 = c17, m19 = p->count;
+        do {
+          res = peg_char(p, c19, '(');
+          if (res < 0)
+            break;
+          c19 += res;
+          res = rule_bs(p, c19);
+          if (res < 0)
+            break;
+          c19 += res;
+          res = rule_col_name(p, c19);
+          if (res < 0)
+            break;
+          c19 += res;
+          res = rule_bs(p, c19);
+          if (res < 0)
+            break;
+          c19 += res;
+          {
+            int c20 = c19, r20, n20 = 0, m20 = p->count;
+            for (;;) {
+              {
+                int c21 = c20, m21 = p->count;
+                do {
+                  r20 = peg_char(p, c21, ',');
+                  if (r20 < 0)
+                    break;
+                  c21 += r20;
+                  r20 = rule_bs(p, c21);
+                  if (r20 < 0)
+                    break;
+                  c21 += r20;
+                  r20 = rule_col_name(p, c21);
+                  if (r20 < 0)
+                    break;
+                  c21 += r20;
+                  r20 = rule_bs(p, c21);
+                  if (r20 < 0)
+                    break;
+                  c21 += r20;
+                  r20 = c21 - c20;
+                } while (0);
+                if (r20 < 0)
+                  peg_drop(p, m21);
+              }
+              if (r20 < 0)
+                break;
+              if (r20 == 0) {
+                peg_epsilon(p, m20);
+                c20 = -1;
+                break;
+              }
+              c20 += r20;
+              n20++;
+            }
+            res = c20 < 0 ? -1 : c20 - c19;
+          }
+          if (res < 0)
+            break;
+          c19 += res;
+          res = peg_char(p, c19, ')');
+          if (res < 0)
+            break;
+          c19 += res;
+          res = rule_bs(p, c19);
+          if (res < 0)
+            break;
+          c19 += res;
+          res = c19 - c17;
+        } while (0);
+        if (res < 0)
+          peg_drop(p, m19);
+      }
+      if (res < 0)
+        res = 0;
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_values_kw(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_bs(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      res = peg_char(p, c17, '(');
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_bs(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_expr(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      res = rule_bs(p, c17);
+      if (res < 0)
+        break;
+      c17 += res;
+      {
+        int c22 = c17, r22, n22 = 0, m22 = p->count;
+        for (;;) {
+          {
+            int c23 = c22, m23 = p->count;
+            do {
+              r22 = peg_char(p, c23, ',');
+              if (r22 < 0)
+                break;
+              c23 += r22;
+              r22 = rule_bs(p, c23);
+              if (r22 < 0)
+                break;
+              c23 += r22;
+              r22 = rule_expr(p, c23);
+              if (r22 < 0)
+                break;
+              c23 += r22;
+              r22 = rule_bs(p, c23);
+              if (r22 < 0)
+                break;
+              c23 += r22;
+              r22 = c23 - c22;
+            } while (0);
+            if (r22 < 0)
+              peg_drop(p, m23);
+          }
+          if (r22 < 0)
+            break;
+          if (r22 == 0) {
+            peg_epsilon(p, m22);
+            c22 = -1;
+            break;
+          }
+          c22 += r22;
+          n22++;
+        }
+        res = c22 < 0 ? -1 : c22 - c17;
+      }
+      if (res < 0)
+        break;
+      c17 += res;
+      res = peg_char(p, c17, ')');
+      if (res < 0)
+        break;
+      c17 += res;
+      res = c17 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m17);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_insert_statement_name, c, res);
+  }
+  return res;
+}
+
+static int rule_commit_statement(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c24 = c, m24 = p->count;
+    do {
+      res = rule_commit_kw(p, c24);
+      if (res < 0)
+        break;
+      c24 += res;
+      {
+        int c25 = c24, m25 = p->count;
+        do {
+          res = rule_bs(p, c25);
+          if (res < 0)
+            break;
+          c25 += res;
+          res = rule_work_kw(p, c25);
+          if (res < 0)
+            break;
+          c25 += res;
+          res = c25 - c24;
+        } while (0);
+        if (res < 0)
+          peg_drop(p, m25);
+      }
+      if (res < 0)
+        res = 0;
+      if (res < 0)
+        break;
+      c24 += res;
+      res = c24 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m24);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_commit_statement_name, c, res);
+  }
+  return res;
+}
+
+static int rule_select_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c26 = c, m26 = p->count;
+    do {
+      res = peg_class(p, c26, class2);
+      if (res < 0)
+        break;
+      c26 += res;
+      res = peg_class(p, c26, class3);
+      if (res < 0)
+        break;
+      c26 += res;
+      res = peg_class(p, c26, class4);
+      if (res < 0)
+        break;
+      c26 += res;
+      res = peg_class(p, c26, class5);
+      if (res < 0)
+        break;
+      c26 += res;
+      res = peg_class(p, c26, class6);
+      if (res < 0)
+        break;
+      c26 += res;
+      res = peg_class(p, c26, class7);
+      if (res < 0)
+        break;
+      c26 += res;
+      {
+        int r27, l27 = p->last, m27 = p->count;
+        r27 = rule_ident_char(p, c26);
+        p->last = l27;
+        res = r27 < 0 ? 0 : -1;
+        if (r27 >= 0)
+          peg_drop(p, m27);
+      }
+      if (res < 0)
+        break;
+      c26 += res;
+      res = c26 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m26);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_select_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_from_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c28 = c, m28 = p->count;
+    do {
+      res = peg_class(p, c28, class8);
+      if (res < 0)
+        break;
+      c28 += res;
+      res = peg_class(p, c28, class9);
+      if (res < 0)
+        break;
+      c28 += res;
+      res = peg_class(p, c28, class10);
+      if (res < 0)
+        break;
+      c28 += res;
+      res = peg_class(p, c28, class11);
+      if (res < 0)
+        break;
+      c28 += res;
+      {
+        int r29, l29 = p->last, m29 = p->count;
+        r29 = rule_ident_char(p, c28);
+        p->last = l29;
+        res = r29 < 0 ? 0 : -1;
+        if (r29 >= 0)
+          peg_drop(p, m29);
+      }
+      if (res < 0)
+        break;
+      c28 += res;
+      res = c28 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m28);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_from_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_where_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c30 = c, m30 = p->count;
+    do {
+      res = peg_class(p, c30, class12);
+      if (res < 0)
+        break;
+      c30 += res;
+      res = peg_class(p, c30, class13);
+      if (res < 0)
+        break;
+      c30 += res;
+      res = peg_class(p, c30, class14);
+      if (res < 0)
+        break;
+      c30 += res;
+      res = peg_class(p, c30, class15);
+      if (res < 0)
+        break;
+      c30 += res;
+      res = peg_class(p, c30, class16);
+      if (res < 0)
+        break;
+      c30 += res;
+      {
+        int r31, l31 = p->last, m31 = p->count;
+        r31 = rule_ident_char(p, c30);
+        p->last = l31;
+        res = r31 < 0 ? 0 : -1;
+        if (r31 >= 0)
+          peg_drop(p, m31);
+      }
+      if (res < 0)
+        break;
+      c30 += res;
+      res = c30 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m30);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_where_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_insert_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c32 = c, m32 = p->count;
+    do {
+      res = peg_class(p, c32, class17);
+      if (res < 0)
+        break;
+      c32 += res;
+      res = peg_class(p, c32, class18);
+      if (res < 0)
+        break;
+      c32 += res;
+      res = peg_class(p, c32, class19);
+      if (res < 0)
+        break;
+      c32 += res;
+      res = peg_class(p, c32, class20);
+      if (res < 0)
+        break;
+      c32 += res;
+      res = peg_class(p, c32, class21);
+      if (res < 0)
+        break;
+      c32 += res;
+      res = peg_class(p, c32, class22);
+      if (res < 0)
+        break;
+      c32 += res;
+      {
+        int r33, l33 = p->last, m33 = p->count;
+        r33 = rule_ident_char(p, c32);
+        p->last = l33;
+        res = r33 < 0 ? 0 : -1;
+        if (r33 >= 0)
+          peg_drop(p, m33);
+      }
+      if (res < 0)
+        break;
+      c32 += res;
+      res = c32 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m32);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_insert_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_into_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c34 = c, m34 = p->count;
+    do {
+      res = peg_class(p, c34, class23);
+      if (res < 0)
+        break;
+      c34 += res;
+      res = peg_class(p, c34, class24);
+      if (res < 0)
+        break;
+      c34 += res;
+      res = peg_class(p, c34, class25);
+      if (res < 0)
+        break;
+      c34 += res;
+      res = peg_class(p, c34, class26);
+      if (res < 0)
+        break;
+      c34 += res;
+      {
+        int r35, l35 = p->last, m35 = p->count;
+        r35 = rule_ident_char(p, c34);
+        p->last = l35;
+        res = r35 < 0 ? 0 : -1;
+        if (r35 >= 0)
+          peg_drop(p, m35);
+      }
+      if (res < 0)
+        break;
+      c34 += res;
+      res = c34 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m34);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_into_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_values_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c36 = c, m36 = p->count;
+    do {
+      res = peg_class(p, c36, class27);
+      if (res < 0)
+        break;
+      c36 += res;
+      res = peg_class(p, c36, class28);
+      if (res < 0)
+        break;
+      c36 += res;
+      res = peg_class(p, c36, class29);
+      if (res < 0)
+        break;
+      c36 += res;
+      res = peg_class(p, c36, class30);
+      if (res < 0)
+        break;
+      c36 += res;
+      res = peg_class(p, c36, class31);
+      if (res < 0)
+        break;
+      c36 += res;
+      res = peg_class(p, c36, class32);
+      if (res < 0)
+        break;
+      c36 += res;
+      {
+        int r37, l37 = p->last, m37 = p->count;
+        r37 = rule_ident_char(p, c36);
+        p->last = l37;
+        res = r37 < 0 ? 0 : -1;
+        if (r37 >= 0)
+          peg_drop(p, m37);
+      }
+      if (res < 0)
+        break;
+      c36 += res;
+      res = c36 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m36);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_values_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_commit_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c38 = c, m38 = p->count;
+    do {
+      res = peg_class(p, c38, class33);
+      if (res < 0)
+        break;
+      c38 += res;
+      res = peg_class(p, c38, class34);
+      if (res < 0)
+        break;
+      c38 += res;
+      res = peg_class(p, c38, class35);
+      if (res < 0)
+        break;
+      c38 += res;
+      res = peg_class(p, c38, class36);
+      if (res < 0)
+        break;
+      c38 += res;
+      res = peg_class(p, c38, class37);
+      if (res < 0)
+        break;
+      c38 += res;
+      res = peg_class(p, c38, class38);
+      if (res < 0)
+        break;
+      c38 += res;
+      {
+        int r39, l39 = p->last, m39 = p->count;
+        r39 = rule_ident_char(p, c38);
+        p->last = l39;
+        res = r39 < 0 ? 0 : -1;
+        if (r39 >= 0)
+          peg_drop(p, m39);
+      }
+      if (res < 0)
+        break;
+      c38 += res;
+      res = c38 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m38);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_commit_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_work_kw(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c40 = c, m40 = p->count;
+    do {
+      res = peg_class(p, c40, class39);
+      if (res < 0)
+        break;
+      c40 += res;
+      res = peg_class(p, c40, class40);
+      if (res < 0)
+        break;
+      c40 += res;
+      res = peg_class(p, c40, class41);
+      if (res < 0)
+        break;
+      c40 += res;
+      res = peg_class(p, c40, class42);
+      if (res < 0)
+        break;
+      c40 += res;
+      {
+        int r41, l41 = p->last, m41 = p->count;
+        r41 = rule_ident_char(p, c40);
+        p->last = l41;
+        res = r41 < 0 ? 0 : -1;
+        if (r41 >= 0)
+          peg_drop(p, m41);
+      }
+      if (res < 0)
+        break;
+      c40 += res;
+      res = c40 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m40);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_work_kw_name, c, res);
+  }
+  return res;
+}
+
+static int rule_expr(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c42 = c, m42 = p->count;
+    do {
+      res = rule_term(p, c42);
+      if (res < 0)
+        break;
+      c42 += res;
+      {
+        int c43 = c42, r43, n43 = 0, m43 = p->count;
+        for (;;) {
+          {
+            int c44 = c43, m44 = p->count;
+            do {
+              r43 = rule_bs(p, c44);
+              if (r43 < 0)
+                break;
+              c44 += r43;
+              do {
+                r43 = peg_string(p, c44, "<>", 2);
+                if (r43 >= 0)
+                  break;
+                r43 = peg_class(p, c44, class43);
+              } while (0);
+              if (r43 < 0)
+                break;
+              c44 += r43;
+              r43 = rule_bs(p, c44);
+              if (r43 < 0)
+                break;
+              c44 += r43;
+              r43 = rule_term(p, c44);
+              if (r43 < 0)
+                break;
+              c44 += r43;
+              r43 = c44 - c43;
+            } while (0);
+            if (r43 < 0)
+              peg_drop(p, m44);
+          }
+          if (r43 < 0)
+            break;
+          if (r43 == 0) {
+            peg_epsilon(p, m43);
+            c43 = -1;
+            break;
+          }
+          c43 += r43;
+          n43++;
+        }
+        res = c43 < 0 ? -1 : c43 - c42;
+      }
+      if (res < 0)
+        break;
+      c42 += res;
+      res = c42 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m42);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_expr_name, c, res);
+  }
+  return res;
+}
+
+static int rule_term(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    res = rule_number(p, c);
+    if (res >= 0)
+      break;
+    res = rule_quotes(p, c);
+    if (res >= 0)
+      break;
+    res = rule_col_name(p, c);
+    if (res >= 0)
+      break;
+    {
+      int c45 = c, m45 = p->count;
+      do {
+        res = peg_char(p, c45, '(');
+        if (res < 0)
+          break;
+        c45 += res;
+        res = rule_bs(p, c45);
+        if (res < 0)
+          break;
+        c45 += res;
+        res = rule_expr(p, c45);
+        if (res < 0)
+          break;
+        c45 += res;
+        res = rule_bs(p, c45);
+        if (res < 0)
+          break;
+        c45 += res;
+        res = peg_char(p, c45, ')');
+        if (res < 0)
+          break;
+        c45 += res;
+        res = c45 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m45);
+    }
+  } while (0);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_term_name, c, res);
+  }
+  return res;
+}
+
+static int rule_number(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c46 = c, m46 = p->count;
+    do {
+      res = peg_char(p, c46, '-');
+      if (res < 0)
+        res = 0;
+      if (res < 0)
+        break;
+      c46 += res;
+      res = peg_span(p, c46, class44, 1);
+      if (res < 0)
+        break;
+      c46 += res;
+      res = c46 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m46);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_number_name, c, res);
+  }
+  return res;
+}
+
+static int rule_quotes(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    {
+      int c47 = c, m47 = p->count;
+      do {
+        res = peg_char(p, c47, '\'');
+        if (res < 0)
+          break;
+        c47 += res;
+        {
+          int c48 = c47, r48, n48 = 0, m48 = p->count;
+          for (;;) {
+            do {
+              r48 = peg_string(p, c48, "''", 2);
+              if (r48 >= 0)
+                break;
+              r48 = peg_class(p, c48, class45);
+            } while (0);
+            if (r48 < 0)
+              break;
+            if (r48 == 0) {
+              peg_epsilon(p, m48);
+              c48 = -1;
+              break;
+            }
+            c48 += r48;
+            n48++;
+          }
+          res = c48 < 0 ? -1 : c48 - c47;
+        }
+        if (res < 0)
+          break;
+        c47 += res;
+        res = peg_char(p, c47, '\'');
+        if (res < 0)
+          break;
+        c47 += res;
+        res = c47 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m47);
+    }
+    if (res >= 0)
+      break;
+    {
+      int c49 = c, m49 = p->count;
+      do {
+        res = peg_char(p, c49, '"');
+        if (res < 0)
+          break;
+        c49 += res;
+        {
+          int c50 = c49, r50, n50 = 0, m50 = p->count;
+          for (;;) {
+            do {
+              r50 = peg_string(p, c50, "\"\"", 2);
+              if (r50 >= 0)
+                break;
+              r50 = peg_class(p, c50, class46);
+            } while (0);
+            if (r50 < 0)
+              break;
+            if (r50 == 0) {
+              peg_epsilon(p, m50);
+              c50 = -1;
+              break;
+            }
+            c50 += r50;
+            n50++;
+          }
+          res = c50 < 0 ? -1 : c50 - c49;
+        }
+        if (res < 0)
+          break;
+        c49 += res;
+        res = peg_char(p, c49, '"');
+        if (res < 0)
+          break;
+        c49 += res;
+        res = c49 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m49);
+    }
+  } while (0);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_drop(p, m);
+    peg_reduce(p, m, gramgen_test_quotes_name, c, res);
+  }
+  return res;
+}
+
+static int rule_tbl_name(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  res = rule_identifier(p, c);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_tbl_name_name, c, res);
+  }
+  return res;
+}
+
+static int rule_col_name(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  res = rule_identifier(p, c);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_col_name_name, c, res);
+  }
+  return res;
+}
+
+static int rule_identifier(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  do {
+    {
+      int c51 = c, m51 = p->count;
+      do {
+        {
+          int r52, l52 = p->last, m52 = p->count;
+          r52 = rule_keyword(p, c51);
+          p->last = l52;
+          res = r52 < 0 ? 0 : -1;
+          if (r52 >= 0)
+            peg_drop(p, m52);
+        }
+        if (res < 0)
+          break;
+        c51 += res;
+        {
+          int c53 = c51, r53, n53 = 0, m53 = p->count;
+          for (;;) {
+            r53 = rule_ident_char(p, c53);
+            if (r53 < 0)
+              break;
+            if (r53 == 0 && n53) {
+              peg_epsilon(p, m53);
+              c53 = -1;
+              break;
+            }
+            c53 += r53;
+            n53++;
+          }
+          res = c53 < 0 || !n53 ? -1 : c53 - c51;
+        }
+        if (res < 0)
+          break;
+        c51 += res;
+        res = c51 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m51);
+    }
+    if (res >= 0)
+      break;
+    {
+      int c54 = c, m54 = p->count;
+      do {
+        res = peg_char(p, c54, '`');
+        if (res < 0)
+          break;
+        c54 += res;
+        {
+          int c55 = c54, r55, n55 = 0, m55 = p->count;
+          for (;;) {
+            do {
+              r55 = peg_string(p, c55, "``", 2);
+              if (r55 >= 0)
+                break;
+              r55 = peg_class(p, c55, class47);
+            } while (0);
+            if (r55 < 0)
+              break;
+            if (r55 == 0) {
+              peg_epsilon(p, m55);
+              c55 = -1;
+              break;
+            }
+            c55 += r55;
+            n55++;
+          }
+          res = c55 < 0 ? -1 : c55 - c54;
+        }
+        if (res < 0)
+          break;
+        c54 += res;
+        res = peg_char(p, c54, '`');
+        if (res < 0)
+          break;
+        c54 += res;
+        res = c54 - c;
+      } while (0);
+      if (res < 0)
+        peg_drop(p, m54);
+    }
+  } while (0);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_identifier_name, c, res);
+  }
+  return res;
+}
+
+static int rule_keyword(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  {
+    int c56 = c, m56 = p->count;
+    do {
+      do {
+        res = rule_select_kw(p, c56);
+        if (res >= 0)
+          break;
+        res = rule_from_kw(p, c56);
+        if (res >= 0)
+          break;
+        res = rule_where_kw(p, c56);
+        if (res >= 0)
+          break;
+        res = rule_values_kw(p, c56);
+      } while (0);
+      if (res < 0)
+        break;
+      c56 += res;
+      {
+        int r57, l57 = p->last, m57 = p->count;
+        r57 = rule_ident_char(p, c56);
+        p->last = l57;
+        res = r57 < 0 ? 0 : -1;
+        if (r57 >= 0)
+          peg_drop(p, m57);
+      }
+      if (res < 0)
+        break;
+      c56 += res;
+      res = c56 - c;
+    } while (0);
+    if (res < 0)
+      peg_drop(p, m56);
+  }
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_keyword_name, c, res);
+  }
+  return res;
+}
+
+static int rule_ident_char(struct peg * p, int c) {
+  int res, m = p->count;
+  if (!peg_enter(p))
+    return -1;
+  res = peg_class(p, c, class48);
+  p->depth--;
+  if (res >= 0 && p->build) {
+    peg_reduce(p, m, gramgen_test_ident_char_name, c, res);
+  }
+  return res;
+}
+
+static int run(struct peg * p, const char * text, int len, int * last) {
+  p->text = text;
+  p->len = len;
+  p->last = last ? *last : 0;
+  p->depth = 0;
+  p->max_depth = PEG_MAX_DEPTH;
+  p->overflow = false;
+  p->nodes = NULL;
+  p->count = p->size = 0;
+  len = rule_main(p, 0);
+  if (p->overflow) {
+    // whatever matched was cut short.
+    peg_drop(p, 0);
+    len = -1;
+  }
+  if (last)
+    *last = p->last;
+  return len;
+}
+
+struct ast * gramgen_test_parse(const char * text, int * last) {
+  return gramgen_test_parse_n(text, strlen(text), last);
+}
+
+struct ast * gramgen_test_parse_n(const char * text, int len, int * last) {
+  struct peg p = {.build = true};
+  struct ast * res = run(&p, text, len, last) >= 0 ? p.nodes[0] : NULL;
+  free(p.nodes);
+  return res;
+}
+
+int gramgen_test_match(const char * text, int * last) {
+  return gramgen_test_match_n(text, strlen(text), last);
+}
+
+int gramgen_test_match_n(const char * text, int len, int * last) {
+  struct peg p = {.build = false};
+  return run(&p, text, len, last);
+}
@@ -0,0 +1,49 @@
+// generated by gramgen, do not edit.
+
+#include "gram.h"
+
+// user_data of the nodes of every rule.
+extern const char gramgen_test_main_name[];
+extern const char gramgen_test_bs_name[];
+extern const char gramgen_test_space_name[];
+extern const char gramgen_test_comment_name[];
+extern const char gramgen_test_statement_name[];
+extern const char gramgen_test_select_statement_name[];
+extern const char gramgen_test_columns_name[];
+extern const char gramgen_test_insert_statement_name[];
+extern const char gramgen_test_commit_statement_name[];
+extern const char gramgen_test_select_kw_name[];
+extern const char gramgen_test_from_kw_name[];
+extern const char gramgen_test_where_kw_name[];
+extern const char gramgen_test_insert_kw_name[];
+extern const char gramgen_test_into_kw_name[];
+extern const char gramgen_test_values_kw_name[];
+extern const char gramgen_test_commit_kw_name[];
+extern const char gramgen_test_work_kw_name[];
+extern const char gramgen_test_and_kw_name[];
+extern const char gramgen_test_or_kw_name[];
+extern const char gramgen_test_expr_name[];
+extern const char gramgen_test_term_name[];
+extern const char gramgen_test_number_name[];
+extern const char gramgen_test_quotes_name[];
+extern const char gramgen_test_tbl_name_name[];
+extern const char gramgen_test_col_name_name[];
+extern const char gramgen_test_identifier_name[];
+extern const char gramgen_test_keyword_name[];
+extern const char gramgen_test_ident_char_name[];
+
+/**
+ * same as parse and match, with the rule main of the grammar. The tree has
+ * only the nodes of the rules, filtered as annotated in the grammar.
+ * Texts nesting more than PEG_MAX_DEPTH rules (4095 unless defined when
+ * compiling the parser) fail.
+ */
+struct ast * gramgen_test_parse(const char * text, int * last);
+int gramgen_test_match(const char * text, int * last);
+
+/**
+ * same as parse_n and match_n: the text is the len bytes at text, which
+ * may have NULs and is never read past them.
+ */
+struct ast * gramgen_test_parse_n(const char * text, int len, int * last);
+int gramgen_test_match_n(const char * text, int len, int * last);
@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gram.h"
+#include "gramparser.h"
+#include "gramgen-test-peg.h"
+
+// names of both trees are different pointers, so compare the strings.
+static int ast_equal(struct ast * a, struct ast * b) {
+  int i;
+  if (!a || !b)
+    return a == b;
+  if (strcmp(a->user_data, b->user_data) || a->from != b->from || a->len != b->len)
+    return 0;
+  for (i = 0; a->children[i] && b->children[i]; i++)
+    if (!ast_equal(a->children[i], b->children[i]))
+      return 0;
+  return !a->children[i] && !b->children[i];
+}
+
+static enum filter_ast_mode filter_fn(struct ast * node, void * privdata) {
+  if (!node->user_data)
+    return FILTER_AST_ONLY_KEEP_CHILDREN;
+  return gramparser_get_filter_mode(privdata, node->user_data);
+}
+
+static void print_name(void * user_data) {
+  puts(user_data);
+}
+
+// the generated parser must agree with the same grammar run by the library,
+// on the len bytes at text.
+static void check_n(struct gramparser * gp, const char * text, int text_len, bool matches) {
+  int last1 = 0, last2 = 0, last3 = 0;
+  struct ast * raw = parse_n(text, text_len, gramparser_get_gram(gp, "main"), &last1);
+  struct ast * ast1 = raw ? filter_ast(raw, &filter_fn, gp) : NULL;
+  struct ast * ast2 = gramgen_test_parse_n(text, text_len, &last2);
+  int len = gramgen_test_match_n(text, text_len, &last3);
+  printf("matching \"%.*s\": ast=%p, last=%d, len=%d\n", text_len, text, ast2, last2, len);
+  if (ast2)
+    dump_ast(ast2, 2, &print_name);
+  assert(!ast2 == !matches);
+  assert(ast_equal(ast1, ast2));
+  assert(last1 == last2 && last2 == last3);
+  assert(ast2 ? len == ast2->len : len == -1);
+  if (raw) {
+    free_ast(raw);
+    free_ast(ast1);
+    free_ast(ast2);
+  }
+}
+
+static void check(struct gramparser * gp, const char * text, bool matches) {
+  int last1 = 0, last2 = 0;
+  check_n(gp, text, strlen(text), matches);
+  assert(gramgen_test_match(text, &last1) == gramgen_test_match_n(text, strlen(text), &last2));
+  assert(last1 == last2);
+}
+
+static char * read_file(const char * name) {
+  FILE * fd = fopen(name, "r");
+  assert(fd);
+  fseek(fd, 0, SEEK_END);
+  long size = ftell(fd);
+  rewind(fd);
+  char * text = malloc(size + 1);
+  assert(fread(text, 1, size, fd) == size);
+  text[size] = 0;
+  fclose(fd);
+  return text;
+}
+
+void test1(void) {
+  struct gramparser * gp = new_gramparser();
+  char * peg = read_file("gramgen-test.peg");
+  assert(gramparser_add_peg(gp, peg) == -1);
+  assert(gramparser_is_complete(gp));
+  assert(gramparser_get_filter_mode(gp, "bs") == FILTER_AST_DISCARD);
+  assert(gramparser_get_filter_mode(gp, "quotes") == FILTER_AST_LEAF);
+  assert(gramparser_get_filter_mode(gp, "main") == FILTER_AST_KEEP);
+  assert(gramparser_get_gram(gp, "where_kw") && gramparser_get_gram(gp, "or_kw"));
+  check(gp, "", true);
+  check(gp, "select * from t", true);
+  check(gp, "SELECT a, b ,c FROM `my table` where a = 'it''s' -- done", true);
+  check(gp, "insert into t (a, b) values (1, \"x\"\"y\"); /* twice */ Commit work;", true);
+  check(gp, "select from t", false);
+  check(gp, "select a from where", false);
+  check(gp, "commit; insert t values (-12, 'a'", false);
+  check(gp, "select a from t where (a = (1)) <> (b)", true);
+  // the text ends at its length, whatever the bytes there are.
+  check_n(gp, "select * from t; garbage", 15, true);
+  check_n(gp, "insert into t values ('a\0b')", 28, true);
+  check_n(gp, "select a from t where a = 'b'", 28, false);
+  // too deep for the C stack: both parsers fail, neither crashes.
+  int i, n = 1000000;
+  char * deep = malloc(2 * n + 32);
+  strcpy(deep, "select a from t where ");
+  char * p = deep + strlen(deep);
+  for (i = 0; i < n; i++)
+    p[i] = '(';
+  p[n] = '1';
+  for (i = 0; i < n; i++)
+    p[n + 1 + i] = ')';
+  p[2 * n + 1] = '\0';
+  assert(!gramgen_test_parse(deep, NULL));
+  assert(gramgen_test_match(deep, NULL) == -1);
+  assert(!parse(deep, gramparser_get_gram(gp, "main"), NULL));
+  // but a few levels are parsed as by the library.
+  strcpy(p + 100, "1");
+  memset(p + 101, ')', 100);
+  p[201] = '\0';
+  check(gp, deep, true);
+  free(deep);
+  free(peg);
+  free_gramparser(gp);
+  printf("test1 passed!\n\n");
+}
+
+void test2(void) {
+  // errors are reported with the line where they were found.
+  struct gramparser * gp = new_gramparser();
+  assert(gramparser_add_peg(gp, "a = 'a'\n  / 'b';\n\nb = 'x' |;\n") == 4);
+  assert(gramparser_add_peg(gp, "c = 'c'; # @FOO\n") == 1);
+  assert(gramparser_add_peg(gp, "# comment\nd = 'd'\n") == 2);
+  assert(gramparser_add_peg(gp, "e 'e';\n") == 1);
+  free_gramparser(gp);
+  printf("test2 passed!\n\n");
+}
+
+int main(void) {
+  init_gramparser();
+  test1();
+  test2();
+  return 0;
+}
@@ -0,0 +1,646 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gram-private.h"
+#include "gramparser.h"
+
+/**
+ * gramgen: reads a .peg file (see gramparser_add_peg) and writes a C parser
+ * specialized for it: one function per rule, literals and char classes
+ * inlined, and direct calls between rules. The generated parser builds the
+ * tree of the rules only (as purge_ast would), already filtered with the
+ * modes annotated in the .peg file. The first rule is the entry point.
+ */
+
+struct rule {
+  const char * name;
+  struct gram * gram;
+  enum filter_ast_mode mode;
+  bool used; // reachable from the first rule.
+};
+
+struct gen {
+  FILE * out;
+  const char * prefix;
+  struct rule * rules;
+  int rules_count;
+  int vars; // fresh variable names.
+  FILE * classes; // char class tables, printed before the functions.
+  int classes_count;
+};
+
+static void collect_rule(const char * name, struct gram * g, void * privdata) {
+  struct gen * gen = privdata;
+  gen->rules = realloc(gen->rules, sizeof (struct rule) * (gen->rules_count + 1));
+  gen->rules[gen->rules_count++] = (struct rule){name, g, FILTER_AST_KEEP, false};
+}
+
+static int find_rule(struct gen * gen, struct gram * g) {
+  int i;
+  for (i = 0; i < gen->rules_count; i++)
+    if (gen->rules[i].gram == g)
+      return i;
+  return -1;
+}
+
+// unnamed grams are never shared by gramparser, so only rules are marked.
+static void mark_used(struct gen * gen, struct gram * g, bool rule_body) {
+  int i, r = find_rule(gen, g);
+  if (r >= 0 && !rule_body) {
+    if (!gen->rules[r].used) {
+      gen->rules[r].used = true;
+      mark_used(gen, g, true);
+    }
+    return;
+  }
+  switch (g->type) {
+    case GRAM_OPT: case GRAM_PLUS: case GRAM_ASTER:
+    case GRAM_POSLA: case GRAM_NEGLA:
+      mark_used(gen, ((struct gram_child *)g)->child, false);
+      break;
+    case GRAM_ALT: case GRAM_CAT:
+      for (i = 0; ((struct gram_children *)g)->children[i]; i++)
+	mark_used(gen, ((struct gram_children *)g)->children[i], false);
+      break;
+    default:
+      break;
+  }
+}
+
+static void print_char(FILE * out, char c) {
+  if (c == '\'' || c == '\\')
+    fprintf(out, "'\\%c'", c);
+  else if (isprint((unsigned char)c))
+    fprintf(out, "'%c'", c);
+  else
+    fprintf(out, "'\\x%02x'", (unsigned char)c);
+}
+
+static void print_string(FILE * out, const char * s, int len) {
+  int i;
+  fputc('"', out);
+  for (i = 0; i < len; i++) {
+    if (s[i] == '"' || s[i] == '\\')
+      fprintf(out, "\\%c", s[i]);
+    else if (isprint((unsigned char)s[i]))
+      fputc(s[i], out);
+    else // octal, so the following chars are never taken as part of it.
+      fprintf(out, "\\%03o", (unsigned char)s[i]);
+  }
+  fputc('"', out);
+}
+
+static void indent(struct gen * gen, int level) {
+  fprintf(gen->out, "%*s", 2 * level, "");
+}
+
+// a class, or an alternation of single chars and ranges, so a bitmap lookup.
+static bool is_class(struct gen * gen, struct gram * g) {
+  int i;
+  if (g->type == GRAM_CLASS)
+    return true;
+  if (g->type != GRAM_ALT)
+    return false;
+  struct gram ** children = ((struct gram_children *)g)->children;
+  for (i = 0; children[i]; i++) {
+    if (find_rule(gen, children[i]) >= 0)
+      return false;
+    if (children[i]->type == GRAM_STRING && ((struct gram_string *)children[i])->len == 1)
+      continue;
+    if (children[i]->type != GRAM_RANGE && !is_class(gen, children[i]))
+      return false;
+  }
+  return true;
+}
+
+static void class_bits(struct gram * g, unsigned char bits[32]) {
+  int i, c;
+  if (g->type == GRAM_STRING) {
+    c = (unsigned char)((struct gram_string *)g)->text[0];
+    bits[c >> 3] |= 1 << (c & 7);
+  } else if (g->type == GRAM_RANGE) {
+    // ranges compare chars, whatever their signedness.
+    for (i = ((struct gram_range *)g)->from; i <= ((struct gram_range *)g)->to; i++) {
+      c = (unsigned char)i;
+      bits[c >> 3] |= 1 << (c & 7);
+    }
+  } else if (g->type == GRAM_CLASS || g->type == GRAM_SPAN) {
+    for (i = 0; i < 32; i++)
+      bits[i] |= g->type == GRAM_CLASS ? ((struct gram_class *)g)->set[i]
+	: ((struct gram_span *)g)->set[i];
+  } else {
+    for (i = 0; ((struct gram_children *)g)->children[i]; i++)
+      class_bits(((struct gram_children *)g)->children[i], bits);
+  }
+}
+
+// writes the table of a class, returning its number.
+static int add_class(struct gen * gen, const unsigned char * bits) {
+  int i, n = gen->classes_count++;
+  fprintf(gen->classes, "static const unsigned char class%d[32] = {", n);
+  for (i = 0; i < 32; i++)
+    fprintf(gen->classes, "%s0x%02x", i % 8 ? ", " : i ? ",\n  " : "\n  ", bits[i]);
+  fprintf(gen->classes, "\n};\n\n");
+  return n;
+}
+
+/**
+ * writes the statements matching g at cursor (a variable name), leaving
+ * the length matched or -1 in res. On failure every node pushed is dropped.
+ */
+static void gen_gram(struct gen * gen, struct gram * g, const char * cursor,
+    const char * res, int level, bool inline_rule) {
+  FILE * out = gen->out;
+  int i, n, r = find_rule(gen, g);
+  char c[16], m[16], rr[16];
+  if (r >= 0 && !inline_rule) {
+    indent(gen, level);
+    fprintf(out, "%s = rule_%s(p, %s);\n", res, gen->rules[r].name, cursor);
+    return;
+  }
+  if (is_class(gen, g)) {
+    unsigned char bits[32] = {0};
+    class_bits(g, bits);
+    indent(gen, level);
+    fprintf(out, "%s = peg_class(p, %s, class%d);\n", res, cursor, add_class(gen, bits));
+    return;
+  }
+  switch (g->type) {
+    case GRAM_DOT:
+      indent(gen, level);
+      fprintf(out, "%s = peg_dot(p, %s);\n", res, cursor);
+      break;
+    case GRAM_STRING: {
+      struct gram_string * s = (struct gram_string *)g;
+      indent(gen, level);
+      if (s->len == 1) {
+	fprintf(out, "%s = peg_char(p, %s, ", res, cursor);
+	print_char(out, s->text[0]);
+	fprintf(out, ");\n");
+      } else {
+	fprintf(out, "%s = peg_string(p, %s, ", res, cursor);
+	print_string(out, s->text, s->len);
+	fprintf(out, ", %d);\n", s->len);
+      }
+      break;
+    }
+    case GRAM_RANGE:
+      indent(gen, level);
+      fprintf(out, "%s = peg_range(p, %s, ", res, cursor);
+      print_char(out, ((struct gram_range *)g)->from);
+      fprintf(out, ", ");
+      print_char(out, ((struct gram_range *)g)->to);
+      fprintf(out, ");\n");
+      break;
+    case GRAM_SPAN: {
+      unsigned char bits[32] = {0};
+      class_bits(g, bits);
+      indent(gen, level);
+      fprintf(out, "%s = peg_span(p, %s, class%d, %d);\n", res, cursor,
+	  add_class(gen, bits), ((struct gram_span *)g)->min);
+      break;
+    }
+    case GRAM_OPT:
+      gen_gram(gen, ((struct gram_child *)g)->child, cursor, res, level, false);
+      indent(gen, level);
+      fprintf(out, "if (%s < 0)\n", res);
+      indent(gen, level + 1);
+      fprintf(out, "%s = 0;\n", res);
+      break;
+    case GRAM_PLUS: case GRAM_ASTER:
+      n = gen->vars++;
+      sprintf(c, "c%d", n);
+      sprintf(rr, "r%d", n);
+      indent(gen, level);
+      fprintf(out, "{\n");
+      indent(gen, level + 1);
+      fprintf(out, "int %s = %s, %s, n%d = 0, m%d = p->count;\n", c, cursor, rr, n, n);
+      indent(gen, level + 1);
+      fprintf(out, "for (;;) {\n");
+      gen_gram(gen, ((struct gram_child *)g)->child, c, rr, level + 2, false);
+      indent(gen, level + 2);
+      fprintf(out, "if (%s < 0)\n", rr);
+      indent(gen, level + 3);
+      fprintf(out, "break;\n");
+      indent(gen, level + 2);
+      if (g->type == GRAM_PLUS)
+	fprintf(out, "if (%s == 0 && n%d) {\n", rr, n);
+      else
+	fprintf(out, "if (%s == 0) {\n", rr);
+      indent(gen, level + 3);
+      fprintf(out, "peg_epsilon(p, m%d);\n", n);
+      indent(gen, level + 3);
+      fprintf(out, "%s = -1;\n", c);
+      indent(gen, level + 3);
+      fprintf(out, "break;\n");
+      indent(gen, level + 2);
+      fprintf(out, "}\n");
+      indent(gen, level + 2);
+      fprintf(out, "%s += %s;\n", c, rr);
+      indent(gen, level + 2);
+      fprintf(out, "n%d++;\n", n);
+      indent(gen, level + 1);
+      fprintf(out, "}\n");
+      indent(gen, level + 1);
+      if (g->type == GRAM_PLUS)
+	fprintf(out, "%s = %s < 0 || !n%d ? -1 : %s - %s;\n", res, c, n, c, cursor);
+      else
+	fprintf(out, "%s = %s < 0 ? -1 : %s - %s;\n", res, c, c, cursor);
+      indent(gen, level);
+      fprintf(out, "}\n");
+      break;
+    case GRAM_ALT: {
+      struct gram ** children = ((struct gram_children *)g)->children;
+      indent(gen, level);
+      fprintf(out, "do {\n");
+      for (i = 0; children[i]; i++) {
+	gen_gram(gen, children[i], cursor, res, level + 1, false);
+	if (children[i + 1]) {
+	  indent(gen, level + 1);
+	  fprintf(out, "if (%s >= 0)\n", res);
+	  indent(gen, level + 2);
+	  fprintf(out, "break;\n");
+	}
+      }
+      indent(gen, level);
+      fprintf(out, "} while (0);\n");
+      break;
+    }
+    case GRAM_CAT: {
+      struct gram ** children = ((struct gram_children *)g)->children;
+      if (!children[1]) {
+	gen_gram(gen, children[0], cursor, res, level, false);
+	break;
+      }
+      n = gen->vars++;
+      sprintf(c, "c%d", n);
+      sprintf(m, "m%d", n);
+      indent(gen, level);
+      fprintf(out, "{\n");
+      indent(gen, level + 1);
+      fprintf(out, "int %s = %s, %s = p->count;\n", c, cursor, m);
+      indent(gen, level + 1);
+      fprintf(out, "do {\n");
+      for (i = 0; children[i]; i++) {
+	gen_gram(gen, children[i], c, res, level + 2, false);
+	indent(gen, level + 2);
+	fprintf(out, "if (%s < 0)\n", res);
+	indent(gen, level + 3);
+	fprintf(out, "break;\n");
+	indent(gen, level + 2);
+	fprintf(out, "%s += %s;\n", c, res);
+      }
+      indent(gen, level + 2);
+      fprintf(out, "%s = %s - %s;\n", res, c, cursor);
+      indent(gen, level + 1);
+      fprintf(out, "} while (0);\n");
+      indent(gen, level + 1);
+      fprintf(out, "if (%s < 0)\n", res);
+      indent(gen, level + 2);
+      fprintf(out, "peg_drop(p, %s);\n", m);
+      indent(gen, level);
+      fprintf(out, "}\n");
+      break;
+    }
+    case GRAM_POSLA: case GRAM_NEGLA:
+      n = gen->vars++;
+      sprintf(rr, "r%d", n);
+      indent(gen, level);
+      fprintf(out, "{\n");
+      indent(gen, level + 1);
+      fprintf(out, "int %s, l%d = p->last, m%d = p->count;\n", rr, n, n);
+      gen_gram(gen, ((struct gram_child *)g)->child, cursor, rr, level + 1, false);
+      indent(gen, level + 1);
+      fprintf(out, "p->last = l%d;\n", n);
+      indent(gen, level + 1);
+      if (g->type == GRAM_POSLA) {
+	fprintf(out, "%s = %s < 0 ? -1 : 0;\n", res, rr);
+	indent(gen, level + 1);
+	fprintf(out, "(void)m%d;\n", n);
+      } else {
+	fprintf(out, "%s = %s < 0 ? 0 : -1;\n", res, rr);
+	indent(gen, level + 1);
+	fprintf(out, "if (%s >= 0)\n", rr);
+	indent(gen, level + 2);
+	fprintf(out, "peg_drop(p, m%d);\n", n);
+      }
+      indent(gen, level);
+      fprintf(out, "}\n");
+      break;
+    default:
+      fprintf(stderr, "gramgen: ints and custom grams can't be generated.\n");
+      exit(1);
+  }
+}
+
+static const char * runtime =
+  "// deeper than this the C stack may not hold, and the parse fails.\n"
+  "#ifndef PEG_MAX_DEPTH\n"
+  "#define PEG_MAX_DEPTH 0xfff\n"
+  "#endif\n"
+  "\n"
+  "struct peg {\n"
+  "  const char * text;\n"
+  "  int len; // the text ends here, whatever its bytes are.\n"
+  "  int last;\n"
+  "  int depth, max_depth;\n"
+  "  bool overflow; // nested deeper than max_depth: the parse fails.\n"
+  "  bool build;\n"
+  "  struct ast ** nodes;\n"
+  "  int count, size;\n"
+  "};\n"
+  "\n"
+  "// rules must give up (failing) when it returns false.\n"
+  "static inline bool peg_enter(struct peg * p) {\n"
+  "  if (++p->depth <= p->max_depth)\n"
+  "    return true;\n"
+  "  p->depth--;\n"
+  "  p->overflow = true;\n"
+  "  // every rule fails from now on, so the parse unwinds quickly.\n"
+  "  p->max_depth = 0;\n"
+  "  return false;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_match(struct peg * p, int cursor, int len) {\n"
+  "  if (cursor + len > p->last)\n"
+  "    p->last = cursor + len;\n"
+  "  return len;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_dot(struct peg * p, int cursor) {\n"
+  "  return cursor < p->len ? peg_match(p, cursor, 1) : -1;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_char(struct peg * p, int cursor, char c) {\n"
+  "  return cursor < p->len && p->text[cursor] == c ? peg_match(p, cursor, 1) : -1;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_string(struct peg * p, int cursor, const char * s, int len) {\n"
+  "  return len <= p->len - cursor && !memcmp(p->text + cursor, s, len)\n"
+  "    ? peg_match(p, cursor, len) : -1;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_range(struct peg * p, int cursor, char from, char to) {\n"
+  "  if (cursor >= p->len)\n"
+  "    return -1;\n"
+  "  char c = p->text[cursor];\n"
+  "  return from <= c && c <= to ? peg_match(p, cursor, 1) : -1;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_class(struct peg * p, int cursor, const unsigned char * bits) {\n"
+  "  if (cursor >= p->len)\n"
+  "    return -1;\n"
+  "  unsigned char c = p->text[cursor];\n"
+  "  return bits[c >> 3] >> (c & 7) & 1 ? peg_match(p, cursor, 1) : -1;\n"
+  "}\n"
+  "\n"
+  "static inline int peg_span(struct peg * p, int cursor, const unsigned char * bits, int min) {\n"
+  "  int len = 0;\n"
+  "  unsigned char c;\n"
+  "  while (cursor + len < p->len && (c = p->text[cursor + len], bits[c >> 3] >> (c & 7) & 1))\n"
+  "    len++;\n"
+  "  if (len)\n"
+  "    peg_match(p, cursor, len);\n"
+  "  return len >= min ? len : -1;\n"
+  "}\n"
+  "\n"
+  "static inline void peg_push(struct peg * p, struct ast * ast) {\n"
+  "  if (p->count == p->size) {\n"
+  "    p->size = p->size ? 2 * p->size : 64;\n"
+  "    p->nodes = realloc(p->nodes, sizeof (struct ast *) * p->size);\n"
+  "  }\n"
+  "  p->nodes[p->count++] = ast;\n"
+  "}\n"
+  "\n"
+  "// replaces the nodes pushed since mark by a node having them as children.\n"
+  "static inline void peg_reduce(struct peg * p, int mark, const char * name, int from, int len) {\n"
+  "  int n = p->count - mark;\n"
+  "  struct ast * ast = malloc(sizeof (struct ast) + sizeof (struct ast *) * (n + 1));\n"
+  "  ast->user_data = (void *)name;\n"
+  "  ast->from = from;\n"
+  "  ast->len = len;\n"
+  "  ast->refs = 1;\n"
+  "  if (n) // nodes may still be NULL.\n"
+  "    memcpy(ast->children, p->nodes + mark, sizeof (struct ast *) * n);\n"
+  "  ast->children[n] = NULL;\n"
+  "  p->count = mark;\n"
+  "  peg_push(p, ast);\n"
+  "}\n"
+  "\n"
+  "static inline void peg_drop(struct peg * p, int mark) {\n"
+  "  while (p->count > mark)\n"
+  "    free_ast(p->nodes[--p->count]);\n"
+  "}\n"
+  "\n"
+  "static inline void peg_epsilon(struct peg * p, int mark) {\n"
+  "  fprintf(stderr, \"WARNING: repetition parsing subgrammar with epsilon transitions. E.g: ('a'?)*\\n\"\n"
+  "      \"\\t(as a fallback) this match will fail, but you MUST fix the grammar.\");\n"
+  "  peg_drop(p, mark);\n"
+  "}\n"
+  "\n";
+
+static const char * mode_names[] = {
+  "KEEP", "ONLY_KEEP_CHILDREN", "LEAF", "DISCARD"
+};
+
+static void gen_rule(struct gen * gen, int r) {
+  struct rule * rule = &gen->rules[r];
+  FILE * out = gen->out;
+  fprintf(out, "static int rule_%s(struct peg * p, int c) {\n", rule->name);
+  fprintf(out, "  int res, m = p->count;\n");
+  fprintf(out, "  if (!peg_enter(p))\n");
+  fprintf(out, "    return -1;\n");
+  gen_gram(gen, rule->gram, "c", "res", 1, true);
+  fprintf(out, "  p->depth--;\n");
+  // the root is never filtered.
+  enum filter_ast_mode mode = r ? rule->mode : FILTER_AST_KEEP;
+  if (mode == FILTER_AST_ONLY_KEEP_CHILDREN) {
+    fprintf(out, "  (void)m;\n");
+  } else {
+    fprintf(out, "  if (res >= 0 && p->build) {\n");
+    if (mode != FILTER_AST_KEEP)
+      fprintf(out, "    peg_drop(p, m);\n");
+    if (mode != FILTER_AST_DISCARD)
+      fprintf(out, "    peg_reduce(p, m, %s_%s_name, c, res);\n", gen->prefix, rule->name);
+    fprintf(out, "  }\n");
+  }
+  fprintf(out, "  return res;\n}\n\n");
+}
+
+static void gen_header(struct gen * gen) {
+  int i;
+  printf("// generated by gramgen, do not edit.\n\n");
+  printf("#include \"gram.h\"\n\n");
+  printf("// user_data of the nodes of every rule.\n");
+  for (i = 0; i < gen->rules_count; i++)
+    printf("extern const char %s_%s_name[];\n", gen->prefix, gen->rules[i].name);
+  printf("\n");
+  printf("/**\n"
+      " * same as parse and match, with the rule %s of the grammar. The tree has\n"
+      " * only the nodes of the rules, filtered as annotated in the grammar.\n"
+      " * Texts nesting more than PEG_MAX_DEPTH rules (4095 unless defined when\n"
+      " * compiling the parser) fail.\n"
+      " */\n", gen->rules[0].name);
+  printf("struct ast * %s_parse(const char * text, int * last);\n", gen->prefix);
+  printf("int %s_match(const char * text, int * last);\n", gen->prefix);
+  printf("\n/**\n"
+      " * same as parse_n and match_n: the text is the len bytes at text, which\n"
+      " * may have NULs and is never read past them.\n"
+      " */\n");
+  printf("struct ast * %s_parse_n(const char * text, int len, int * last);\n", gen->prefix);
+  printf("int %s_match_n(const char * text, int len, int * last);\n", gen->prefix);
+}
+
+static void gen_source(struct gen * gen, const char * header) {
+  int i;
+  char * classes, * functions;
+  size_t classes_size, functions_size;
+  printf("// generated by gramgen, do not edit.\n\n");
+  printf("#include <stdbool.h>\n#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n\n");
+  printf("#include \"gram.h\"\n");
+  if (header)
+    printf("#include \"%s\"\n", header);
+  printf("\n");
+  for (i = 0; i < gen->rules_count; i++)
+    printf("const char %s_%s_name[] = \"%s\"; // %s\n", gen->prefix, gen->rules[i].name,
+	gen->rules[i].name, mode_names[gen->rules[i].mode]);
+  printf("\n%s", runtime);
+  mark_used(gen, gen->rules[0].gram, false);
+  for (i = 0; i < gen->rules_count; i++)
+    if (gen->rules[i].used)
+      printf("static int rule_%s(struct peg * p, int c);\n", gen->rules[i].name);
+  printf("\n");
+  gen->classes = open_memstream(&classes, &classes_size);
+  gen->out = open_memstream(&functions, &functions_size);
+  for (i = 0; i < gen->rules_count; i++)
+    if (gen->rules[i].used)
+      gen_rule(gen, i);
+  fclose(gen->classes);
+  fclose(gen->out);
+  fputs(classes, stdout);
+  fputs(functions, stdout);
+  free(classes);
+  free(functions);
+  printf("static int run(struct peg * p, const char * text, int len, int * last) {\n"
+      "  p->text = text;\n"
+      "  p->len = len;\n"
+      "  p->last = last ? *last : 0;\n"
+      "  p->depth = 0;\n"
+      "  p->max_depth = PEG_MAX_DEPTH;\n"
+      "  p->overflow = false;\n"
+      "  p->nodes = NULL;\n"
+      "  p->count = p->size = 0;\n"
+      "  len = rule_%s(p, 0);\n"
+      "  if (p->overflow) {\n"
+      "    // whatever matched was cut short.\n"
+      "    peg_drop(p, 0);\n"
+      "    len = -1;\n"
+      "  }\n"
+      "  if (last)\n"
+      "    *last = p->last;\n"
+      "  return len;\n"
+      "}\n\n", gen->rules[0].name);
+  printf("struct ast * %s_parse(const char * text, int * last) {\n"
+      "  return %s_parse_n(text, strlen(text), last);\n"
+      "}\n\n", gen->prefix, gen->prefix);
+  printf("struct ast * %s_parse_n(const char * text, int len, int * last) {\n"
+      "  struct peg p = {.build = true};\n"
+      "  struct ast * res = run(&p, text, len, last) >= 0 ? p.nodes[0] : NULL;\n"
+      "  free(p.nodes);\n"
+      "  return res;\n"
+      "}\n\n", gen->prefix);
+  printf("int %s_match(const char * text, int * last) {\n"
+      "  return %s_match_n(text, strlen(text), last);\n"
+      "}\n\n", gen->prefix, gen->prefix);
+  printf("int %s_match_n(const char * text, int len, int * last) {\n"
+      "  struct peg p = {.build = false};\n"
+      "  return run(&p, text, len, last);\n"
+      "}\n", gen->prefix);
+}
+
+static char * read_file(FILE * fd) {
+  size_t size = 4096, len = 0, res;
+  char * text = malloc(size);
+  while ((res = fread(text + len, 1, size - len - 1, fd)) > 0) {
+    len += res;
+    if (len + 1 == size)
+      text = realloc(text, size *= 2);
+  }
+  text[len] = 0;
+  return text;
+}
+
+static void print_help(const char * arg0) {
+  printf("Usage: %s [-p prefix] [-h / -i header] file.peg\n"
+      "Writes to stdout a C parser for the grammar of file.peg (see\n"
+      "gramparser_add_peg), whose entry point is its first rule.\n"
+      "Options:\n"
+      "  -p prefix  Prefix of the public symbols (default: peg).\n"
+      "  -h         Write the header instead.\n"
+      "  -i header  Name of the header to include from the parser.\n",
+      arg0);
+}
+
+int main(int argc, char * argv[]) {
+  struct gen gen = {.prefix = "peg"};
+  const char * header = NULL, * file = NULL;
+  bool write_header = false;
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (!strcmp("-p", argv[i]) && i < argc - 1) {
+      gen.prefix = argv[++i];
+    } else if (!strcmp("-h", argv[i])) {
+      write_header = true;
+    } else if (!strcmp("-i", argv[i]) && i < argc - 1) {
+      header = argv[++i];
+    } else if (!strcmp("--help", argv[i]) || !strcmp("-help", argv[i])) {
+      print_help(*argv);
+      return 0;
+    } else {
+      file = argv[i];
+    }
+  }
+  if (!file) {
+    print_help(*argv);
+    return 1;
+  }
+  FILE * fd = fopen(file, "r");
+  if (!fd) {
+    fprintf(stderr, "Failed opening file %s: %s\n", file, strerror(errno));
+    return 1;
+  }
+  char * peg = read_file(fd);
+  fclose(fd);
+  init_gramparser();
+  struct gramparser * gp = new_gramparser();
+  int line = gramparser_add_peg(gp, peg);
+  if (line >= 0) {
+    fprintf(stderr, "%s:%d: error reading the grammar.\n", file, line);
+    return 1;
+  }
+  if (!gramparser_is_complete(gp)) {
+    fprintf(stderr, "%s: there are undefined non-terminal references.\n", file);
+    return 1;
+  }
+  gramparser_foreach(gp, &collect_rule, &gen);
+  if (!gen.rules_count) {
+    fprintf(stderr, "%s: there are no rules.\n", file);
+    return 1;
+  }
+  for (i = 0; i < gen.rules_count; i++)
+    gen.rules[i].mode = gramparser_get_filter_mode(gp, gen.rules[i].name);
+  if (write_header)
+    gen_header(&gen);
+  else
+    gen_source(&gen, header);
+  free(gen.rules);
+  free_gramparser(gp);
+  free(peg);
+  return 0;
+}
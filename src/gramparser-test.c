@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "gramparser.h"
 
@@ -15,8 +17,139 @@ void test1(void) {
   dump_ast(ast, 2, NULL);
 }
 
+void test2(void) {
+  // single char alternatives and !X . are matched with classes.
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "main", "(word / quoted / other)* !.");
+  gramparser_add(gp, "word", "('a'..'z' / \"_\" / '0'..'9' / '\xc3' .)+");
+  gramparser_add(gp, "quoted", "'\\'' (!'\\'' !'\\n' . / '\\n')* '\\''");
+  gramparser_add(gp, "other", "'-' / space / ((!'a'..'z' !'\\'' !'\xc3' .))");
+  assert(!gramparser_is_complete(gp));
+  gramparser_add(gp, "space", "' '+");
+  assert(gramparser_is_complete(gp));
+  struct gram * gram = gramparser_get_gram(gp, "main");
+  const char * text = "ab_9 'it\nx' -\t\xc3\xb1";
+  int last = 0;
+  struct ast * ast = parse(text, gram, &last);
+  assert(ast && last == strlen(text));
+  struct ast * purged = purge_ast(ast);
+  dump_ast(purged, 2, (void(*)(void*))&puts);
+  assert(purged->children[0]->len == 4); // word
+  assert(purged->children[1]->children[0]->len == 1); // space
+  assert(purged->children[2]->len == 6); // quoted
+  assert(purged->children[4]->len == 1 && !purged->children[4]->children[0]); // -
+  assert(purged->children[6]->len == 2); // word
+  assert(!purged->children[7]);
+  free_ast(ast);
+  free_ast(purged);
+  last = 0;
+  assert(!parse("'a", gram, &last) && last == 2);
+  free_gramparser(gp);
+  printf("test2 passed!\n\n");
+}
+
+static bool same_tree(struct ast * a, struct ast * b) {
+  int i;
+  if (a->user_data != b->user_data || a->from != b->from || a->len != b->len)
+    return false;
+  for (i = 0; a->children[i] && b->children[i]; i++)
+    if (!same_tree(a->children[i], b->children[i]))
+      return false;
+  return !a->children[i] && !b->children[i];
+}
+
+static void count_rule(const char * name, struct gram * g, void * privdata) {
+  (*(int *)privdata)++;
+}
+
+static void count_created(struct gram * gram, struct gram * copy, int created, void * privdata) {
+  *(int *)privdata += created;
+}
+
+void test3(void) {
+  const char * texts[] = {
+    "let x = 1+(y-2)", "a;let b=c", "let=1", "lets", "1+", "((a))-b;c", NULL
+  };
+  struct gramparser * gp = new_gramparser(), * opt = new_gramparser();
+  struct gramparser * gps[] = {gp, opt};
+  int i, j, rules = 0, created = 0;
+  for (i = 0; i < 2; i++) {
+    gramparser_add(gps[i], "main", "stmt (';' stmt)* !.");
+    gramparser_add(gps[i], "stmt", "\"let\" ' '* ident ' '* '=' ' '* expr / expr");
+    gramparser_add(gps[i], "ident", "('a'..'z' / 'A'..'Z' / '_')+");
+    gramparser_add(gps[i], "expr", "term (('+' / '-') term)*");
+    gramparser_add(gps[i], "term", "ident / ('0'..'9')+ / '(' expr ')'");
+    gramparser_add(gps[i], "unused", "'x' term");
+  }
+  assert(!gramparser_optimize(opt, "nope"));
+  assert(gramparser_optimize(opt, "main"));
+  gramparser_foreach(opt, &count_rule, &rules);
+  assert(rules == 5 && !gramparser_get_gram(opt, "unused"));
+  gram_analyze(gramparser_get_gram(opt, "main"));
+  for (i = 0; texts[i]; i++) {
+    int last[2] = {0, 0};
+    struct ast * purged[2];
+    for (j = 0; j < 2; j++) {
+      struct ast * ast = parse(texts[i], gramparser_get_gram(gps[j], "main"), &last[j]);
+      purged[j] = NULL;
+      if (ast) {
+	purged[j] = purge_ast(ast);
+	free_ast(ast);
+      }
+    }
+    printf("optimized \"%s\": last=%d/%d\n", texts[i], last[0], last[1]);
+    assert(!purged[0] == !purged[1]);
+    if (purged[0]) {
+      assert(same_tree(purged[0], purged[1]));
+      free_ast(purged[0]);
+      free_ast(purged[1]);
+    }
+  }
+  free_gramparser(gp);
+  free_gramparser(opt);
+  // 'a' 'b' ('c' 'd'): one string, whose node has no children.
+  struct gram * g = new_gram_cat(NULL, new_gram_string(NULL, "a"), new_gram_string(NULL, "b"),
+      new_gram_cat(NULL, new_gram_string(NULL, "c"), new_gram_string(NULL, "d")));
+  struct gram * o = gram_optimize(g, &count_created, &created);
+  int last = 0;
+  assert(created == 1 && o != g);
+  struct ast * ast = parse("abcd", o, &last);
+  assert(ast && ast->len == 4 && !ast->children[0]);
+  free_ast(ast);
+  free_gram(o);
+  free_gram(g);
+  printf("test3 passed!\n\n");
+}
+
+void test4(void) {
+  struct gramparser * gp = new_gramparser();
+  char names[1000][8], def[32];
+  int i, last = 0;
+  // every rule refers to the next one, defined afterwards.
+  for (i = 0; i < 1000; i++)
+    sprintf(names[i], "r%d", i);
+  for (i = 0; i < 999; i++) {
+    sprintf(def, "'x' r%d / 'y'", i + 1);
+    assert(gramparser_add(gp, names[i], def) == -1);
+    assert(!gramparser_is_complete(gp));
+  }
+  assert(gramparser_add(gp, names[999], "'z'") == -1);
+  assert(gramparser_is_complete(gp));
+  assert(gramparser_get_gram(gp, "r500") && !gramparser_get_gram(gp, "r1000"));
+  assert(match("xxxxxy", gramparser_get_gram(gp, "r0"), &last) == 6);
+  assert(match("xxz", gramparser_get_gram(gp, "r997"), &last) == 3);
+  assert(gramparser_optimize(gp, "r990"));
+  assert(!gramparser_get_gram(gp, "r989") && gramparser_get_gram(gp, "r999"));
+  assert(match("xy", gramparser_get_gram(gp, "r990"), &last) == 2);
+  free_gramparser(gp);
+  printf("test4 passed!\n\n");
+}
+
 int main(void) {
   // init_gramparser(); // not needed
   test1();
+  test2();
+  test3();
+  test4();
   return 0;
 }
@@ -1,7 +1,9 @@
+#include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "gramparser.h"
 #include "gram.h"
@@ -13,47 +15,127 @@ static const char WORD_TOKEN[] = "word";
 static const char SUBCMD_TOKEN[] = "subcmd";
 static const char BRACES_TOKEN[] = "braces";
 static const char QUOTES_TOKEN[] = "quotes";
+static const char BARE_TOKEN[] = "bare";
+static const char COMMENT_TOKEN[] = "comment";
 static const char SP_TOKEN[] = "sp";
 
-struct {
+struct token {
   const char * name;
   const char * def;
   enum filter_ast_mode mode;
-} gram_tokens[] = {
+};
+
+struct token gram_tokens[] = {
   {MAIN_TOKEN, "line ('\n' line)* !.", FILTER_AST_KEEP},
-  {LINE_TOKEN, "words (';' words)* / comment", FILTER_AST_KEEP},
+  {LINE_TOKEN, "words (';' words)* / comment", FILTER_AST_ONLY_KEEP_CHILDREN},
   {WORDS_TOKEN, "sp* (word (sp+ word)* sp*)?", FILTER_AST_KEEP},
-  {WORD_TOKEN, "braces / subcmd", FILTER_AST_KEEP},
+  {WORD_TOKEN, "braces / subcmd / quotes / bare", FILTER_AST_ONLY_KEEP_CHILDREN},
   {SUBCMD_TOKEN, "'[' words ']'", FILTER_AST_KEEP},
-  {BRACES_TOKEN, "'{' ('\\\\'./braces/!'\\\\'!'{'!'}')* '}'", FILTER_AST_LEAF},
-  {QUOTES_TOKEN, "'\"' (subcmd/braces/'\\\\'./!'\\\\'!'[')* '\"'", FILTER_AST_LEAF},
+  {BRACES_TOKEN, "'{' ('\\\\'./braces/!'\\\\'!'{'!'}'.)* '}'", FILTER_AST_LEAF},
+  {QUOTES_TOKEN, "'\"' (subcmd/braces/'\\\\'./!'\\\\'!'['!'\"'.)* '\"'", FILTER_AST_LEAF},
+  {BARE_TOKEN, "(!sp!'['!']'!'{'!'\"'!';'!'\n'.)+", FILTER_AST_KEEP},
+  {COMMENT_TOKEN, "'#' (!'\n'.)*", FILTER_AST_DISCARD},
   {SP_TOKEN, "' '/'\t'/'\v'/'\f'", FILTER_AST_DISCARD},
   {NULL}
-}, list_tokens[] {
+}, list_tokens[] = {
+  {MAIN_TOKEN, "words !.", FILTER_AST_KEEP},
   {WORDS_TOKEN, "sp* (word (sp+ word)* sp*)?", FILTER_AST_KEEP},
-  {BRACES_TOKEN, "'{' ('\\\\'./braces/!'\\\\'!'{'!'}')* '}'", FILTER_AST_LEAF},
-  {QUOTES_TOKEN, "'\"' (braces/'\\\\'./!'\\\\')* '\"'", FILTER_AST_KEEP},
+  {WORD_TOKEN, "braces / quotes / bare", FILTER_AST_ONLY_KEEP_CHILDREN},
+  {BRACES_TOKEN, "'{' ('\\\\'./braces/!'\\\\'!'{'!'}'.)* '}'", FILTER_AST_LEAF},
+  {QUOTES_TOKEN, "'\"' (braces/'\\\\'./!'\\\\'!'\"'.)* '\"'", FILTER_AST_KEEP},
+  {BARE_TOKEN, "(!sp!'{'!'\"'.)+", FILTER_AST_KEEP},
   {SP_TOKEN, "' '/'\t'/'\v'/'\f'/'\r'/'\n'", FILTER_AST_DISCARD},
+  {NULL}
 };
 
-int main(void) {
-  init_gramparser();
+static struct gramparser * new_token_parser(struct token * tokens, bool filtered) {
   struct gramparser * gp = new_gramparser();
   int i;
-  for (i = 0; gram_tokens[i].name; i++) {
-    printf("adding %s\n", gram_tokens[i].name);
-    gramparser_add(gp, gram_tokens[i].name, gram_tokens[i].def);
+  for (i = 0; tokens[i].name; i++) {
+    assert(gramparser_add(gp, tokens[i].name, tokens[i].def) == -1);
+    if (filtered)
+      assert(gramparser_set_filter_mode(gp, tokens[i].name, tokens[i].mode));
   }
-  struct gram * g = gramparser_get_gram(gp, MAIN_TOKEN);
-  printf("is complete? %d\n", gramparser_is_complete(gp));
-  i = 0;
-  struct ast * a = parse("hello world {foo bar} taz!", g, &i);
-  printf("ast=%p, last=%d\n", a, i);
-  if (!a)
-    return 1;
-  switch ((intptr_t)a->user_data) {
-    case (intptr_t)MAIN_TOKEN:
-      printf("main!\n");
+  assert(gramparser_is_complete(gp));
+  return gp;
+}
+
+static enum filter_ast_mode filter_fn(struct ast * node, void * privdata) {
+  struct token * tokens = privdata;
+  int i;
+  if (!node->user_data)
+    return FILTER_AST_ONLY_KEEP_CHILDREN;
+  for (i = 0; tokens[i].name; i++)
+    if (tokens[i].name == node->user_data)
+      return tokens[i].mode;
+  return FILTER_AST_KEEP;
+}
+
+static bool ast_equal(struct ast * a, struct ast * b) {
+  int i;
+  if (a->user_data != b->user_data || a->from != b->from || a->len != b->len)
+    return false;
+  for (i = 0; a->children[i] && b->children[i]; i++)
+    if (!ast_equal(a->children[i], b->children[i]))
+      return false;
+  return !a->children[i] && !b->children[i];
+}
+
+static int count_nodes(struct ast * ast) {
+  int i, n = 1;
+  for (i = 0; ast->children[i]; i++)
+    n += count_nodes(ast->children[i]);
+  return n;
+}
+
+// parsing with the modes set gives the tree filter_ast gives afterwards.
+static void expect_filtered(struct token * tokens, const char * text) {
+  static const int flags[] = {0, PARSE_MEMO, PARSE_ITERATIVE};
+  struct gramparser * plain = new_token_parser(tokens, false);
+  struct gramparser * filtered = new_token_parser(tokens, true);
+  int i, last = 0;
+  struct ast * raw = parse(text, gramparser_get_gram(plain, MAIN_TOKEN), &last);
+  assert(raw);
+  struct ast * purged_raw = purge_ast(raw);
+  struct ast * expected = filter_ast(purged_raw, &filter_fn, tokens);
+  printf("\"%s\": %d nodes, %d once filtered\n", text, count_nodes(raw), count_nodes(expected));
+  for (i = 0; i < sizeof flags / sizeof flags[0]; i++) {
+    last = 0;
+    struct ast * ast = parse_ex(text, gramparser_get_gram(filtered, MAIN_TOKEN), &last, flags[i]);
+    assert(ast);
+    struct ast * purged = purge_ast(ast);
+    assert(ast_equal(purged, expected));
+    free_ast(purged);
+    free_ast(ast);
   }
+  free_ast(raw);
+  free_ast(purged_raw);
+  free_ast(expected);
+  free_gramparser(plain);
+  free_gramparser(filtered);
+}
+
+int main(void) {
+  init_gramparser();
+  expect_filtered(gram_tokens, "hello world {foo bar} taz!");
+  expect_filtered(gram_tokens, "set a [expr {1 + 2}]; puts \"a=[set a] {x}\"\n# the end\nputs ok");
+  expect_filtered(list_tokens, "a {b {c}} \"d {e} f\"\n g");
+  struct gramparser * gp = new_token_parser(gram_tokens, true);
+  assert(gramparser_get_filter_mode(gp, SP_TOKEN) == FILTER_AST_DISCARD);
+  assert(!gramparser_set_filter_mode(gp, "undefined", FILTER_AST_LEAF));
+  int last = 0;
+  struct ast * a = parse("hello world {foo bar} taz!", gramparser_get_gram(gp, MAIN_TOKEN), &last);
+  printf("ast=%p, last=%d\n", a, last);
+  assert(a && a->user_data == MAIN_TOKEN);
+  // main > words > bare bare braces bare, with neither the line nor the spaces.
+  struct ast * purged = purge_ast(a);
+  struct ast * words = purged->children[0];
+  assert(words && words->user_data == WORDS_TOKEN && !purged->children[1]);
+  assert(words->children[2]->user_data == BRACES_TOKEN && !words->children[2]->children[0]);
+  assert(words->children[3] && !words->children[4]);
+  free_ast(purged);
+  free_ast(a);
+  free_gramparser(gp);
+  printf("gramparser-test3 passed!\n");
   return 0;
 }
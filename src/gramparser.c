@@ -1,21 +1,36 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
+#include "gram-private.h"
 #include "gramparser.h"
 
+// an entry of a hash table keyed by name, chained in its bucket.
+struct named {
+  struct named * next;
+  const char * name;
+};
+
+struct name_table {
+  struct named ** buckets;
+  int size, count;
+};
+
 struct def {
+  struct named named; // in gp->defs_by_name.
   struct def * next;
-  const char * name;
   struct gram * gram;
+  bool owns_name; // name was copied by gramparser_add_peg.
 };
 
 struct undef_ref {
-  struct undef_ref * next;
-  char * name; // this always refers malloced ram. Must be freed on resolve.
+  // in gp->undef_refs. Its name always refers malloced ram, it must be
+  // freed on resolve.
+  struct named named;
   struct gram * parent;
   int num_child;
 };
@@ -26,8 +41,8 @@ struct gram_list {
 };
 
 struct gramparser {
-  struct def * defs;
-  struct undef_ref * undef_refs;
+  struct def * defs, ** defs_tail; // in definition order.
+  struct name_table defs_by_name, undef_refs;
   struct gram_list * freeable_grammars;
 };
 
@@ -58,155 +73,211 @@ static const char escaped_codes[] = {
   0};
 
 static struct gram * add_freeable_gram(struct gramparser * gp, struct gram * g);
+static struct def * find_def(struct gramparser * gp, const char * name);
 
-void init_gramparser(void) {
-  if (peggrammar) // already initialized.
-    return;
+static unsigned hash_name(const char * name) {
+  unsigned h = 2166136261u; // FNV-1a
+  while (*name)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h;
+}
+
+// the link to the first entry named name (pointing to NULL if none).
+static struct named ** name_table_find(struct name_table * t, const char * name) {
+  struct named ** link;
+  for (link = &t->buckets[hash_name(name) & (t->size - 1)]; *link; link = &(*link)->next)
+    if (!strcmp((*link)->name, name))
+      break;
+  return link;
+}
+
+static void name_table_init(struct name_table * t) {
+  t->size = 16;
+  t->count = 0;
+  t->buckets = calloc(t->size, sizeof (struct named *));
+}
+
+static void name_table_add(struct name_table * t, struct named * e) {
+  struct named ** link;
+  int i, old_size = t->size;
+  // grown to about one entry per bucket.
+  if (t->count == t->size) {
+    struct named ** old = t->buckets, * o, * next;
+    t->size *= 2;
+    t->buckets = calloc(t->size, sizeof (struct named *));
+    for (i = 0; i < old_size; i++)
+      for (o = old[i]; o; o = next) {
+	next = o->next;
+	link = &t->buckets[hash_name(o->name) & (t->size - 1)];
+	o->next = *link;
+	*link = o;
+      }
+    free(old);
+  }
+  link = &t->buckets[hash_name(e->name) & (t->size - 1)];
+  e->next = *link;
+  *link = e;
+  t->count++;
+}
+
+// unchains the entry link points to, returning it.
+static struct named * name_table_remove(struct name_table * t, struct named ** link) {
+  struct named * e = *link;
+  *link = e->next;
+  t->count--;
+  return e;
+}
+
+// calls fn for every entry (which fn may free).
+static void name_table_foreach(struct name_table * t, void (*fn)(struct named * e)) {
+  struct named * e, * next;
+  int i;
+  for (i = 0; i < t->size; i++)
+    for (e = t->buckets[i]; e; e = next) {
+      next = e->next;
+      fn(e);
+    }
+}
+
+// adds the chars from..to to a class bitmap (see new_gram_class).
+static void set_range(unsigned char * set, int from, int to) {
+  for (; from <= to; from++)
+    set[from >> 3] |= 1 << (from & 7);
+}
+
+// builds peggrammar, once (see init_gramparser).
+/****** GRAMMAR FOR GRAMMAR PARSING :D ******/
+// laid out at compile time, so only its analysis is left for
+// init_gramparser (into the dispatch tables given to the alternations).
+
+#define PEG_STRING(name, user_data, text) \
+  static struct gram_string name = { \
+    GRAM_STATIC(user_data, GRAM_STRING, gram_string_matcher), sizeof text - 1, text}
+#define PEG_CLASS(name, ...) \
+  static struct gram_class name = { \
+    GRAM_STATIC(NULL, GRAM_CLASS, gram_class_matcher), {__VA_ARGS__}}
+#define PEG_CHILD(name, user_data, type, matcher, child) \
+  static struct gram_child name = {GRAM_STATIC(user_data, type, matcher), child}
+#define PEG_CHILDREN(...) {__VA_ARGS__, NULL}
+#define PEG_CAT(name, user_data, ...) \
+  static struct gram_children name = { \
+    GRAM_STATIC(user_data, GRAM_CAT, gram_cat_matcher), NULL, PEG_CHILDREN(__VA_ARGS__)}
+#define PEG_ALT(name, user_data, ...) \
+  static unsigned short name##_dispatch[256]; \
+  static struct gram_children name = { \
+    GRAM_STATIC(user_data, GRAM_ALT, gram_alt_matcher), name##_dispatch, PEG_CHILDREN(__VA_ARGS__)}
+
+// the grammar is recursive through alt.
+static struct gram_children peg_alt;
+
+// anychar = .;
+static struct gram peg_anychar = GRAM_STATIC(NULL, GRAM_DOT, gram_dot_matcher);
+
+// backslash = '\\';
+PEG_STRING(peg_backslash, NULL, "\\");
+
+// blanks = ((' ' / '\t'..'\r') / '#' (!'\n' .)*)*;  # <- comments
+PEG_CLASS(peg_space, [1] = 0x3e, [4] = 0x01);
+PEG_STRING(peg_hash, NULL, "#");
+static struct gram_span peg_comment_text = {
+  GRAM_STATIC(NULL, GRAM_SPAN, gram_span_matcher), 0,
+  {[0 ... 31] = 0xff, [1] = 0xfb}, // but '\n'
+  2, {0x00, 0x0b}, {0x09, 0xf4}
+};
+PEG_CAT(peg_comment, NULL, &peg_hash.gram, &peg_comment_text.gram);
+PEG_ALT(peg_blank, NULL, &peg_space.gram, &peg_comment.gram);
+PEG_CHILD(peg_blanks, NULL, GRAM_ASTER, gram_aster_matcher, &peg_blank.gram);
+
+// dot = '.';
+PEG_STRING(peg_dot, DOT_GRAM, ".");
+
+// char = '\'' ('\\' . / .) '\'';
+PEG_STRING(peg_quote, NULL, "'");
+PEG_CAT(peg_escaped, NULL, &peg_backslash.gram, &peg_anychar);
+PEG_ALT(peg_char_body, NULL, &peg_escaped.gram, &peg_anychar);
+PEG_CAT(peg_char, CHAR_GRAM, &peg_quote.gram, &peg_char_body.gram, &peg_quote.gram);
+
+// str = '"' ('\\' . / !'"' .)* '"';
+PEG_STRING(peg_dquote, NULL, "\"");
+PEG_CLASS(peg_not_dquote, [0 ... 31] = 0xff, [4] = 0xfb);
+PEG_ALT(peg_str_char, NULL, &peg_escaped.gram, &peg_not_dquote.gram);
+PEG_CHILD(peg_str_chars, NULL, GRAM_ASTER, gram_aster_matcher, &peg_str_char.gram);
+PEG_CAT(peg_str, STR_GRAM, &peg_dquote.gram, &peg_str_chars.gram, &peg_dquote.gram);
+
+// nt = ('A'..'Z' / 'a'..'z' / '_') ('A'..'Z' / 'a'..'z' / '_' / '0'..'9')*;
+PEG_CLASS(peg_nt_first, [8] = 0xfe, [9] = 0xff, [10] = 0xff, [11] = 0x87,
+    [12] = 0xfe, [13] = 0xff, [14] = 0xff, [15] = 0x07);
+static struct gram_span peg_nt_rest = {
+  GRAM_STATIC(NULL, GRAM_SPAN, gram_span_matcher), 0,
+  {[6] = 0xff, [7] = 0x03, [8] = 0xfe, [9] = 0xff, [10] = 0xff, [11] = 0x87,
+    [12] = 0xfe, [13] = 0xff, [14] = 0xff, [15] = 0x07},
+  4, {'0', 'A', '_', 'a'}, {9, 25, 0, 25}
+};
+PEG_CAT(peg_nt, NT_GRAM, &peg_nt_first.gram, &peg_nt_rest.gram);
+
+// range = char blanks ".." blanks char;
+PEG_STRING(peg_dots, NULL, "..");
+PEG_CAT(peg_range, RANGE_GRAM, &peg_char.gram, &peg_blanks.gram, &peg_dots.gram, &peg_char.gram);
+
+// atom = range / char / str / nt / '(' alt ')' / dot;
+PEG_STRING(peg_open, NULL, "(");
+PEG_STRING(peg_close, NULL, ")");
+PEG_CAT(peg_parens, NULL, &peg_open.gram, &peg_alt.gram, &peg_close.gram);
+PEG_ALT(peg_atom, NULL, &peg_range.gram, &peg_char.gram, &peg_str.gram, &peg_nt.gram,
+    &peg_parens.gram, &peg_dot.gram);
 
-  /****** GRAMMAR FOR GRAMMAR PARSING :D ******/
-  // anychar = .;
-  struct gram * anychar = new_gram_dot(NULL);
-
-  // backslash = '\\';
-  struct gram * backslash = new_gram_string(NULL, "\\");
-
-  // blanks = (' ' / '\t' / '\n' / '\v' / '\f' / '\r' / '#' (!'\n' .)*)*;  # <- comments
-  struct gram * blanks_gram = new_gram_aster(NULL,
-      new_gram_alt(NULL,
-	  new_gram_string(NULL, " "),
-	  new_gram_range(NULL, '\t', '\r'),
-	  new_gram_cat(NULL, //comment
-	      new_gram_string(NULL, "#"),
-	      new_gram_aster(NULL,
-		  new_gram_cat(NULL,
-		      new_gram_negla(NULL,
-			  new_gram_string(NULL, "\n")),
-		      anychar)))));
-
-  // dot = '.';
-  struct gram * dot_gram = new_gram_string((void*)DOT_GRAM, ".");
-
-  // '\'' ('\\' . / .) '\'';
-  struct gram * char_gram;
-  {
-    struct gram * a = new_gram_string(NULL, "'");
-    char_gram = new_gram_cat((void*)CHAR_GRAM,
-	a,
-	new_gram_alt(NULL,
-	    new_gram_cat(NULL, backslash, anychar),
-	    anychar),
-	a);
-  }
-
-  // str = '"' ('\\' . / !'"' .)* '"';
-  struct gram * str_gram;
-  {
-    struct gram * quote = new_gram_string(NULL, "\"");
-    str_gram = new_gram_cat((void*)STR_GRAM,
-	quote,
-	new_gram_aster(NULL,
-	    new_gram_alt(NULL,
-		new_gram_cat(NULL, backslash, anychar),
-		new_gram_cat(NULL, new_gram_negla(NULL, quote), anychar))),
-	quote);
-  }
-
-  // nt = ('A'..'Z' / 'a'..'z' / '_') ('A'..'Z' / 'a'..'z' / '_' / '0'..'9')*;
-  struct gram * nt_gram;
-  {
-    // hidden grammar t = ('A'..'Z' / 'a'..'z' / '_');
-    struct gram * t = new_gram_alt(NULL,
-	new_gram_range(NULL, 'A', 'Z'),
-	new_gram_range(NULL, 'a', 'z'),
-	new_gram_string(NULL, "_"));
-    // then, nt = t (t / '0'..'9')*;
-    nt_gram = new_gram_cat((void*)NT_GRAM,
-	t,
-	new_gram_aster(NULL,
-	    new_gram_alt(NULL,
-		t,
-		new_gram_range(NULL, '0', '9'))));
-  }
-
-  // range = char blanks ".." blanks char;
-  struct gram * range_gram = new_gram_cat((void*)RANGE_GRAM,
-      char_gram,
-      blanks_gram,
-      new_gram_string(NULL, ".."),
-      char_gram);
-
-  struct gram * tmp_gram; // this tmp var is used to keep a reference so we
-			  // can set the cyclic reference.
-  // atom = range / char / str / nt / '(' alt ')' / dot;
-  struct gram * atom_gram = new_gram_alt(NULL,
-      range_gram,
-      char_gram,
-      str_gram,
-      nt_gram,
-      tmp_gram = new_gram_cat(NULL,
-	  new_gram_string(NULL, "("),
-	  (void*)(-1), // here goes reference to alt_gram
-	  new_gram_string(NULL, ")")),
-      dot_gram);
-
-  // cuant = atom blanks (cuantopt / cuantaster / cuantplus)?;
-  struct gram * cuant_gram = new_gram_cat((void*)CUANT_GRAM,
-      atom_gram,
-      blanks_gram,
-      new_gram_opt(NULL,
-	  new_gram_alt(NULL,
-	      new_gram_string((void*)OPT_CUANT, "?"),
-	      new_gram_string((void*)ASTER_CUANT, "*"),
-	      new_gram_string((void*)PLUS_CUANT, "+"))));
-
-  // negla = '!' blanks cuant;
-  struct gram * negla_gram = new_gram_cat((void*)NEGLA_GRAM,
-      new_gram_string(NULL, "!"),
-      blanks_gram,
-      cuant_gram);
-
-  // posla = '&' blanks cuant;
-  struct gram * posla_gram = new_gram_cat((void*)POSLA_GRAM,
-      new_gram_string(NULL, "&"),
-      blanks_gram,
-      cuant_gram);
-
-  // la = negla / posla / cuant;
-  struct gram * la_gram = new_gram_alt(NULL,
-      negla_gram, posla_gram, cuant_gram, NULL);
-
-  // cat = (la blanks)+; # use "" for epsilon productions
-  struct gram * cat_gram = new_gram_plus((void*)CAT_GRAM,
-      new_gram_cat(NULL,
-	  la_gram,
-	  blanks_gram));
-
-  // alt = blanks cat blanks ('/' blanks cat blanks)*
-  struct gram * alt_gram = new_gram_cat((void*)ALT_GRAM,
-      blanks_gram,
-      cat_gram,
-      blanks_gram,
-      new_gram_aster(NULL,
-	  new_gram_cat(NULL,
-	      new_gram_string(NULL, "/"),
-	      blanks_gram,
-	      cat_gram,
-	      blanks_gram)));
-
-  // add cyclic reference for infinite grammar:
-  gram_set_child(tmp_gram, alt_gram, 1);
-
-  // root non-terminal for grammars is = alt !.
-  peggrammar = new_gram_cat(NULL,
-      alt_gram,
-      new_gram_negla(NULL, anychar));
+// cuant = atom blanks (cuantopt / cuantaster / cuantplus)?;
+PEG_STRING(peg_opt_cuant, OPT_CUANT, "?");
+PEG_STRING(peg_aster_cuant, ASTER_CUANT, "*");
+PEG_STRING(peg_plus_cuant, PLUS_CUANT, "+");
+PEG_ALT(peg_cuants, NULL, &peg_opt_cuant.gram, &peg_aster_cuant.gram, &peg_plus_cuant.gram);
+PEG_CHILD(peg_cuant_opt, NULL, GRAM_OPT, gram_opt_matcher, &peg_cuants.gram);
+PEG_CAT(peg_cuant, CUANT_GRAM, &peg_atom.gram, &peg_blanks.gram, &peg_cuant_opt.gram);
+
+// negla = '!' blanks cuant;
+PEG_STRING(peg_bang, NULL, "!");
+PEG_CAT(peg_negla, NEGLA_GRAM, &peg_bang.gram, &peg_blanks.gram, &peg_cuant.gram);
+
+// posla = '&' blanks cuant;
+PEG_STRING(peg_amp, NULL, "&");
+PEG_CAT(peg_posla, POSLA_GRAM, &peg_amp.gram, &peg_blanks.gram, &peg_cuant.gram);
+
+// la = negla / posla / cuant;
+PEG_ALT(peg_la, NULL, &peg_negla.gram, &peg_posla.gram, &peg_cuant.gram);
+
+// cat = (la blanks)+; # use "" for epsilon productions
+PEG_CAT(peg_la_blanks, NULL, &peg_la.gram, &peg_blanks.gram);
+PEG_CHILD(peg_cat, CAT_GRAM, GRAM_PLUS, gram_plus_matcher, &peg_la_blanks.gram);
+
+// alt = blanks cat blanks ('/' blanks cat blanks)*
+PEG_STRING(peg_slash, NULL, "/");
+PEG_CAT(peg_more_cats, NULL, &peg_slash.gram, &peg_blanks.gram, &peg_cat.gram, &peg_blanks.gram);
+PEG_CHILD(peg_more_cats_aster, NULL, GRAM_ASTER, gram_aster_matcher, &peg_more_cats.gram);
+static struct gram_children peg_alt = {
+  GRAM_STATIC(ALT_GRAM, GRAM_CAT, gram_cat_matcher), NULL,
+  PEG_CHILDREN(&peg_blanks.gram, &peg_cat.gram, &peg_blanks.gram, &peg_more_cats_aster.gram)
+};
+
+// root non-terminal for grammars is = alt !.
+PEG_CHILD(peg_end, NULL, GRAM_NEGLA, gram_negla_matcher, &peg_anychar);
+PEG_CAT(peg_grammar, NULL, &peg_alt.gram, &peg_end.gram);
+
+static void build_peggrammar(void) {
+  peggrammar = gram_freeze(&peg_grammar.gram);
+}
+
+void init_gramparser(void) {
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, build_peggrammar);
 }
 
 struct gramparser * new_gramparser(void) {
   init_gramparser(); // make sure it's initialized...
   struct gramparser * gp = malloc(sizeof (struct gramparser));
   gp->defs = NULL;
-  gp->undef_refs = NULL;
+  gp->defs_tail = &gp->defs;
+  name_table_init(&gp->defs_by_name);
+  name_table_init(&gp->undef_refs);
   gp->freeable_grammars = NULL;
   return gp;
 }
@@ -248,6 +319,104 @@ static char decode_char(const char * def, struct ast * ast) {
   return c;
 }
 
+// writes the NUL terminated text of a str into str (if not NULL), and
+// returns its length.
+static int decode_string(const char * def, struct ast * ast, char * str) {
+  int i, j, len = 0;
+  assert(STR_GRAM == (intptr_t)ast->user_data);
+  for (i = 1; i < ast->len - 1; i++) {
+    char c = def[ast->from + i];
+    if (c == '\\') {
+      c = def[ast->from + ++i];
+      for (j = 0; escaped_codes[j]; j += 2)
+	if (c == escaped_codes[j]) {
+	  c = escaped_codes[j+1];
+	  break;
+	}
+    }
+    if (str)
+      str[len] = c;
+    len++;
+  }
+  if (str)
+    str[len] = 0;
+  return len;
+}
+
+// the nodes with a single child are compiled as that child.
+static struct ast * unwrap_ast(struct ast * ast) {
+  int type = (intptr_t)ast->user_data;
+  while (ast->children[0] && !ast->children[1]
+      && (type == ALT_GRAM || type == CAT_GRAM || type == CUANT_GRAM)) {
+    ast = ast->children[0];
+    type = (intptr_t)ast->user_data;
+  }
+  return ast;
+}
+
+static bool class_from_ast(const char * def, struct ast * ast, unsigned char * set);
+
+// whether ast[0], ast[1]... is a run of n >= 1 negative lookaheads of
+// classes followed by a dot, i.e. !X !Y ... . which is the class of the
+// chars in none of them.
+static bool negated_class_from_ast(const char * def, struct ast ** ast, int * n,
+    unsigned char * set) {
+  unsigned char bits[32] = {0};
+  int i, j;
+  for (i = 0; ast[i] && NEGLA_GRAM == (intptr_t)unwrap_ast(ast[i])->user_data; i++)
+    if (!class_from_ast(def, unwrap_ast(ast[i])->children[0], bits))
+      return false;
+  if (!i || !ast[i] || DOT_GRAM != (intptr_t)unwrap_ast(ast[i])->user_data)
+    return false;
+  for (j = 0; j < 32; j++)
+    set[j] |= ~bits[j];
+  *n = i + 1;
+  return true;
+}
+
+/**
+ * whether ast always matches a single char: a char, a one char str, a
+ * range, an alternation of those, or !X .; if so its chars are added to set.
+ */
+static bool class_from_ast(const char * def, struct ast * ast, unsigned char * set) {
+  unsigned char bits[32] = {0};
+  char str[2];
+  int i, n, c;
+  ast = unwrap_ast(ast);
+  switch ((intptr_t)ast->user_data) {
+    case CHAR_GRAM:
+      c = (unsigned char)decode_char(def, ast);
+      set_range(bits, c, c);
+      break;
+    case STR_GRAM:
+      if (decode_string(def, ast, NULL) != 1)
+	return false;
+      decode_string(def, ast, str);
+      c = (unsigned char)str[0];
+      set_range(bits, c, c);
+      break;
+    case RANGE_GRAM:
+      // ranges compare chars, whatever their signedness.
+      for (i = decode_char(def, ast->children[0]); i <= decode_char(def, ast->children[1]); i++)
+	set_range(bits, (unsigned char)i, (unsigned char)i);
+      break;
+    case ALT_GRAM:
+      for (i = 0; ast->children[i]; i++)
+	if (!class_from_ast(def, ast->children[i], bits))
+	  return false;
+      break;
+    case CAT_GRAM:
+      if (!negated_class_from_ast(def, ast->children, &n, bits) || ast->children[n])
+	return false;
+      break;
+    default:
+      return false;
+  }
+  for (i = 0; i < 32; i++)
+    set[i] |= bits[i];
+  return true;
+}
+
 struct gram_thunk {
   struct gram * gram;
   struct undef_ref * undef_ref;
@@ -292,18 +461,34 @@ static struct gram_thunk gram_from_ast(struct gramparser * gp, const char * def,
       {
 	struct gram * children[children_count + 1];
 	struct gram ** parent_ptrs[children_count];
-	int parent_ptrs_count = 0;
-	for (i = 0; ast->children[i]; i++) {
-	  struct gram_thunk gt = gram_from_ast(gp, def, ast->children[i]);
+	int parent_ptrs_count = 0, n = 0;
+	unsigned char set[32] = {0};
+	if (class_from_ast(def, ast, set))
+	  return (struct gram_thunk){add_freeable_gram(gp, new_gram_class(NULL, set, 0)), NULL};
+	for (i = 0; ast->children[i]; n++) {
+	  int run = 0;
+	  // runs of single chars are matched with a class instead.
+	  memset(set, 0, sizeof set);
+	  if (type == ALT_GRAM)
+	    while (ast->children[i + run] && class_from_ast(def, ast->children[i + run], set))
+	      run++;
+	  else if (!negated_class_from_ast(def, ast->children + i, &run, set))
+	    run = 0;
+	  if (run > 1) {
+	    children[n] = add_freeable_gram(gp, new_gram_class(NULL, set, 0));
+	    i += run;
+	    continue;
+	  }
+	  struct gram_thunk gt = gram_from_ast(gp, def, ast->children[i++]);
 	  if (gt.gram) {
-	    children[i] = gt.gram;
+	    children[n] = gt.gram;
 	  } else {
 	    parent_ptrs[parent_ptrs_count++] = &(gt.undef_ref->parent);
-	    gt.undef_ref->num_child = i;
-	    children[i] = (struct gram *)-1;
+	    gt.undef_ref->num_child = n;
+	    children[n] = (struct gram *)-1;
 	  }
 	}
-	children[children_count] = NULL;
+	children[n] = NULL;
 	struct gram * res;
 	if (type == ALT_GRAM)
 	  res = new_gram_alt_arr(NULL, children);
@@ -321,6 +506,14 @@ static struct gram_thunk gram_from_ast(struct gramparser * gp, const char * def,
     case CUANT_GRAM:
       {
 	struct gram * res, * child;
+	unsigned char set[32] = {0};
+	// repeated single chars are matched as a run.
+	if (type == CUANT_GRAM && (intptr_t)ast->children[1]->user_data != OPT_CUANT
+	    && class_from_ast(def, ast->children[0], set)) {
+	  res = new_gram_span(NULL, set, 0,
+	      (intptr_t)ast->children[1]->user_data == PLUS_CUANT);
+	  return (struct gram_thunk){add_freeable_gram(gp, res), NULL};
+	}
 	struct gram_thunk gt = gram_from_ast(gp, def, ast->children[0]);
 	if (gt.gram) {
 	  child = gt.gram;
@@ -371,41 +564,21 @@ static struct gram_thunk gram_from_ast(struct gramparser * gp, const char * def,
 	strncpy(buff, def + ast->from, ast->len);
 	buff[ast->len] = 0;
 	// look in defs:
-	struct def * def = gp->defs;
-	while (def) {
-	  if (!strcmp(def->name, buff))
-	    return (struct gram_thunk){def->gram, NULL};
-	  def = def->next;
-	}
+	struct def * def = find_def(gp, buff);
+	if (def)
+	  return (struct gram_thunk){def->gram, NULL};
 	struct undef_ref * undef_ref = malloc(sizeof (struct undef_ref));
 	memset(undef_ref, 0, sizeof (struct undef_ref));
-	undef_ref->name = malloc(ast->len + 1);
-	strcpy(undef_ref->name, buff);
-	undef_ref->next = gp->undef_refs;
-	gp->undef_refs = undef_ref;
+	char * name = malloc(ast->len + 1);
+	strcpy(name, buff);
+	undef_ref->named.name = name;
+	name_table_add(&gp->undef_refs, &undef_ref->named);
 	return (struct gram_thunk){NULL, undef_ref};
       }
     case STR_GRAM:
       {
-	int outchars = 0;
-	for (i = 1; i < ast->len - 1; i++) {
-	  outchars++;
-	  if (def[ast->from + i] == '\\')
-	    i++;
-	}
-	char * str = malloc(outchars+1);
-	outchars = 0;
-	for (i = 1; i < ast->len - 1; i++) {
-	  char c = def[ast->from + i];
-	  if (c == '\\') {
-	    c = def[ast->from + ++i];
-	    for (i = 0; escaped_codes[i]; i += 2)
-	      if (c == escaped_codes[i])
-		c = escaped_codes[i+1];
-	  }
-	  str[outchars++] = c;
-	}
-	str[outchars] = 0;
+	char * str = malloc(decode_string(def, ast, NULL) + 1);
+	decode_string(def, ast, str);
 	struct gram * g = new_gram_string(NULL, str);
 	add_freeable_gram(gp, g);
 	free(str);
@@ -487,7 +660,7 @@ int gramparser_add(struct gramparser * gp, const char * name, const char * def)
 static struct gram * add_freeable_gram(struct gramparser * gp, struct gram * g) {
   assert(gp);
   assert(g);
-  struct gram_list * item = malloc(sizeof (struct gram_list *));
+  struct gram_list * item = malloc(sizeof (struct gram_list));
   item->next = gp->freeable_grammars;
   item->gram = g;
   gp->freeable_grammars = item;
@@ -512,23 +685,26 @@ void gramparser_add_gram(struct gramparser * gp, const char * name, struct gram
     exit(1);
   }
   struct def * def = malloc(sizeof (struct def));
-  def->next = gp->defs;
-  def->name = name;
+  def->next = NULL;
+  def->named.name = name;
   def->gram = g;
-  gp->defs = def;
-  struct undef_ref ** urefs = &gp->undef_refs;
-  while (*urefs) {
-    if (!strcmp((*urefs)->name, name)) {
-      struct undef_ref * next = (*urefs)->next;
-      free((*urefs)->name);
-      gram_set_child((*urefs)->parent, g, (*urefs)->num_child);
-      free(*urefs);
-      *urefs = next;
-    } else
-      urefs = &(*urefs)->next;
+  def->owns_name = false;
+  *gp->defs_tail = def;
+  gp->defs_tail = &def->next;
+  name_table_add(&gp->defs_by_name, &def->named);
+  struct named ** link;
+  while (*(link = name_table_find(&gp->undef_refs, name))) {
+    struct undef_ref * uref = (struct undef_ref *)name_table_remove(&gp->undef_refs, link);
+    gram_set_child(uref->parent, g, uref->num_child);
+    free((char *)uref->named.name);
+    free(uref);
   }
 }
 
+static struct def * find_def(struct gramparser * gp, const char * name) {
+  return (struct def *)*name_table_find(&gp->defs_by_name, name);
+}
+
 struct gram * gramparser_get_gram(struct gramparser * gp, const char * name) {
   if (!gp) {
     fprintf(stderr, "ERROR: gramparser_get_gram: gp is NULL\n");
@@ -538,14 +714,16 @@ struct gram * gramparser_get_gram(struct gramparser * gp, const char * name) {
     fprintf(stderr, "WARNING: gramparser_get_gram: name is NULL\n");
     return NULL;
   }
-  struct def * def = gp->defs;
-  while (def) {
-    if (!strcmp(def->name, name))
-      return def->gram;
-    def = def->next;
-  }
-  return NULL; // not found:
+  struct def * def = find_def(gp, name);
+  return def ? def->gram : NULL; // NULL if not found.
+}
+
+#ifdef DEBUG
+static void print_undef_ref(struct named * e) {
+  struct undef_ref * u = (struct undef_ref *)e;
+  printf("undef_ref{name=%s, parent=%p, num_child=%d}\n", e->name, u->parent, u->num_child);
 }
+#endif
 
 bool gramparser_is_complete(struct gramparser * gp) {
   if (!gp) {
@@ -553,27 +731,295 @@ bool gramparser_is_complete(struct gramparser * gp) {
     exit(1);
   }
 #ifdef DEBUG
-  struct undef_ref * u = gp->undef_refs;
-  while (u) {
-    printf("undef_ref{name=%s, parent=%p, num_child=%d}\n", u->name, u->parent, u->num_child);
-    u = u->next;
-  }
+  name_table_foreach(&gp->undef_refs, &print_undef_ref);
 #endif
-  return !gp->undef_refs;
+  return !gp->undef_refs.count;
+}
+
+void gramparser_foreach(struct gramparser * gp,
+    void (*fn)(const char * name, struct gram * g, void * privdata),
+    void * privdata) {
+  if (!gp) {
+    fprintf(stderr, "ERROR: gramparser_foreach: gp is NULL\n");
+    exit(1);
+  }
+  struct def * def;
+  for (def = gp->defs; def; def = def->next)
+    fn(def->named.name, def->gram, privdata);
+}
+
+struct def_gram {
+  struct gram * gram;
+  int pos; // in gp->defs.
+};
+
+struct optimize_data {
+  struct gramparser * gp;
+  struct def ** defs; // by position in gp->defs.
+  struct def_gram * by_gram; // sorted.
+  int count;
+  bool * reached; // by position in gp->defs.
+};
+
+static int compare_def_grams(const void * a, const void * b) {
+  uintptr_t x = (uintptr_t)((const struct def_gram *)a)->gram;
+  uintptr_t y = (uintptr_t)((const struct def_gram *)b)->gram;
+  return x < y ? -1 : x > y;
+}
+
+// points the defs to the copies of their grams.
+static void on_optimized_copy(struct gram * gram, struct gram * copy, int created, void * privdata) {
+  struct optimize_data * data = privdata;
+  int lo = 0, hi = data->count, mid;
+  if (created)
+    add_freeable_gram(data->gp, copy);
+  if (!gram)
+    return;
+  // the first def of gram, if any (several names may have the same gram).
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if ((uintptr_t)data->by_gram[mid].gram < (uintptr_t)gram)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < data->count && data->by_gram[lo].gram == gram; lo++) {
+    data->defs[data->by_gram[lo].pos]->gram = copy;
+    data->reached[data->by_gram[lo].pos] = true;
+  }
+}
+
+bool gramparser_optimize(struct gramparser * gp, const char * start) {
+  if (!gp) {
+    fprintf(stderr, "ERROR: gramparser_optimize: gp is NULL\n");
+    exit(1);
+  }
+  struct def * def = start ? find_def(gp, start) : NULL;
+  if (!def || !gramparser_is_complete(gp))
+    return false;
+  struct gram * gram = def->gram;
+  struct optimize_data data = {gp, NULL, NULL, gp->defs_by_name.count, NULL};
+  int i;
+  data.defs = malloc(sizeof (struct def *) * data.count);
+  data.by_gram = malloc(sizeof (struct def_gram) * data.count);
+  data.reached = calloc(data.count, sizeof (bool));
+  for (def = gp->defs, i = 0; def; def = def->next, i++) {
+    data.defs[i] = def;
+    data.by_gram[i] = (struct def_gram){def->gram, i};
+  }
+  qsort(data.by_gram, data.count, sizeof (struct def_gram), &compare_def_grams);
+  gram_optimize(gram, &on_optimized_copy, &data);
+  // the rules that weren't reached are dropped.
+  gp->defs_tail = &gp->defs;
+  for (i = 0; i < data.count; i++) {
+    def = data.defs[i];
+    if (data.reached[i]) {
+      *gp->defs_tail = def;
+      gp->defs_tail = &def->next;
+      continue;
+    }
+    name_table_remove(&gp->defs_by_name, name_table_find(&gp->defs_by_name, def->named.name));
+    if (def->owns_name)
+      free((char *)def->named.name);
+    free(def);
+  }
+  *gp->defs_tail = NULL;
+  free(data.defs);
+  free(data.by_gram);
+  free(data.reached);
+  return true;
+}
+
+enum filter_ast_mode gramparser_get_filter_mode(struct gramparser * gp, const char * name) {
+  if (!gp) {
+    fprintf(stderr, "ERROR: gramparser_get_filter_mode: gp is NULL\n");
+    exit(1);
+  }
+  struct def * def = find_def(gp, name);
+  return def ? gram_get_filter(def->gram) : FILTER_AST_KEEP;
+}
+
+bool gramparser_set_filter_mode(struct gramparser * gp, const char * name, enum filter_ast_mode mode) {
+  if (!gp) {
+    fprintf(stderr, "ERROR: gramparser_set_filter_mode: gp is NULL\n");
+    exit(1);
+  }
+  struct def * def = find_def(gp, name);
+  if (!def)
+    return false;
+  gram_set_filter(def->gram, mode);
+  return true;
+}
+
+static const char * filter_modes[] = {
+  "KEEP", "ONLY_KEEP_CHILDREN", "LEAF", "DISCARD", NULL
+};
+
+// adds a rule read from a .peg file, copying its name.
+static int add_peg_rule(struct gramparser * gp, const char * name, int name_len,
+    const char * def, enum filter_ast_mode mode, int line) {
+  char * copy = malloc(name_len + 1);
+  memcpy(copy, name, name_len);
+  copy[name_len] = 0;
+  if (gramparser_get_gram(gp, copy)) {
+    // e.g. a keyword listed twice.
+    free(copy);
+    return -1;
+  }
+  if (gramparser_add(gp, copy, def) >= 0) {
+    fprintf(stderr, "gramparser_add_peg: syntax error in rule %s at line %d.\n", copy, line);
+    free(copy);
+    return line;
+  }
+  struct def * d = find_def(gp, copy);
+  gram_set_filter(d->gram, mode);
+  d->owns_name = true;
+  return -1;
+}
+
+int gramparser_add_peg(struct gramparser * gp, const char * peg) {
+  if (!gp) {
+    fprintf(stderr, "ERROR: gramparser_add_peg: gp is NULL\n");
+    exit(1);
+  }
+  int line = 1, def_line = 0, def_size = 256, def_len = 0;
+  const char * p = peg, * name = NULL;
+  int name_len = 0;
+  char * def = malloc(def_size);
+  while (*p) {
+    const char * eol = strchr(p, '\n');
+    if (!eol)
+      eol = p + strlen(p);
+    const char * q = p;
+    while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r'))
+      q++;
+    if (!name && q < eol && *q == '@') {
+      // @KEYWORD w1 w2 ...: w_kw = ('W'/'w')... !ident_char;
+      if (strncmp(q, "@KEYWORD", 8) || (q[8] != ' ' && q[8] != '\t')) {
+	fprintf(stderr, "gramparser_add_peg: unknown annotation at line %d.\n", line);
+	free(def);
+	return line;
+      }
+      for (q += 8; q < eol; ) {
+	while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r'))
+	  q++;
+	const char * w = q;
+	while (q < eol && *q != ' ' && *q != '\t' && *q != '\r')
+	  q++;
+	if (q == w)
+	  break;
+	char kw[q - w + 4], kwdef[(q - w) * 10 + 16];
+	int i, len = 0;
+	for (i = 0; i < q - w; i++) {
+	  char c = w[i];
+	  kw[i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	  if (kw[i] >= 'a' && kw[i] <= 'z')
+	    len += sprintf(kwdef + len, "('%c'/'%c')", kw[i] - 'a' + 'A', kw[i]);
+	  else
+	    len += sprintf(kwdef + len, "'%c'", c);
+	}
+	strcpy(kw + i, "_kw");
+	strcpy(kwdef + len, " !ident_char");
+	int res = add_peg_rule(gp, kw, i + 3, kwdef, FILTER_AST_KEEP, line);
+	if (res >= 0) {
+	  free(def);
+	  return res;
+	}
+      }
+    } else if (name || (q < eol && *q != '#')) {
+      const char * start = p;
+      if (!name) {
+	// name = def...
+	name = q;
+	while (q < eol && *q != '=' && *q != ' ' && *q != '\t')
+	  q++;
+	name_len = q - name;
+	while (q < eol && (*q == ' ' || *q == '\t'))
+	  q++;
+	if (!name_len || q == eol || *q != '=') {
+	  fprintf(stderr, "gramparser_add_peg: expected \"name = definition;\" at line %d.\n", line);
+	  free(def);
+	  return line;
+	}
+	start = ++q;
+	def_len = 0;
+	def_line = line;
+      }
+      // copy up to an unquoted ';' (or a comment).
+      char quote = 0;
+      const char * end = NULL;
+      for (; q < eol; q++) {
+	if (quote) {
+	  if (*q == '\\' && q + 1 < eol)
+	    q++;
+	  else if (*q == quote)
+	    quote = 0;
+	} else if (*q == '\'' || *q == '"') {
+	  quote = *q;
+	} else if (*q == ';' || *q == '#') {
+	  end = q;
+	  break;
+	}
+      }
+      const char * stop = end ? end : eol;
+      while (def_len + (stop - start) + 2 > def_size)
+	def = realloc(def, def_size *= 2);
+      memcpy(def + def_len, start, stop - start);
+      def_len += stop - start;
+      def[def_len++] = '\n';
+      def[def_len] = 0;
+      if (end && *end == ';') {
+	enum filter_ast_mode mode = FILTER_AST_KEEP;
+	const char * at = memchr(end, '@', eol - end);
+	if (at && memchr(end, '#', at - end)) {
+	  int i, len = eol - at - 1;
+	  while (len && (at[len] == ' ' || at[len] == '\t' || at[len] == '\r'))
+	    len--;
+	  for (i = 0; filter_modes[i]; i++)
+	    if ((int)strlen(filter_modes[i]) == len && !strncmp(at + 1, filter_modes[i], len))
+	      break;
+	  if (!filter_modes[i]) {
+	    fprintf(stderr, "gramparser_add_peg: unknown mode at line %d.\n", line);
+	    free(def);
+	    return line;
+	  }
+	  mode = i;
+	}
+	int res = add_peg_rule(gp, name, name_len, def, mode, def_line);
+	if (res >= 0) {
+	  free(def);
+	  return res;
+	}
+	name = NULL;
+      }
+    }
+    p = *eol ? eol + 1 : eol;
+    line++;
+  }
+  free(def);
+  if (name) {
+    fprintf(stderr, "gramparser_add_peg: missing ';' after rule at line %d.\n", def_line);
+    return def_line;
+  }
+  return -1;
+}
+
+static void free_undef_ref(struct named * e) {
+  free((char *)e->name);
+  free(e);
 }
 
 void free_gramparser(struct gramparser * gp) {
   struct def * def, * tmp_def;
   for (def = gp->defs; def; def = tmp_def) {
     tmp_def = def->next;
+    if (def->owns_name)
+      free((char *)def->named.name);
     free(def);
   }
-  struct undef_ref * uref, * tmp_uref;
-  for (uref = gp->undef_refs; uref; uref = tmp_uref) {
-    tmp_uref = uref->next;
-    free(uref->name);
-    free(uref);
-  }
+  free(gp->defs_by_name.buckets);
+  name_table_foreach(&gp->undef_refs, &free_undef_ref);
+  free(gp->undef_refs.buckets);
   struct gram_list * fg, * tmp_fg;
   for (fg = gp->freeable_grammars; fg; fg = tmp_fg) {
     tmp_fg = fg->next;
@@ -7,6 +7,10 @@
 
 struct gramparser;
 
+/**
+ * builds the grammar of grammars, only the first time (whatever thread calls
+ * it). new_gramparser calls it too.
+ */
 void init_gramparser(void);
 
 struct gramparser * new_gramparser(void);
@@ -34,6 +38,56 @@ struct gram * gramparser_get_gram(struct gramparser * gp, const char * name);
 
 bool gramparser_is_complete(struct gramparser * gp);
 
+/**
+ * replaces the grammar with its gram_optimize copy from the rule start,
+ * dropping the rules it doesn't reach (the grams given to
+ * gramparser_add_gram are left untouched, as are the old grams, which are
+ * freed along with gp). Then gramparser_get_gram returns the new grams.
+ * It returns false, changing nothing, if start isn't defined or the
+ * grammar isn't complete.
+ */
+bool gramparser_optimize(struct gramparser * gp, const char * start);
+
+/**
+ * adds every rule of a grammar in .peg format, e.g.:
+ *   main = bs (word bs)* !.;
+ *   word = ('a'..'z' / 'A'..'Z')+
+ *        / "'" (!"'" .)* "'";
+ *   bs = (' ' / '\t')*; # @DISCARD
+ *   @KEYWORD select from where
+ * Rules may span several lines and end with a ';', optionally followed by
+ * "# @MODE", where MODE is the name of a filter_ast_mode (KEEP,
+ * ONLY_KEEP_CHILDREN, LEAF or DISCARD) set as the filter of the rule (see
+ * gramparser_set_filter_mode).
+ * "@KEYWORD" lines add a rule w_kw for every word w, matching it in any case
+ * when not followed by an ident_char (a rule which must be defined as well).
+ * Other lines starting with '#' are comments.
+ *   Names are copied, and the keywords listed twice are only added once. It
+ * returns -1 on success, or the line where the first error was found.
+ */
+int gramparser_add_peg(struct gramparser * gp, const char * peg);
+
+/**
+ * the filter of the gram of name (see gram_set_filter), as annotated in
+ * gramparser_add_peg or set by gramparser_set_filter_mode, which filter_ast
+ * may apply as well. FILTER_AST_KEEP for the other rules.
+ */
+enum filter_ast_mode gramparser_get_filter_mode(struct gramparser * gp, const char * name);
+
+/**
+ * sets the filter of the gram of name (see gram_set_filter), so its nodes
+ * are filtered while parsing. It returns false if name isn't defined.
+ */
+bool gramparser_set_filter_mode(struct gramparser * gp, const char * name, enum filter_ast_mode mode);
+
+/**
+ * calls fn for every defined non-terminal (in definition order), with
+ * the same name pointer given to gramparser_add or gramparser_add_gram.
+ */
+void gramparser_foreach(struct gramparser * gp,
+    void (*fn)(const char * name, struct gram * g, void * privdata),
+    void * privdata);
+
 /**
  * This frees the gramparser structure, all the undefined references, and
  * those "struct gram" internally created by gramparser_add().
@@ -0,0 +1,384 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "gram.h"
+#include "gramparser.h"
+#include "gramvm.h"
+
+static int ast_equal(struct ast * a, struct ast * b) {
+  int i;
+  if (!a || !b)
+    return a == b;
+  if (a->user_data != b->user_data || a->from != b->from || a->len != b->len)
+    return 0;
+  for (i = 0; a->children[i] && b->children[i]; i++)
+    if (!ast_equal(a->children[i], b->children[i]))
+      return 0;
+  return !a->children[i] && !b->children[i];
+}
+
+// the program must agree with the combinator engine on everything.
+static void check(struct gram * gram, struct gram_program * prog, const char * text) {
+  int last1 = 0, last2 = 0, last3 = 0;
+  struct ast * ast1 = parse(text, gram, &last1);
+  struct ast * ast2 = parse_program(prog, text, &last2);
+  int len = match_program(prog, text, &last3);
+  printf("matching \"%s\": ast=%p, last=%d, len=%d\n", text, ast2, last2, len);
+  assert(ast_equal(ast1, ast2));
+  assert(last1 == last2 && last2 == last3);
+  assert(ast2 ? len == ast2->len : len == -1);
+  if (ast1) {
+    free_ast(ast1);
+    free_ast(ast2);
+  }
+}
+
+static int digits_matcher(const char * text, int cursor, void * priv_data, struct gram_state * state) {
+  int len = 0;
+  while (text[cursor + len] >= '0' && text[cursor + len] <= '9')
+    len++;
+  gram_state_update_last(state, cursor + len);
+  return len ? len : -1;
+}
+
+void test1(void) {
+  // gram = ('a' / "bc" / &'d' 'd'..'f' / int)* !. / <digits> ' '? 'x'+;
+  struct gram * gram = new_gram_alt((void *)1,
+      new_gram_cat((void *)2,
+	new_gram_aster((void *)3,
+	  new_gram_alt((void *)4,
+	    new_gram_string((void *)5, "a"),
+	    new_gram_string((void *)6, "bc"),
+	    new_gram_cat(NULL,
+	      new_gram_posla((void *)7, new_gram_string(NULL, "d")),
+	      new_gram_range((void *)8, 'd', 'f'),
+	      NULL),
+	    new_gram_int((void *)9))),
+	new_gram_negla((void *)10, new_gram_dot((void *)11)),
+	NULL),
+      new_gram_cat(NULL,
+	new_gram_custom((void *)12, digits_matcher, NULL),
+	new_gram_opt((void *)13, new_gram_string(NULL, " ")),
+	new_gram_plus((void *)14, new_gram_string((void *)15, "x")),
+	NULL),
+      NULL);
+  struct gram_program * prog = compile_gram(gram);
+  dump_gram_program(prog);
+  const char * texts[] = {
+    "", "a", "abcde", "ab", "aa12bc0x1f", "ddd", "dg", "12 xxx", "12xx!", "12 ", "x",
+  };
+  int i;
+  for (i = 0; i < sizeof texts / sizeof texts[0]; i++)
+    check(gram, prog, texts[i]);
+  free_gram_program(prog);
+  printf("test1 passed!\n\n");
+}
+
+void test2(void) {
+  // recursive rules, compiled as subroutines.
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "atom", "('0'..'9')+ / '(' adds ')'");
+  gramparser_add(gp, "mults", "atom ('*' atom)*");
+  gramparser_add(gp, "adds", "mults ('+' mults)*");
+  gramparser_add(gp, "all", "adds !.");
+  assert(gramparser_is_complete(gp));
+  struct gram * gram = gramparser_get_gram(gp, "all");
+  struct gram_program * prog = compile_gram(gram);
+  check(gram, prog, "1+1*(2+1)+3");
+  check(gram, prog, "((((12))))*(3+4*(5))");
+  check(gram, prog, "1+(2*3");
+  check(gram, prog, "1+2)");
+  // nodes of the failed alternatives are discarded from the arena too.
+  struct ast_arena * arena = new_ast_arena();
+  int last1 = 0, last2 = 0;
+  struct ast * ast1 = parse("(1*2)+(3+4)*5", gram, &last1);
+  struct ast * ast2 = parse_program_arena(arena, prog, "(1*2)+(3+4)*5", &last2);
+  assert(ast_equal(ast1, ast2) && last1 == last2);
+  free_ast(ast1);
+  free_ast_arena(arena);
+  free_gram_program(prog);
+  // once analyzed, alternatives are only tried if they may start there.
+  gram_analyze(gram);
+  prog = compile_gram(gram);
+  dump_gram_program(prog);
+  check(gram, prog, "1+1*(2+1)+3");
+  check(gram, prog, "((((12))))*(3+4*(5))");
+  check(gram, prog, "1+(2*3");
+  check(gram, prog, "1+2)");
+  check(gram, prog, "(");
+  free_gram_program(prog);
+  free_gramparser(gp);
+  printf("test2 passed!\n\n");
+}
+
+void test3(void) {
+  // deep nesting doesn't need a deep C stack, nor do the trees built.
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "p", "'(' p? ')'");
+  struct gram * gram = gramparser_get_gram(gp, "p");
+  struct gram_program * prog = compile_gram(gram);
+  int i, n = 1000000, last = 0;
+  char * text = malloc(2 * n + 1);
+  for (i = 0; i < n; i++) {
+    text[i] = '(';
+    text[2 * n - 1 - i] = ')';
+  }
+  text[2 * n] = '\0';
+  assert(match_program(prog, text, &last) == 2 * n && last == 2 * n);
+  struct ast * ast = parse_program(prog, text, &last);
+  assert(ast && ast->len == 2 * n);
+  free_ast(ast);
+  ast = parse_ex(text, gram, &last, PARSE_ITERATIVE);
+  assert(ast && last == 2 * n);
+  struct ast * purged = purge_ast(ast), * node = purged;
+  for (i = 0; i < n - 1; i++)
+    node = node->children[0];
+  assert(node->from == n - 1 && !node->children[0]);
+  free_ast(purged);
+  free_ast(ast);
+  text[n] = '(';
+  assert(match_program(prog, text, &last) == -1);
+  free(text);
+  free_gram_program(prog);
+  // only left recursions are stopped, as an overflow.
+  struct gram_context * ctx = new_gram_context();
+  gramparser_add(gp, "l", "m 'x' / 'x'");
+  gramparser_add(gp, "m", "'y'? l");
+  assert(match_context(ctx, "xxx", 3, gramparser_get_gram(gp, "l"), NULL, PARSE_ITERATIVE) == -1);
+  assert(gram_context_overflow(ctx));
+  assert(match_context(ctx, "()", 2, gram, NULL, PARSE_ITERATIVE) == 2);
+  assert(!gram_context_overflow(ctx));
+  free_gram_context(ctx);
+  free_gramparser(gp);
+  printf("test3 passed!\n\n");
+}
+
+void test4(void) {
+  // char classes, as compiled by gramparser.
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "all", "(('a'..'z' / '_')+ / (!' ' !'a'..'z' .)+ / ' ')* !.");
+  struct gram * gram = gramparser_get_gram(gp, "all");
+  struct gram_program * prog = compile_gram(gram);
+  dump_gram_program(prog);
+  check(gram, prog, "abc 12_x ;-) \xff");
+  check(gram, prog, "");
+  free_gram_program(prog);
+  free_gramparser(gp);
+  printf("test4 passed!\n\n");
+}
+
+void test5(void) {
+  // binary texts, never read past their length.
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "all", "((!'\\n' .)+ / \"ab\" / 'x'..'z' / '\\n')* !.");
+  struct gram * gram = gramparser_get_gram(gp, "all");
+  struct gram_program * prog = compile_gram(gram);
+  const char text[] = "ab\0\n\nx\0\0";
+  int len, last1, last2, last3;
+  for (len = 0; len < sizeof text; len++) {
+    char * copy = malloc(len + 1);
+    memcpy(copy, text, len);
+    last1 = last2 = last3 = 0;
+    struct ast * ast1 = parse_n(copy, len, gram, &last1);
+    struct ast * ast2 = parse_program_n(prog, copy, len, &last2);
+    assert(ast1 && ast_equal(ast1, ast2) && ast1->len == len);
+    assert(match_program_n(prog, copy, len, &last3) == len);
+    assert(last1 == last2 && last2 == last3);
+    free_ast(ast1);
+    free_ast(ast2);
+    free(copy);
+  }
+  free_gram_program(prog);
+  free_gramparser(gp);
+  printf("test5 passed!\n\n");
+}
+
+// a stream over a string, handed out in chunks of 1 to 7 bytes.
+struct chunks {
+  const char * text;
+  int len, read, grown;
+};
+
+static int read_chunk(void * user_data, char * buf, int size) {
+  struct chunks * c = user_data;
+  int n = c->read % 7 + 1;
+  if (n > size)
+    n = size;
+  if (n > c->len - c->read)
+    n = c->len - c->read;
+  memcpy(buf, c->text + c->read, n);
+  c->read += n;
+  return n;
+}
+
+static void on_grow(void * user_data, int pinned, int new_size) {
+  ((struct chunks *)user_data)->grown = pinned;
+}
+
+// streaming it must agree with parsing it whole, growing the window or not.
+static void check_stream(struct gram_program * prog, const char * text, bool grows) {
+  struct chunks c = { text, strlen(text) };
+  struct gram_stream stream = { read_chunk, &c, 8, on_grow };
+  int last1 = 0, last2 = 0, last3 = 0;
+  struct ast * ast1 = parse_program(prog, text, &last1);
+  struct ast * ast2 = parse_program_stream(prog, &stream, &last2);
+  assert(ast_equal(ast1, ast2) && last1 == last2);
+  printf("streaming %d bytes: grows=%d, max_window=%d\n", c.len, stream.grows, stream.max_window);
+  assert(!stream.grows == !grows);
+  c.read = 0;
+  assert(match_program_stream(prog, &stream, &last3) == (ast1 ? ast1->len : -1));
+  assert(last1 == last3);
+  if (ast1) {
+    free_ast(ast1);
+    free_ast(ast2);
+  }
+}
+
+void test6(void) {
+  // streams are read through a small window, unless backtracking needs more.
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "line", "(!'\\n' .)* '\\n'");
+  gramparser_add(gp, "all", "(line / 'x' ('0'..'9')+ &'y' / ('0'..'9')+ / ' ')* !.");
+  assert(gramparser_is_complete(gp));
+  struct gram * gram = gramparser_get_gram(gp, "all");
+  struct gram_program * prog = compile_gram(gram);
+  int i, n = 10000;
+  char * text = malloc(n + 1);
+  for (i = 0; i < n; i++)
+    text[i] = i % 5 == 4 ? '\n' : 'a' + i % 5;
+  text[n] = '\0';
+  check_stream(prog, text, false);
+  check_stream(prog, "12 x34y", false);
+  check_stream(prog, "0123456789", true); // a span longer than the window.
+  // the last line never ends, so it may backtrack to its start.
+  for (i = n - 100; i < n; i++)
+    text[i] = 'x';
+  check_stream(prog, text, true);
+  int fds[2];
+  assert(pipe(fds) == 0);
+  assert(write(fds[1], "ab\ncd\n", 6) == 6);
+  close(fds[1]);
+  struct gram_stream stream = { gram_stream_read_fd, (void *)(intptr_t)fds[0] };
+  assert(match_program_stream(prog, &stream, NULL) == 6 && stream.max_window == 1 << 16);
+  close(fds[0]);
+  free(text);
+  free_gram_program(prog);
+  free_gramparser(gp);
+  printf("test6 passed!\n\n");
+}
+
+// as ast_equal, but comparing the names the user_data point to.
+static int ast_same_names(struct ast * a, struct ast * b) {
+  int i;
+  if (!a || !b)
+    return a == b;
+  if ((a->user_data && b->user_data ? strcmp(a->user_data, b->user_data) : a->user_data != b->user_data)
+      || a->from != b->from || a->len != b->len)
+    return 0;
+  for (i = 0; a->children[i] && b->children[i]; i++)
+    if (!ast_same_names(a->children[i], b->children[i]))
+      return 0;
+  return !a->children[i] && !b->children[i];
+}
+
+// copies the instruction from (-1 for the last one) over the instruction to
+// of a saved program (a 32 bytes header, then 8 bytes per instruction).
+static void patch_program(const char * path, int to, int from) {
+  FILE * f = fopen(path, "r+b");
+  int code_count;
+  char instr[8];
+  assert(f && !fseek(f, 12, SEEK_SET) && fread(&code_count, sizeof (int), 1, f) == 1);
+  if (from < 0)
+    from = code_count - 1;
+  assert(!fseek(f, 32 + 8 * from, SEEK_SET) && fread(instr, 8, 1, f) == 1);
+  assert(!fseek(f, 32 + 8 * to, SEEK_SET) && fwrite(instr, 8, 1, f) == 1);
+  fclose(f);
+}
+
+void test7(void) {
+  const char * texts[] = {"1+1*(2+1)+3", "((((12))))*(3+4*(5))", "1+(2*3", "1+2)", "7", NULL};
+  const char * path = "gramvm-test.prog";
+  struct gramparser * gp = new_gramparser();
+  gramparser_add(gp, "atom", "('0'..'9')+ / '(' adds ')'");
+  gramparser_add(gp, "mults", "atom ('*' atom)*");
+  gramparser_add(gp, "adds", "mults ('+' mults)*");
+  gramparser_add(gp, "all", "adds !.");
+  struct gram * gram = gramparser_get_gram(gp, "all");
+  gram_analyze(gram);
+  struct gram_program * prog = compile_gram(gram), * loaded;
+  int i;
+  assert(save_gram_program(prog, path) == 0);
+  assert((loaded = load_gram_program(path)));
+  for (i = 0; texts[i]; i++) {
+    int last1 = 0, last2 = 0;
+    struct ast * ast1 = parse_program(prog, texts[i], &last1);
+    struct ast * ast2 = parse_program(loaded, texts[i], &last2);
+    assert(ast_same_names(ast1, ast2) && last1 == last2);
+    assert(!ast2 || ast2->user_data != ast1->user_data);
+    if (ast1) {
+      free_ast(ast1);
+      free_ast(ast2);
+    }
+  }
+  free_gram_program(loaded);
+  // nor is a corrupt one, whose frames don't balance: a RET in place of the
+  // first instruction finds no frame to return from.
+  patch_program(path, 0, -1);
+  assert(!load_gram_program(path));
+  // one that doesn't build the root fails to parse.
+  gram = gramparser_get_gram(gp, "atom");
+  free_gram_program(prog);
+  prog = compile_gram(gram);
+  assert(save_gram_program(prog, path) == 0);
+  patch_program(path, 0, 1);
+  assert((loaded = load_gram_program(path)));
+  assert(!parse_program(loaded, "7", NULL));
+  free_gram_program(loaded);
+  assert(save_gram_program(prog, path) == 0);
+  // a program without names, nor strings.
+  struct gram * x = new_gram_string(NULL, "x");
+  free_gram_program(prog);
+  prog = compile_gram(x);
+  assert(save_gram_program(prog, path) == 0);
+  assert((loaded = load_gram_program(path)));
+  assert(match_program(loaded, "x", NULL) == 1);
+  free_gram_program(loaded);
+  // nothing is left of a file that couldn't be written.
+  struct rlimit limit, saved;
+  assert(!getrlimit(RLIMIT_FSIZE, &saved));
+  limit = saved;
+  limit.rlim_cur = 16;
+  signal(SIGXFSZ, SIG_IGN);
+  assert(!setrlimit(RLIMIT_FSIZE, &limit));
+  assert(save_gram_program(prog, path) == -1);
+  assert(!setrlimit(RLIMIT_FSIZE, &saved));
+  assert(access(path, F_OK) == -1);
+  free_gram_program(prog);
+  free_gram(x);
+  prog = compile_gram(gram);
+  assert(save_gram_program(prog, path) == 0);
+  // a truncated file isn't loaded.
+  assert(truncate(path, 64) == 0);
+  assert(!load_gram_program(path));
+  unlink(path);
+  assert(!load_gram_program(path));
+  free_gram_program(prog);
+  free_gramparser(gp);
+  printf("test7 passed!\n\n");
+}
+
+int main(void) {
+  test1();
+  test2();
+  test3();
+  test4();
+  test5();
+  test6();
+  test7();
+  return 0;
+}
@@ -0,0 +1,1243 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gram.h"
+#include "gram-private.h"
+#include "gramvm.h"
+
+/************************************************************************\
+*				 PROGRAM				 *
+* Every gram is compiled into a few instructions wrapping the code of	 *
+* its children with OPEN/CLOSE (so the same nodes are built). Grams	 *
+* referenced more than once (rules, recursion) become subroutines.	 *
+\************************************************************************/
+
+enum vm_opcode {
+  VM_END,      // the whole grammar matched.
+  VM_FAIL,     // backtracks to the last choice.
+  VM_CHAR,     // matches the byte arg.
+  VM_STRING,   // matches the NUL terminated literal at strings + arg.
+  VM_RANGE,    // matches a byte in [arg & 0xff, arg >> 8].
+  VM_CLASS,    // matches a byte in the 32 bytes bitmap at strings + arg.
+  VM_ANY,      // matches any byte but the terminating NUL.
+  VM_GRAM,     // calls the matcher of grams[arg] (ints, spans, custom grams).
+  VM_CHOICE,   // pushes a backtrack entry resuming at arg.
+  VM_NCHOICE,  // same as VM_CHOICE, but last is restored as well.
+  VM_COMMIT,   // pops the backtrack entry and jumps to arg.
+  VM_LOOP,     // updates the backtrack entry to the cursor and jumps to arg.
+  VM_FAILTWICE,// pops the (negative lookahead) backtrack entry and fails.
+  VM_LOOK,     // remembers the cursor and last of a positive lookahead.
+  VM_UNLOOK,   // restores them.
+  VM_CALL,     // pushes the return address and jumps to arg.
+  VM_RET,      // returns from the subroutine.
+  VM_OPEN,     // a node starts here.
+  VM_CLOSE,    // reduces the nodes since the matching VM_OPEN, filtered
+	       // as arg (a filter_ast_mode).
+  VM_LEAF,     // pushes an empty node.
+  VM_TESTSET,  // unless the byte is in the bitmap at strings + arg, jumps to
+	       // ud (skipping an alternative that can't start with it).
+  VM_JUMP,     // jumps to arg.
+};
+
+static const char * vm_opcode_names[] = {
+  "end", "fail", "char", "string", "range", "class", "any", "gram", "choice", "nchoice",
+  "commit", "loop", "failtwice", "look", "unlook", "call", "ret",
+  "open", "close", "leaf", "testset", "jump",
+};
+
+struct vm_instr {
+  unsigned op:8;
+  unsigned ud:24; // index of the user_data of the node it builds, 0 is NULL
+		  // (VM_TESTSET builds none, it's its target instead).
+  int arg;
+};
+
+struct gram_program {
+  struct vm_instr * code;
+  int code_count;
+  void ** user_datas;
+  int user_datas_count;
+  char * strings;
+  int strings_len;
+  struct gram ** grams;
+  int grams_count;
+  // loaded programs only: the file mapped, where code and strings are.
+  void * map;
+  size_t map_size;
+};
+
+/************************************************************************\
+*				 COMPILER				 *
+\************************************************************************/
+
+// a pointer keyed open addressing hash table.
+struct ptrmap_entry {
+  const void * key; // NULL for empty slots.
+  int refs;
+  int index;
+};
+
+struct ptrmap {
+  int size, count;
+  struct ptrmap_entry * entries;
+};
+
+static void ptrmap_init(struct ptrmap * map) {
+  map->size = 64;
+  map->count = 0;
+  map->entries = calloc(map->size, sizeof (struct ptrmap_entry));
+}
+
+static struct ptrmap_entry * ptrmap_slot(struct ptrmap * map, const void * key) {
+  unsigned mask = map->size - 1;
+  uintptr_t h = (uintptr_t)key >> 4;
+  unsigned i = (unsigned)(h ^ (h >> 15)) * 0x9e3779b1u & mask;
+  while (map->entries[i].key && map->entries[i].key != key)
+    i = (i + 1) & mask;
+  return &map->entries[i];
+}
+
+// returns the entry for key, adding it (zeroed, index -1) if needed.
+static struct ptrmap_entry * ptrmap_get(struct ptrmap * map, const void * key) {
+  struct ptrmap_entry * e = ptrmap_slot(map, key);
+  if (e->key)
+    return e;
+  if (2 * (map->count + 1) > map->size) {
+    struct ptrmap_entry * old = map->entries;
+    int i, oldsize = map->size;
+    map->size *= 2;
+    map->entries = calloc(map->size, sizeof (struct ptrmap_entry));
+    for (i = 0; i < oldsize; i++)
+      if (old[i].key)
+	*ptrmap_slot(map, old[i].key) = old[i];
+    free(old);
+    e = ptrmap_slot(map, key);
+  }
+  e->key = key;
+  e->refs = 0;
+  e->index = -1;
+  map->count++;
+  return e;
+}
+
+struct compiler {
+  struct vm_instr * code;
+  int code_count, code_size;
+  void ** user_datas;
+  int user_datas_count, user_datas_size;
+  char * strings;
+  int strings_len, strings_size;
+  struct gram ** grams;
+  int grams_count, grams_size;
+  struct ptrmap refs; // how many times every gram is referenced.
+  struct ptrmap uds;  // index of every user_data.
+  // grams compiled as subroutines, and their addresses:
+  struct gram ** subs;
+  int * subs_addr;
+  int subs_count, subs_size;
+  struct gram * root; // filtered, but not its node at the root of the tree.
+};
+
+#define GROW(arr, count, size) do { \
+  if ((count) == (size)) { \
+    (size) = (size) ? 2 * (size) : 64; \
+    (arr) = realloc((arr), sizeof (*(arr)) * (size)); \
+  } } while (0)
+
+static int emit(struct compiler * c, enum vm_opcode op, void * user_data, int arg) {
+  int ud = 0;
+  if (user_data) {
+    struct ptrmap_entry * e = ptrmap_get(&c->uds, user_data);
+    if (e->index < 0) {
+      GROW(c->user_datas, c->user_datas_count, c->user_datas_size);
+      e->index = c->user_datas_count;
+      c->user_datas[c->user_datas_count++] = user_data;
+    }
+    ud = e->index;
+  }
+  GROW(c->code, c->code_count, c->code_size);
+  c->code[c->code_count] = (struct vm_instr){op, ud, arg};
+  return c->code_count++;
+}
+
+// len bytes of data are copied, and then a NUL.
+static int add_string(struct compiler * c, const void * data, int len) {
+  int offset = c->strings_len;
+  while (c->strings_len + len + 1 > c->strings_size) {
+    c->strings_size = c->strings_size ? 2 * c->strings_size : 256;
+    c->strings = realloc(c->strings, c->strings_size);
+  }
+  memcpy(c->strings + offset, data, len);
+  c->strings[offset + len] = '\0';
+  c->strings_len += len + 1;
+  return offset;
+}
+
+static void count_refs(struct compiler * c, struct gram * gram) {
+  int i;
+  struct ptrmap_entry * e = ptrmap_get(&c->refs, gram);
+  if (e->refs++)
+    return; // its children were already counted.
+  switch (gram->type) {
+    case GRAM_OPT: case GRAM_PLUS: case GRAM_ASTER:
+    case GRAM_POSLA: case GRAM_NEGLA:
+      count_refs(c, ((struct gram_child *)gram)->child);
+      break;
+    case GRAM_ALT: case GRAM_CAT:
+      for (i = 0; ((struct gram_children *)gram)->children[i]; i++)
+	count_refs(c, ((struct gram_children *)gram)->children[i]);
+      break;
+    default:
+      break;
+  }
+}
+
+static void emit_call(struct compiler * c, struct gram * gram) {
+  struct ptrmap_entry * e = ptrmap_get(&c->refs, gram);
+  if (e->index < 0) {
+    GROW(c->subs, c->subs_count, c->subs_size);
+    c->subs_addr = realloc(c->subs_addr, sizeof (int) * c->subs_size);
+    e->index = c->subs_count;
+    c->subs[c->subs_count] = gram;
+    c->subs_addr[c->subs_count++] = -1;
+  }
+  emit(c, VM_CALL, NULL, e->index); // patched once every sub is emitted.
+}
+
+static void emit_body(struct compiler * c, struct gram * gram);
+
+static bool is_terminal(struct gram * gram) {
+  return gram->type == GRAM_DOT || gram->type == GRAM_STRING || gram->type == GRAM_RANGE
+    || gram->type == GRAM_CLASS || gram->type == GRAM_SPAN || gram->type == GRAM_INT || gram->type == GRAM_CUSTOM;
+}
+
+static void emit_gram(struct compiler * c, struct gram * gram) {
+  // terminals are always copied, there's nothing to gain calling them.
+  if (!is_terminal(gram) && ptrmap_get(&c->refs, gram)->refs > 1)
+    emit_call(c, gram);
+  else
+    emit_body(c, gram);
+}
+
+// before an alternative that can't match an empty text: then its first
+// byte tells (once analyzed) if it's worth a try. It returns the test, to
+// be patched with the address of the next alternative, or -1.
+static int emit_test(struct compiler * c, struct gram * gram) {
+  if (gram->nullable)
+    return -1;
+  return emit(c, VM_TESTSET, NULL, add_string(c, gram->first, 32));
+}
+
+// whether no alternative after the first one may start like it does, so
+// once it starts there's nothing else to try.
+static bool is_exclusive(struct gram ** alts) {
+  int i, j;
+  for (i = 1; alts[i]; i++) {
+    if (alts[i]->nullable)
+      return false;
+    for (j = 0; j < 32; j++)
+      if (alts[0]->first[j] & alts[i]->first[j])
+	return false;
+  }
+  return true;
+}
+
+static void emit_body(struct compiler * c, struct gram * gram) {
+  int i, l, l2, t;
+  struct gram * child;
+  enum filter_ast_mode filter = gram->filter;
+  if (gram == c->root) {
+    filter = FILTER_AST_KEEP;
+    c->root = NULL; // its references are filtered.
+  }
+  // the leaves of terminals have no children to keep: if they're filtered
+  // out, they're dropped by a node around them.
+  bool dropped = is_terminal(gram)
+    && (filter == FILTER_AST_DISCARD || filter == FILTER_AST_ONLY_KEEP_CHILDREN);
+  if (dropped)
+    emit(c, VM_OPEN, NULL, 0);
+  switch (gram->type) {
+    case GRAM_DOT:
+      emit(c, VM_ANY, gram->user_data, 0);
+      break;
+    case GRAM_STRING: {
+      struct gram_string * g = (struct gram_string *)gram;
+      if (g->len == 1)
+	emit(c, VM_CHAR, gram->user_data, (unsigned char)g->text[0]);
+      else
+	emit(c, VM_STRING, gram->user_data, add_string(c, g->text, g->len));
+      break;
+    }
+    case GRAM_RANGE: {
+      struct gram_range * g = (struct gram_range *)gram;
+      emit(c, VM_RANGE, gram->user_data,
+	  (unsigned char)g->from | (unsigned char)g->to << 8);
+      break;
+    }
+    case GRAM_CLASS:
+      emit(c, VM_CLASS, gram->user_data,
+	  add_string(c, ((struct gram_class *)gram)->set, 32));
+      break;
+    case GRAM_SPAN: case GRAM_INT: case GRAM_CUSTOM:
+      GROW(c->grams, c->grams_count, c->grams_size);
+      c->grams[c->grams_count] = gram;
+      emit(c, VM_GRAM, NULL, c->grams_count++);
+      break;
+    case GRAM_OPT:
+      emit(c, VM_OPEN, NULL, 0);
+      t = emit_test(c, ((struct gram_child *)gram)->child);
+      l = emit(c, VM_CHOICE, NULL, 0);
+      emit_gram(c, ((struct gram_child *)gram)->child);
+      l2 = emit(c, VM_COMMIT, NULL, 0);
+      // (emit may move the code, so it's called first)
+      i = emit(c, VM_CLOSE, gram->user_data, filter);
+      c->code[l].arg = c->code[l2].arg = i;
+      if (t >= 0)
+	c->code[t].ud = c->code[l].arg;
+      break;
+    case GRAM_PLUS: case GRAM_ASTER:
+      child = ((struct gram_child *)gram)->child;
+      // the child of a plus is emitted twice: only terminals are copied,
+      // anything else becomes a subroutine.
+      if (gram->type == GRAM_PLUS && !is_terminal(child))
+	ptrmap_get(&c->refs, child)->refs++;
+      emit(c, VM_OPEN, NULL, 0);
+      if (gram->type == GRAM_PLUS)
+	emit_gram(c, child);
+      l = emit(c, VM_CHOICE, NULL, 0);
+      emit_gram(c, child);
+      emit(c, VM_LOOP, NULL, l + 1);
+      i = emit(c, VM_CLOSE, gram->user_data, filter);
+      c->code[l].arg = i;
+      break;
+    case GRAM_ALT: {
+      struct gram ** children = ((struct gram_children *)gram)->children;
+      int commits = -1; // chained through their args until the end is known.
+      emit(c, VM_OPEN, NULL, 0);
+      for (i = 0; children[i + 1]; i++) {
+	t = emit_test(c, children[i]);
+	if (t >= 0 && is_exclusive(children + i)) {
+	  // if it fails, so would the others: no need to backtrack.
+	  emit_gram(c, children[i]);
+	  commits = emit(c, VM_JUMP, NULL, commits);
+	} else {
+	  l = emit(c, VM_CHOICE, NULL, 0);
+	  emit_gram(c, children[i]);
+	  commits = emit(c, VM_COMMIT, NULL, commits);
+	  c->code[l].arg = c->code_count;
+	}
+	if (t >= 0)
+	  c->code[t].ud = c->code_count;
+      }
+      emit_gram(c, children[i]);
+      while (commits >= 0) {
+	l = c->code[commits].arg;
+	c->code[commits].arg = c->code_count;
+	commits = l;
+      }
+      emit(c, VM_CLOSE, gram->user_data, filter);
+      break;
+    }
+    case GRAM_CAT:
+      emit(c, VM_OPEN, NULL, 0);
+      for (i = 0; ((struct gram_children *)gram)->children[i]; i++)
+	emit_gram(c, ((struct gram_children *)gram)->children[i]);
+      emit(c, VM_CLOSE, gram->user_data, filter);
+      break;
+    case GRAM_POSLA:
+      emit(c, VM_OPEN, NULL, 0);
+      emit(c, VM_LOOK, NULL, 0);
+      emit_gram(c, ((struct gram_child *)gram)->child);
+      emit(c, VM_UNLOOK, NULL, 0);
+      emit(c, VM_CLOSE, gram->user_data, filter);
+      break;
+    case GRAM_NEGLA:
+      l = emit(c, VM_NCHOICE, NULL, 0);
+      emit_gram(c, ((struct gram_child *)gram)->child);
+      emit(c, VM_FAILTWICE, NULL, 0);
+      if (filter == FILTER_AST_DISCARD || filter == FILTER_AST_ONLY_KEEP_CHILDREN)
+	i = emit(c, VM_JUMP, NULL, c->code_count + 1);
+      else
+	i = emit(c, VM_LEAF, gram->user_data, 0);
+      c->code[l].arg = i;
+      break;
+  }
+  if (dropped)
+    emit(c, VM_CLOSE, NULL, FILTER_AST_DISCARD);
+}
+
+struct gram_program * compile_gram(struct gram * gram) {
+  struct compiler c;
+  struct gram_program * prog;
+  int i;
+  if (!gram) {
+    fprintf(stderr, "compile_gram: NULL grammar.\n");
+    return NULL;
+  }
+  memset(&c, 0, sizeof c);
+  ptrmap_init(&c.refs);
+  ptrmap_init(&c.uds);
+  GROW(c.user_datas, c.user_datas_count, c.user_datas_size);
+  c.user_datas[c.user_datas_count++] = NULL;
+  count_refs(&c, gram);
+  // the root is never filtered, so a filtered one is emitted apart from the
+  // subroutine its references call.
+  if (gram->filter != FILTER_AST_KEEP) {
+    c.root = gram;
+    emit_body(&c, gram);
+  } else {
+    emit_gram(&c, gram);
+  }
+  emit(&c, VM_END, NULL, 0);
+  // emitting a subroutine may discover new ones.
+  for (i = 0; i < c.subs_count; i++) {
+    c.subs_addr[i] = c.code_count;
+    emit_body(&c, c.subs[i]);
+    emit(&c, VM_RET, NULL, 0);
+  }
+  for (i = 0; i < c.code_count; i++)
+    if (c.code[i].op == VM_CALL)
+      c.code[i].arg = c.subs_addr[c.code[i].arg];
+  prog = malloc(sizeof (struct gram_program));
+  prog->code = c.code;
+  prog->code_count = c.code_count;
+  prog->user_datas = c.user_datas;
+  prog->user_datas_count = c.user_datas_count;
+  prog->strings = c.strings;
+  prog->strings_len = c.strings_len;
+  prog->grams = c.grams;
+  prog->grams_count = c.grams_count;
+  prog->map = NULL;
+  prog->map_size = 0;
+  free(c.refs.entries);
+  free(c.uds.entries);
+  free(c.subs);
+  free(c.subs_addr);
+  return prog;
+}
+
+void free_gram_program(struct gram_program * prog) {
+  int i;
+  if (prog->map) {
+    munmap(prog->map, prog->map_size);
+    // the grams were rebuilt by load_gram_program.
+    for (i = 0; i < prog->grams_count; i++)
+      free_gram(prog->grams[i]);
+  } else {
+    free(prog->code);
+    free(prog->strings);
+  }
+  free(prog->user_datas);
+  free(prog->grams);
+  free(prog);
+}
+
+static void print_class_byte(int c) {
+  printf(isprint(c) && c != '-' && c != ']' && c != '\\' ? "%c" : "\\x%02x", c);
+}
+
+void dump_gram_program(struct gram_program * prog) {
+  int i, j, k;
+  for (i = 0; i < prog->code_count; i++) {
+    struct vm_instr * in = &prog->code[i];
+    printf("%5d %-9s", i, vm_opcode_names[in->op]);
+    switch (in->op) {
+      case VM_CHAR:
+	printf(" '%c'", in->arg);
+	break;
+      case VM_STRING:
+	printf(" \"%s\"", prog->strings + in->arg);
+	break;
+      case VM_RANGE:
+	printf(" '%c'..'%c'", in->arg & 0xff, in->arg >> 8);
+	break;
+      case VM_CLASS: case VM_TESTSET:
+	// as runs of bytes, e.g. [\x01-/:-\xff] for any but a digit.
+	printf(" [");
+	for (j = 0; j < 256; j = k) {
+	  for (k = j; k < 256 && gram_class_has((unsigned char *)prog->strings + in->arg, k); k++)
+	    ;
+	  if (k > j) {
+	    print_class_byte(j);
+	    if (k - 1 > j) {
+	      printf("-");
+	      print_class_byte(k - 1);
+	    }
+	  } else {
+	    k++;
+	  }
+	}
+	printf("]");
+	if (in->op == VM_TESTSET)
+	  printf(" %d", in->ud);
+	break;
+      case VM_GRAM: case VM_CHOICE: case VM_NCHOICE: case VM_COMMIT:
+      case VM_LOOP: case VM_CALL: case VM_JUMP:
+	printf(" %d", in->arg);
+	break;
+      default:
+	break;
+    }
+    if (in->ud && in->op != VM_TESTSET)
+      printf(" [%p]", prog->user_datas[in->ud]);
+    printf("\n");
+  }
+}
+
+/************************************************************************\
+*				 FILES					 *
+* A saved program is its code and strings as they are in memory, so	 *
+* loading maps them in place. Pointers are saved as offsets: the names	 *
+* (the user_data) follow the strings, and the grams called (spans and	 *
+* ints) are described by their data and built again.			 *
+\************************************************************************/
+
+#define PROGRAM_MAGIC "GRAMVM\0\1"
+
+struct program_header {
+  char magic[8];
+  int instr_size; // sizeof (struct vm_instr), as it's a bit field.
+  int code_count, strings_len, user_datas_count, grams_count;
+  int names_len;
+  // the sections follow in this order, every one aligned to 8 bytes:
+  // code, grams (struct program_gram), user_datas (offsets of the names,
+  // -1 for NULL), strings, names.
+};
+
+struct program_gram {
+  int type; // GRAM_SPAN or GRAM_INT.
+  int min;
+  int name; // as in user_datas.
+  unsigned char set[32];
+};
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+struct names {
+  char * text;
+  int len, size;
+  struct ptrmap offsets; // of every name saved, by pointer.
+};
+
+// the offset of name in names, appending it if it's not there yet.
+static int add_name(struct names * names, const char * name) {
+  struct ptrmap_entry * e;
+  int n;
+  if (!name)
+    return -1;
+  e = ptrmap_get(&names->offsets, name);
+  if (e->index >= 0)
+    return e->index;
+  n = strlen(name);
+  while (names->len + n + 1 > names->size) {
+    names->size = names->size ? 2 * names->size : 256;
+    names->text = realloc(names->text, names->size);
+  }
+  memcpy(names->text + names->len, name, n + 1);
+  e->index = names->len;
+  names->len += n + 1;
+  return e->index;
+}
+
+static bool write_section(FILE * f, const void * data, size_t size) {
+  static const char zeros[8];
+  if (!size) // (data may be NULL)
+    return true;
+  return fwrite(data, 1, size, f) == size && fwrite(zeros, 1, ALIGN8(size) - size, f) == ALIGN8(size) - size;
+}
+
+int save_gram_program(struct gram_program * prog, const char * path) {
+  struct program_header h = {PROGRAM_MAGIC, sizeof (struct vm_instr), prog->code_count,
+    prog->strings_len, prog->user_datas_count, prog->grams_count, 0};
+  struct program_gram * grams = calloc(prog->grams_count + 1, sizeof (struct program_gram));
+  int * user_datas = malloc(sizeof (int) * prog->user_datas_count);
+  struct names names = {NULL, 0, 0};
+  int i, res = -1;
+  FILE * f = NULL;
+  ptrmap_init(&names.offsets);
+  for (i = 0; i < prog->grams_count; i++) {
+    struct gram * g = prog->grams[i];
+    if (g->type == GRAM_CUSTOM) {
+      fprintf(stderr, "save_gram_program: custom grams can't be saved.\n");
+      goto end;
+    }
+    grams[i].type = g->type;
+    if (g->type == GRAM_SPAN) {
+      grams[i].min = ((struct gram_span *)g)->min;
+      memcpy(grams[i].set, ((struct gram_span *)g)->set, 32);
+    }
+    grams[i].name = add_name(&names, g->user_data);
+  }
+  for (i = 0; i < prog->user_datas_count; i++)
+    user_datas[i] = add_name(&names, prog->user_datas[i]);
+  h.names_len = names.len;
+  if (!(f = fopen(path, "wb"))
+      || !write_section(f, &h, sizeof h)
+      || !write_section(f, prog->code, sizeof (struct vm_instr) * prog->code_count)
+      || !write_section(f, grams, sizeof (struct program_gram) * prog->grams_count)
+      || !write_section(f, user_datas, sizeof (int) * prog->user_datas_count)
+      || !write_section(f, prog->strings, prog->strings_len)
+      || !write_section(f, names.text, names.len)) {
+    perror(path);
+    goto end;
+  }
+  res = 0;
+end:
+  if (f && fclose(f) && !res) {
+    perror(path);
+    res = -1;
+  }
+  // no truncated program is left behind.
+  if (f && res)
+    unlink(path);
+  free(grams);
+  free(user_datas);
+  free(names.text);
+  free(names.offsets.entries);
+  return res;
+}
+
+// the frames open at every instruction, within its subroutine.
+struct frames_check {
+  // the instruction that pushed the top one (the frames below it being
+  // those open there), -1 if there's none, -2 if it wasn't reached yet.
+  int * top;
+  bool * sub; // reached within a subroutine.
+  int * todo, todo_count;
+  int code_count;
+};
+
+// whether pc may be reached with these frames, as on every other path.
+static bool reach(struct frames_check * fc, int pc, int top, bool sub) {
+  if (pc >= fc->code_count)
+    return false;
+  if (fc->top[pc] == -2) {
+    fc->top[pc] = top;
+    fc->sub[pc] = sub;
+    fc->todo[fc->todo_count++] = pc;
+    return true;
+  }
+  return fc->top[pc] == top && fc->sub[pc] == sub;
+}
+
+/**
+ * whether every instruction taking a frame finds the one it expects on
+ * top, so a corrupt program can't take one that isn't there. Compiled
+ * programs are structured: the frames open at an instruction are the same
+ * whatever the path to it.
+ */
+static bool check_frames(struct gram_program * prog) {
+  int n = prog->code_count;
+  struct frames_check fc = {malloc(sizeof (int) * n), malloc(n), malloc(sizeof (int) * n), 0, n};
+  int pc, top, below;
+  bool ok, choice;
+  for (pc = 0; pc < n; pc++)
+    fc.top[pc] = -2;
+  ok = reach(&fc, 0, -1, false);
+  while (ok && fc.todo_count) {
+    pc = fc.todo[--fc.todo_count];
+    struct vm_instr * in = &prog->code[pc];
+    bool sub = fc.sub[pc];
+    top = fc.top[pc];
+    below = top >= 0 ? fc.top[top] : -1;
+    choice = top >= 0 && (prog->code[top].op == VM_CHOICE || prog->code[top].op == VM_NCHOICE);
+    switch (in->op) {
+      case VM_END:
+	ok = !sub && top < 0;
+	break;
+      case VM_FAIL:
+	break;
+      case VM_CHOICE: case VM_NCHOICE:
+	ok = reach(&fc, pc + 1, pc, sub) && reach(&fc, in->arg, top, sub);
+	break;
+      case VM_COMMIT:
+	ok = choice && reach(&fc, in->arg, below, sub);
+	break;
+      case VM_LOOP:
+	ok = choice && reach(&fc, in->arg, top, sub);
+	break;
+      case VM_FAILTWICE:
+	ok = choice;
+	break;
+      case VM_LOOK: case VM_OPEN:
+	ok = reach(&fc, pc + 1, pc, sub);
+	break;
+      case VM_UNLOOK:
+	ok = top >= 0 && prog->code[top].op == VM_LOOK && reach(&fc, pc + 1, below, sub);
+	break;
+      case VM_CLOSE:
+	ok = top >= 0 && prog->code[top].op == VM_OPEN && reach(&fc, pc + 1, below, sub);
+	break;
+      case VM_CALL:
+	ok = reach(&fc, in->arg, -1, true) && reach(&fc, pc + 1, top, sub);
+	break;
+      case VM_RET:
+	ok = sub && top < 0;
+	break;
+      case VM_TESTSET:
+	ok = reach(&fc, in->ud, top, sub) && reach(&fc, pc + 1, top, sub);
+	break;
+      case VM_JUMP:
+	ok = reach(&fc, in->arg, top, sub);
+	break;
+      default: // a terminal.
+	ok = reach(&fc, pc + 1, top, sub);
+	break;
+    }
+  }
+  free(fc.top);
+  free(fc.sub);
+  free(fc.todo);
+  return ok;
+}
+
+// whether the operands of the instructions are within the program.
+static bool check_code(struct gram_program * prog) {
+  int i;
+  for (i = 0; i < prog->code_count; i++) {
+    struct vm_instr * in = &prog->code[i];
+    int strings_arg = in->op == VM_STRING ? 1 : in->op == VM_CLASS || in->op == VM_TESTSET ? 32 : 0;
+    if (in->op == VM_STRING && in->arg >= 0 && in->arg < prog->strings_len
+	&& !memchr(prog->strings + in->arg, 0, prog->strings_len - in->arg))
+      return false;
+    if (in->op > VM_JUMP
+	|| (in->op != VM_TESTSET && in->ud >= prog->user_datas_count)
+	|| (in->op == VM_TESTSET && in->ud >= prog->code_count)
+	|| (in->op == VM_GRAM && (in->arg < 0 || in->arg >= prog->grams_count))
+	|| (in->op == VM_CLOSE && (in->arg < FILTER_AST_KEEP || in->arg > FILTER_AST_DISCARD))
+	|| (strings_arg && (in->arg < 0 || in->arg > prog->strings_len - strings_arg))
+	|| ((in->op == VM_CHOICE || in->op == VM_NCHOICE || in->op == VM_COMMIT || in->op == VM_LOOP
+	    || in->op == VM_CALL || in->op == VM_JUMP) && (in->arg < 0 || in->arg >= prog->code_count)))
+      return false;
+  }
+  // nor may it run past its end.
+  return prog->code_count && check_frames(prog);
+}
+
+struct gram_program * load_gram_program(const char * path) {
+  struct gram_program * prog;
+  struct program_header h;
+  struct stat st;
+  size_t offsets[6];
+  void * map;
+  int i, fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st)) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  map = st.st_size >= sizeof h ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "load_gram_program: %s isn't a program.\n", path);
+    return NULL;
+  }
+  memcpy(&h, map, sizeof h);
+  offsets[0] = ALIGN8(sizeof h);
+  if (memcmp(h.magic, PROGRAM_MAGIC, 8) || h.instr_size != sizeof (struct vm_instr)
+      || h.code_count < 0 || h.grams_count < 0 || h.user_datas_count < 1
+      || h.strings_len < 0 || h.names_len < 0
+      // (the sizes are ints, so the offsets don't overflow)
+      || (offsets[1] = offsets[0] + ALIGN8(sizeof (struct vm_instr) * (size_t)h.code_count),
+	offsets[2] = offsets[1] + ALIGN8(sizeof (struct program_gram) * (size_t)h.grams_count),
+	offsets[3] = offsets[2] + ALIGN8(sizeof (int) * (size_t)h.user_datas_count),
+	offsets[4] = offsets[3] + ALIGN8(h.strings_len),
+	offsets[5] = offsets[4] + ALIGN8(h.names_len)) > st.st_size
+      || (h.names_len && ((char *)map)[offsets[4] + h.names_len - 1])) {
+    fprintf(stderr, "load_gram_program: %s isn't a program (of this build).\n", path);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  const struct program_gram * grams = (void *)((char *)map + offsets[1]);
+  const int * user_datas = (void *)((char *)map + offsets[2]);
+  const char * names = (char *)map + offsets[4];
+  prog = malloc(sizeof (struct gram_program));
+  prog->map = map;
+  prog->map_size = st.st_size;
+  prog->code = (void *)((char *)map + offsets[0]);
+  prog->code_count = h.code_count;
+  prog->strings = (char *)map + offsets[3];
+  prog->strings_len = h.strings_len;
+  prog->user_datas_count = h.user_datas_count;
+  prog->user_datas = malloc(sizeof (void *) * h.user_datas_count);
+  prog->grams_count = 0;
+  prog->grams = malloc(sizeof (struct gram *) * (h.grams_count + 1));
+  bool ok = user_datas[0] == -1;
+  for (i = 0; i < h.user_datas_count; i++) {
+    ok = ok && user_datas[i] >= -1 && user_datas[i] < h.names_len;
+    prog->user_datas[i] = ok && user_datas[i] >= 0 ? (void *)(names + user_datas[i]) : NULL;
+  }
+  for (i = 0; ok && i < h.grams_count; i++) {
+    void * name = grams[i].name >= 0 && grams[i].name < h.names_len ? (void *)(names + grams[i].name) : NULL;
+    if (grams[i].type == GRAM_SPAN && grams[i].min >= 0)
+      prog->grams[prog->grams_count++] = new_gram_span(name, grams[i].set, 0, grams[i].min);
+    else if (grams[i].type == GRAM_INT)
+      prog->grams[prog->grams_count++] = new_gram_int(name);
+    else
+      ok = false;
+  }
+  if (!ok || !check_code(prog)) {
+    fprintf(stderr, "load_gram_program: %s is corrupt.\n", path);
+    free_gram_program(prog);
+    return NULL;
+  }
+  return prog;
+}
+
+/************************************************************************\
+*				 MACHINE				 *
+\************************************************************************/
+
+enum vm_frame_kind {
+  FRAME_CALL,    // pc is the return address, cursor where it was called.
+  FRAME_NODE,    // cursor and mark of an open node.
+  FRAME_CHOICE,  // where to resume (pc, cursor, mark) on failure.
+  FRAME_NCHOICE, // same as FRAME_CHOICE, restoring last too.
+  FRAME_LOOK,    // cursor and last before a positive lookahead.
+};
+
+struct vm_frame {
+  enum vm_frame_kind kind;
+  int pc;
+  int cursor;
+  int last;
+  struct gram_mark mark;
+};
+
+// the text of a stream still reachable: [base, state->len).
+struct vm_window {
+  struct gram_stream * stream;
+  char * buf;
+  int base, size;
+  bool eof;
+};
+
+/**
+ * whether the last subroutine called is being called again at the same
+ * cursor, without returning: a left recursion, which would grow the stack
+ * forever. The cursors of the calls never decrease up the stack.
+ */
+static bool vm_left_recursion(const struct vm_instr * code, struct vm_frame * frames, int frames_count) {
+  int i, top = -1;
+  for (i = frames_count - 1; i >= 0; i--) {
+    if (frames[i].kind != FRAME_CALL)
+      continue;
+    if (top < 0)
+      top = i;
+    else if (frames[i].cursor != frames[top].cursor)
+      return false;
+    else if (code[frames[i].pc - 1].arg == code[frames[top].pc - 1].arg)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * doubles the stack, or returns false if it can't grow anymore. It's only
+ * limited by memory, but left recursions are stopped (checked here, so
+ * it costs nothing to the other pushes).
+ */
+static bool vm_grow(const struct vm_instr * code, struct vm_frame ** frames, int frames_count,
+    int * frames_size) {
+  int size = *frames_size ? 2 * *frames_size : 256;
+  struct vm_frame * grown;
+  if (*frames_size > INT_MAX / 2 || vm_left_recursion(code, *frames, frames_count)
+      || !(grown = realloc(*frames, sizeof (struct vm_frame) * size)))
+    return false;
+  *frames = grown;
+  *frames_size = size;
+  return true;
+}
+
+/**
+ * reads the stream until the text reaches upto (or it ends). The bytes
+ * before the cursor and the frames that may take it back are forgotten.
+ */
+static void vm_fill(struct vm_window * w, struct vm_frame * frames, int frames_count,
+    int cursor, int upto, struct gram_state * state) {
+  int low = cursor, used, n, i;
+  for (i = 0; i < frames_count; i++)
+    if ((frames[i].kind == FRAME_CHOICE || frames[i].kind == FRAME_NCHOICE
+	  || frames[i].kind == FRAME_LOOK) && frames[i].cursor < low)
+      low = frames[i].cursor;
+  while (state->len < upto && !w->eof) {
+    if (low > w->base) {
+      memmove(w->buf, w->buf + (low - w->base), state->len - low);
+      w->base = low;
+    }
+    used = state->len - w->base;
+    if (used == w->size) {
+      if (w->stream->grow)
+	w->stream->grow(w->stream->user_data, low, 2 * w->size);
+      w->size *= 2;
+      w->buf = realloc(w->buf, w->size);
+      w->stream->grows++;
+      if (w->size > w->stream->max_window)
+	w->stream->max_window = w->size;
+    }
+    n = w->stream->refill(w->stream->user_data, w->buf + used, w->size - used);
+    if (n > 0)
+      state->len += n;
+    else
+      w->eof = true;
+  }
+}
+
+/**
+ * runs the program over text, or over the window w when streaming. Then
+ * text is biased by the window base, so it's still indexed by the cursor.
+ * Always inlined, so that texts in memory don't pay for streams.
+ */
+static int run_program_window(struct gram_program * prog, const char * text, struct gram_state * state,
+    struct vm_window * w) {
+  static const void * const ops[] = {
+    &&op_VM_END, &&op_VM_FAIL, &&op_VM_CHAR, &&op_VM_STRING, &&op_VM_RANGE, &&op_VM_CLASS,
+    &&op_VM_ANY, &&op_VM_GRAM, &&op_VM_CHOICE, &&op_VM_NCHOICE, &&op_VM_COMMIT, &&op_VM_LOOP,
+    &&op_VM_FAILTWICE, &&op_VM_LOOK, &&op_VM_UNLOOK, &&op_VM_CALL, &&op_VM_RET,
+    &&op_VM_OPEN, &&op_VM_CLOSE, &&op_VM_LEAF, &&op_VM_TESTSET, &&op_VM_JUMP,
+  };
+  const struct vm_instr * code = prog->code, * in;
+  struct vm_frame * frames = state->frames, * f;
+  int frames_count = 0, frames_size = state->frames_size;
+  int pc = 0, cursor = 0, end = state->len, len;
+  const char * s;
+  struct gram * g;
+  bool build = state->build;
+  struct gram_mark start = gram_state_mark(state);
+  // custom grams count their depth too.
+  state->depth = 0;
+  state->max_depth = GRAM_MAX_DEPTH;
+
+// whether the text has n bytes, reading them if streaming.
+#define HAS(n) ((n) <= end || (w && (vm_fill(w, frames, frames_count, cursor, (n), state), \
+	text = w->buf - w->base, end = state->len, (n) <= end)))
+
+// jumps to the code of the instruction at pc (a computed goto, so every
+// instruction has its own indirect jump to predict).
+#define NEXT do { in = &code[pc]; goto *ops[in->op]; } while (0)
+
+#define PUSH(frame_kind) do { \
+  if (frames_count == frames_size && !vm_grow(code, &frames, frames_count, &frames_size)) \
+    goto overflow; \
+  f = &frames[frames_count++]; \
+  f->kind = frame_kind; } while (0)
+
+  NEXT;
+  op_VM_END:
+    // a program from a file may not build the root.
+    if (build && !state->record_events && state->nodes_count != start.nodes + 1)
+      goto fail;
+    len = cursor;
+    goto done;
+  op_VM_FAIL:
+    goto fail;
+  op_VM_CHAR:
+    if (!HAS(cursor + 1) || (unsigned char)text[cursor] != in->arg)
+      goto fail;
+    if (cursor + 1 > state->last)
+      state->last = cursor + 1;
+    if (build)
+      gram_state_leaf(state, prog->user_datas[in->ud], cursor, 1);
+    cursor++;
+    pc++;
+    NEXT;
+  op_VM_STRING:
+    for (s = prog->strings + in->arg, len = 0; s[len]; len++)
+      if (!HAS(cursor + len + 1) || text[cursor + len] != s[len])
+	goto fail;
+    if (cursor + len > state->last)
+      state->last = cursor + len;
+    if (build)
+      gram_state_leaf(state, prog->user_datas[in->ud], cursor, len);
+    cursor += len;
+    pc++;
+    NEXT;
+  op_VM_RANGE:
+    if (!HAS(cursor + 1) || (char)(in->arg & 0xff) > text[cursor] || text[cursor] > (char)(in->arg >> 8))
+      goto fail;
+    if (cursor + 1 > state->last)
+      state->last = cursor + 1;
+    if (build)
+      gram_state_leaf(state, prog->user_datas[in->ud], cursor, 1);
+    cursor++;
+    pc++;
+    NEXT;
+  op_VM_CLASS:
+    if (!HAS(cursor + 1) || !gram_class_has((unsigned char *)prog->strings + in->arg, text[cursor]))
+      goto fail;
+    if (cursor + 1 > state->last)
+      state->last = cursor + 1;
+    if (build)
+      gram_state_leaf(state, prog->user_datas[in->ud], cursor, 1);
+    cursor++;
+    pc++;
+    NEXT;
+  op_VM_ANY:
+    if (!HAS(cursor + 1))
+      goto fail;
+    if (cursor + 1 > state->last)
+      state->last = cursor + 1;
+    if (build)
+      gram_state_leaf(state, prog->user_datas[in->ud], cursor, 1);
+    cursor++;
+    pc++;
+    NEXT;
+  op_VM_GRAM:
+    g = prog->grams[in->arg];
+    if (!w) {
+      len = g->matcher(text, cursor, g, state);
+    } else {
+      // it may stop at the end of the window rather than of the text.
+      struct gram_mark mark = gram_state_mark(state);
+      int last = state->last;
+      (void)HAS(cursor + 1);
+      len = g->matcher(text, cursor, g, state);
+      while (state->last >= end && !w->eof) {
+	gram_state_drop(state, mark);
+	state->last = last;
+	(void)HAS(end + 1);
+	len = g->matcher(text, cursor, g, state);
+      }
+    }
+    if (len < 0)
+      goto fail;
+    cursor += len;
+    pc++;
+    NEXT;
+  op_VM_CHOICE: op_VM_NCHOICE:
+    PUSH(in->op == VM_CHOICE ? FRAME_CHOICE : FRAME_NCHOICE);
+    f->pc = in->arg;
+    f->cursor = cursor;
+    f->last = state->last;
+    if (build)
+      f->mark = gram_state_mark(state);
+    pc++;
+    NEXT;
+  op_VM_COMMIT:
+    frames_count--;
+    pc = in->arg;
+    NEXT;
+  op_VM_LOOP:
+    f = &frames[frames_count - 1];
+    if (f->cursor == cursor) {
+      // we reached a dead state... detecting deadlocks is a good thing :D
+      fprintf(stderr, "WARNING: repetition parsing subgrammar with epsilon transitions. E.g: ('a'?)*\n"
+	  "\t(as a fallback) this match will fail, but you MUST fix the grammar.");
+      frames_count--;
+      goto fail;
+    }
+    f->cursor = cursor;
+    if (build)
+      f->mark = gram_state_mark(state);
+    pc = in->arg;
+    NEXT;
+  op_VM_FAILTWICE:
+    state->last = frames[--frames_count].last;
+    goto fail;
+  op_VM_LOOK:
+    PUSH(FRAME_LOOK);
+    f->cursor = cursor;
+    f->last = state->last;
+    pc++;
+    NEXT;
+  op_VM_UNLOOK:
+    f = &frames[--frames_count];
+    cursor = f->cursor;
+    state->last = f->last;
+    pc++;
+    NEXT;
+  op_VM_CALL:
+    PUSH(FRAME_CALL);
+    f->pc = pc + 1;
+    f->cursor = cursor;
+    pc = in->arg;
+    NEXT;
+  op_VM_RET:
+    pc = frames[--frames_count].pc;
+    NEXT;
+  op_VM_OPEN:
+    if (build) {
+      PUSH(FRAME_NODE);
+      f->cursor = cursor;
+      f->mark = gram_state_mark(state);
+    }
+    pc++;
+    NEXT;
+  op_VM_CLOSE:
+    if (build) {
+      f = &frames[--frames_count];
+      switch (in->arg) {
+	case FILTER_AST_KEEP:
+	  gram_state_reduce(state, f->mark, prog->user_datas[in->ud], f->cursor, cursor - f->cursor);
+	  break;
+	case FILTER_AST_ONLY_KEEP_CHILDREN:
+	  break; // they're left where its node would be.
+	case FILTER_AST_LEAF:
+	  gram_state_drop(state, f->mark);
+	  gram_state_leaf(state, prog->user_datas[in->ud], f->cursor, cursor - f->cursor);
+	  break;
+	default:
+	  gram_state_drop(state, f->mark);
+	  break;
+      }
+    }
+    pc++;
+    NEXT;
+  op_VM_LEAF:
+    if (build)
+      gram_state_leaf(state, prog->user_datas[in->ud], cursor, 0);
+    pc++;
+    NEXT;
+  op_VM_TESTSET:
+    if (!HAS(cursor + 1) || !gram_class_has((unsigned char *)prog->strings + in->arg, text[cursor]))
+      pc = in->ud;
+    else
+      pc++;
+    NEXT;
+  op_VM_JUMP:
+    pc = in->arg;
+    NEXT;
+fail:
+  // unwinds up to the last choice.
+  do {
+    if (!frames_count) {
+      gram_state_drop(state, start);
+      len = -1;
+      goto done;
+    }
+    f = &frames[--frames_count];
+    if (f->kind == FRAME_LOOK || f->kind == FRAME_NCHOICE)
+      state->last = f->last;
+  } while (f->kind != FRAME_CHOICE && f->kind != FRAME_NCHOICE);
+  cursor = f->cursor;
+  if (build)
+    gram_state_drop(state, f->mark);
+  pc = f->pc;
+  NEXT;
+overflow:
+  gram_state_drop(state, start);
+  state->overflow = true;
+  len = -1;
+done:
+  state->frames = frames;
+  state->frames_size = frames_size;
+  return len;
+#undef PUSH
+#undef NEXT
+#undef HAS
+}
+
+int gram_program_run(struct gram_program * prog, const char * text, struct gram_state * state) {
+  return run_program_window(prog, text, state, NULL);
+}
+
+static int run_program(struct gram_program * prog, const char * text, struct gram_state * state) {
+  int len = gram_program_run(prog, text, state);
+  free(state->frames);
+  return len;
+}
+
+struct ast * parse_program(struct gram_program * prog, const char * text, int * last) {
+  return parse_program_arena_n(NULL, prog, text, strlen(text), last);
+}
+
+struct ast * parse_program_n(struct gram_program * prog, const char * text, int len, int * last) {
+  return parse_program_arena_n(NULL, prog, text, len, last);
+}
+
+struct ast * parse_program_arena(struct ast_arena * arena, struct gram_program * prog,
+    const char * text, int * last) {
+  return parse_program_arena_n(arena, prog, text, strlen(text), last);
+}
+
+struct ast * parse_program_arena_n(struct ast_arena * arena, struct gram_program * prog,
+    const char * text, int len, int * last) {
+  struct gram_state state = {
+    .len = len,
+    .last = last ? *last : 0,
+    .build = true,
+    .arena = arena,
+  };
+  struct ast * res = NULL;
+  if (run_program(prog, text, &state) >= 0)
+    res = state.nodes[0];
+  free(state.nodes);
+  if (last)
+    *last = state.last;
+  return res;
+}
+
+int match_program(struct gram_program * prog, const char * text, int * last) {
+  return match_program_n(prog, text, strlen(text), last);
+}
+
+int match_program_n(struct gram_program * prog, const char * text, int len, int * last) {
+  struct gram_state state = {
+    .len = len,
+    .last = last ? *last : 0,
+    .build = false,
+  };
+  len = run_program(prog, text, &state);
+  if (last)
+    *last = state.last;
+  return len;
+}
+
+int gram_stream_read_fd(void * user_data, char * buf, int size) {
+  ssize_t n;
+  do
+    n = read((intptr_t)user_data, buf, size);
+  while (n < 0 && errno == EINTR);
+  return n < 0 ? 0 : n;
+}
+
+static int run_program_stream(struct gram_program * prog, struct gram_stream * stream,
+    struct gram_state * state) {
+  struct vm_window w = {
+    .stream = stream,
+    .size = stream->window > 0 ? stream->window : 1 << 16,
+  };
+  int len;
+  w.buf = malloc(w.size);
+  stream->grows = 0;
+  stream->max_window = w.size;
+  len = run_program_window(prog, NULL, state, &w); // the text comes with the first read.
+  free(state->frames);
+  free(w.buf);
+  return len;
+}
+
+struct ast * parse_program_stream(struct gram_program * prog, struct gram_stream * stream, int * last) {
+  struct gram_state state = {
+    .last = last ? *last : 0,
+    .build = true,
+  };
+  struct ast * res = NULL;
+  if (run_program_stream(prog, stream, &state) >= 0)
+    res = state.nodes[0];
+  free(state.nodes);
+  if (last)
+    *last = state.last;
+  return res;
+}
+
+int match_program_stream(struct gram_program * prog, struct gram_stream * stream, int * last) {
+  struct gram_state state = {
+    .last = last ? *last : 0,
+    .build = false,
+  };
+  int len = run_program_stream(prog, stream, &state);
+  if (last)
+    *last = state.last;
+  return len;
+}
@@ -0,0 +1,98 @@
+#ifndef GRAMVM_H
+#define GRAMVM_H 1
+
+#include "gram.h"
+
+/**
+ * a grammar compiled into a flat instruction stream (in the spirit of
+ * LPeg), run by a loop with an explicit backtracking stack instead of one
+ * recursive call per gram. It yields the very same trees (and last) as
+ * parse, but it doesn't memoize.
+ */
+struct gram_program;
+
+/**
+ * compiles gram and everything reachable from it. The program is a
+ * snapshot: later calls to gram_set_child are not seen by it, but the grams
+ * created with new_gram_span, new_gram_int and new_gram_custom are called
+ * from it, so they must outlive the program.
+ */
+struct gram_program * compile_gram(struct gram * gram);
+
+void free_gram_program(struct gram_program * prog);
+
+/**
+ * same as parse/match/parse_arena (without flags) for compiled grammars.
+ */
+struct ast * parse_program(struct gram_program * prog, const char * text, int * last);
+int match_program(struct gram_program * prog, const char * text, int * last);
+struct ast * parse_program_arena(struct ast_arena * arena, struct gram_program * prog,
+    const char * text, int * last);
+
+/**
+ * same as parse_n/match_n/parse_arena_n for compiled grammars.
+ */
+struct ast * parse_program_n(struct gram_program * prog, const char * text, int len, int * last);
+int match_program_n(struct gram_program * prog, const char * text, int len, int * last);
+struct ast * parse_program_arena_n(struct ast_arena * arena, struct gram_program * prog,
+    const char * text, int len, int * last);
+
+/**
+ * an input read in chunks, for texts too big to be held in memory.
+ */
+struct gram_stream {
+  // reads up to size bytes into buf, returning how many (0 at the end of
+  // the input, or on errors).
+  int (*refill)(void * user_data, char * buf, int size);
+  void * user_data;
+  int window; // initial size of the window of text kept, 0 for 64k.
+  // if not NULL, called before the window grows because every byte in it
+  // may still be read again, from pinned on (the position of the oldest
+  // backtrack point or lookahead still alive, or of the token in progress).
+  void (*grow)(void * user_data, int pinned, int new_size);
+  // filled in by the parse:
+  int grows; // times the window had to grow.
+  int max_window; // its largest size.
+};
+
+/**
+ * a refill for gram_stream reading the file descriptor (intptr_t)user_data.
+ */
+int gram_stream_read_fd(void * user_data, char * buf, int size);
+
+/**
+ * same as parse_program_n/match_program_n, but over the text read from
+ * stream. Only the bytes the program may still read are kept, so memory is
+ * bounded by the window unless the grammar backtracks or looks ahead far
+ * (see grow). Positions are counted from the start of the stream, and
+ * the nodes' text is gone by the time they're returned.
+ */
+struct ast * parse_program_stream(struct gram_program * prog, struct gram_stream * stream, int * last);
+int match_program_stream(struct gram_program * prog, struct gram_stream * stream, int * last);
+
+/**
+ * writes prog to the file at path, to be loaded by other processes with
+ * load_gram_program (of the same build of the library, on the same kind of
+ * machine). The user_data of the grams must be NUL terminated names, or
+ * NULL, as those of gramparser's, and they are saved instead of the
+ * pointers. Custom grams can't be saved. It returns 0, or -1 on errors
+ * (removing the file it was writing).
+ */
+int save_gram_program(struct gram_program * prog, const char * path);
+
+/**
+ * maps a file written by save_gram_program: its code and strings are run
+ * from the mapped file, and only the table of names and the spans and ints
+ * called are allocated. The user_data of the nodes point to the names in
+ * the file, so they're only valid until free_gram_program unmaps it. It
+ * returns NULL (printing why) if the file is missing or isn't a program,
+ * its code being checked so it can't run out of it nor of its stack.
+ */
+struct gram_program * load_gram_program(const char * path);
+
+/**
+ * prints the instructions of the program, one per line.
+ */
+void dump_gram_program(struct gram_program * prog);
+
+#endif